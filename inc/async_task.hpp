@@ -0,0 +1,209 @@
+#ifndef _ASYNC_TASK_HPP_
+#define _ASYNC_TASK_HPP_
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#include "async_wait_queue.hpp"
+#include "unordered_map_utils.hpp"
+
+/// Lazily started coroutine returned by the async_ operations of concurrent_unordered_map.
+/// Either co_await it from another coroutine, or call start() and poll isReady() from an event loop.
+/// The task must outlive any suspension of the operation it holds.
+template <class T> class AsyncTask
+{
+public:
+  struct promise_type
+  {
+    std::optional<T> result;
+    std::exception_ptr error;
+    std::coroutine_handle<> continuation;
+    std::atomic<bool> isDone { false }; // polled by isReady (), possibly from another thread than the one resuming
+
+    AsyncTask
+    get_return_object ()
+    {
+      return AsyncTask (std::coroutine_handle<promise_type>::from_promise (*this));
+    }
+
+    std::suspend_always
+    initial_suspend () noexcept
+    {
+      return {};
+    }
+
+    struct FinalAwaiter
+    {
+      bool
+      await_ready () noexcept
+      {
+	return false;
+      }
+
+      std::coroutine_handle<>
+      await_suspend (std::coroutine_handle<promise_type> handle) noexcept
+      {
+	auto continuation = handle.promise ().continuation;
+	handle.promise ().isDone.store (true, std::memory_order_release); // the task may be destroyed from here on
+	return continuation ? continuation : std::noop_coroutine ();
+      }
+
+      void
+      await_resume () noexcept
+      {
+      }
+    };
+
+    FinalAwaiter
+    final_suspend () noexcept
+    {
+      return {};
+    }
+
+    void
+    return_value (T value)
+    {
+      result.emplace (std::move (value));
+    }
+
+    void
+    unhandled_exception ()
+    {
+      error = std::current_exception ();
+    }
+  };
+
+  AsyncTask (AsyncTask &&other) noexcept : handle (std::exchange (other.handle, nullptr))
+  {
+  }
+
+  AsyncTask (const AsyncTask &) = delete;
+  AsyncTask &operator= (const AsyncTask &) = delete;
+
+  ~AsyncTask ()
+  {
+    if (handle)
+      {
+	handle.destroy ();
+      }
+  }
+
+  /// Runs the operation until it completes or first suspends on a contended bucket.
+  void
+  start ()
+  {
+    handle.resume ();
+  }
+
+  bool
+  isReady () const
+  {
+    return handle.promise ().isDone.load (std::memory_order_acquire);
+  }
+
+  T
+  getResult ()
+  {
+    if (handle.promise ().error)
+      {
+	std::rethrow_exception (handle.promise ().error);
+      }
+    return std::move (*handle.promise ().result);
+  }
+
+  bool
+  await_ready () const noexcept
+  {
+    return false;
+  }
+
+  std::coroutine_handle<>
+  await_suspend (std::coroutine_handle<> caller) noexcept
+  {
+    handle.promise ().continuation = caller;
+    return handle;
+  }
+
+  T
+  await_resume ()
+  {
+    return getResult ();
+  }
+
+private:
+  explicit AsyncTask (std::coroutine_handle<promise_type> aHandle) : handle (aHandle)
+  {
+  }
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+/// Suspends the awaiting coroutine until the mutex is released by its current owner.
+/// It does not acquire the mutex: the operation retries its try-lock after resuming.
+template <class MutexT> class MutexReleaseAwaiter
+{
+public:
+  MutexReleaseAwaiter (MutexT *aMutexAddress, LockType aLockType, AsyncScheduler *aScheduler)
+    : mutexAddress (aMutexAddress), lockType (aLockType), scheduler (aScheduler)
+  {
+  }
+
+  bool
+  await_ready () const noexcept
+  {
+    return false;
+  }
+
+  bool
+  await_suspend (std::coroutine_handle<> handle)
+  {
+    AsyncWaitQueue::enqueue (mutexAddress, handle, scheduler);
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+
+    if (!probe ())
+      {
+	return true; // the owner resumes us from AsyncWaitQueue::notify
+      }
+
+    bool cancelled = AsyncWaitQueue::cancel (mutexAddress, handle);
+    // Our probe may have hidden the owner's release from waiters that enqueued meanwhile.
+    AsyncWaitQueue::notify (mutexAddress);
+    return !cancelled;
+  }
+
+  void
+  await_resume () const noexcept
+  {
+  }
+
+private:
+  bool
+  probe () const
+  {
+    if (lockType == LockType::READ)
+      {
+	if (mutexAddress->try_lock_shared ())
+	  {
+	    mutexAddress->unlock_shared ();
+	    return true;
+	  }
+	return false;
+      }
+
+    if (mutexAddress->try_lock ())
+      {
+	mutexAddress->unlock ();
+	return true;
+      }
+    return false;
+  }
+
+  MutexT *mutexAddress;
+  LockType lockType;
+  AsyncScheduler *scheduler;
+};
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef _ASYNC_WAIT_QUEUE_HPP_
+#define _ASYNC_WAIT_QUEUE_HPP_
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/// Decides where a suspended map operation continues once the bucket it waits for is released.
+/// Event loops implement it to post the handle back onto their own thread.
+class AsyncScheduler
+{
+public:
+  virtual ~AsyncScheduler () = default;
+  virtual void schedule (std::coroutine_handle<> handle) = 0;
+};
+
+/// Coroutines waiting for a contended mutex, keyed by the mutex address.
+/// Lock owners call notify() after releasing; waiters are then scheduled to retry their try-lock, on their own
+/// scheduler or on getDefaultScheduler () for those enqueued without one.
+class AsyncWaitQueue
+{
+public:
+  AsyncWaitQueue () = delete;
+
+  static void enqueue (const void *mutexAddress, std::coroutine_handle<> handle, AsyncScheduler *scheduler);
+
+  /// Returns false if the waiter was already taken by notify() and is about to be resumed.
+  static bool cancel (const void *mutexAddress, std::coroutine_handle<> handle);
+
+  static void notify (const void *mutexAddress);
+
+  /// Resumes the waiters enqueued without a scheduler on a thread of its own, started on first use. notify() runs in
+  /// the unlock of a lock owner, which may still hold other locks through its thread's lock maps; a coroutine resumed
+  /// there would find them as its own.
+  static AsyncScheduler &getDefaultScheduler ();
+
+  static uint64_t
+  getWaiterCount ()
+  {
+    return waiterCount;
+  }
+
+private:
+  struct Waiter
+  {
+    const void *mutexAddress;
+    std::coroutine_handle<> handle;
+    AsyncScheduler *scheduler;
+  };
+
+  struct Shard
+  {
+    std::mutex shardMutex;
+    std::vector<Waiter> waiters;
+  };
+
+  static constexpr std::size_t shardCount = 64;
+
+  static Shard &getShard (const void *mutexAddress);
+
+  static std::atomic<uint64_t> waiterCount;
+  static Shard shards[shardCount];
+};
+
+/// A std::shared_lock or std::unique_lock that calls AsyncWaitQueue::notify whenever it releases its mutex, so that
+/// async_ operations suspended on the mutex retry. Locks held on the stack, outside the map's lock maps, use it.
+template <class LockT> class NotifyingLock : public LockT
+{
+public:
+  using LockT::LockT;
+
+  NotifyingLock () = default;
+  NotifyingLock (NotifyingLock &&) = default;
+
+  NotifyingLock &
+  operator= (NotifyingLock &&other)
+  {
+    release ();
+    LockT::operator= (std::move (other));
+    return *this;
+  }
+
+  ~NotifyingLock ()
+  {
+    release ();
+  }
+
+  void
+  unlock ()
+  {
+    LockT::unlock ();
+    AsyncWaitQueue::notify (LockT::mutex ());
+  }
+
+private:
+  void
+  release ()
+  {
+    if (LockT::owns_lock ())
+      {
+	unlock ();
+      }
+  }
+};
+
+#endif
@@ -1,45 +1,97 @@
 #ifndef _BUCKET_HPP_
 #define _BUCKET_HPP_
 
+#include <exception>
 #include <memory>
-#include <shared_mutex>
+#include <optional>
+#include <thread>
+#include <utility>
 #include <vector>
 
+#include "async_wait_queue.hpp"
+#include "buffered_write.hpp"
 #include "internal_value.hpp"
+#include "iterator.hpp"
+#include "key_tag.hpp"
+#include "lock_trace.hpp"
+#include "lookup_filter.hpp"
+#include "map_statistics.hpp"
+#include "performance_counters.hpp"
+#include "stable_vector.hpp"
 #include "unordered_map_utils.hpp"
 
-template <class KeyT, class ValueT, class HashFuncT> class concurrent_unordered_map;
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT> class concurrent_unordered_map;
 
-template <class KeyT, class ValueT, class HashFuncT> class bucket
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT> class bucket
 {
 public:
-  using InternalValue = internal_value<KeyT, ValueT, HashFuncT>;
-  using Map = concurrent_unordered_map<KeyT, ValueT, HashFuncT>;
-  using Iterator = typename concurrent_unordered_map<KeyT, ValueT, HashFuncT>::iterator;
-
-  bucket ()
+  using InternalValue = internal_value<KeyT, ValueT, HashFuncT, LockPolicyT>;
+  using Map = concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>;
+  using Iterator = typename concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::iterator;
+  using Mutex = typename LockPolicyT::mutex_type;
+  using StackReadLock = NotifyingLock<std::shared_lock<Mutex>>;
+  using StackWriteLock = NotifyingLock<std::unique_lock<Mutex>>;
+  using KeyTag = key_tag<KeyT>;
+  static constexpr bool hasKeyTags = !std::is_empty_v<KeyTag>;
+
+  /// An entry whose key is summarized by a tag next to the pointer (string keys).
+  struct TaggedSlot
+  {
+    std::shared_ptr<InternalValue> entry;
+    KeyTag tag;
+  };
+
+  // Inline entries live in the bucket's storage itself, which never moves them while an iterator pins the bucket;
+  // others are shared with the iterators that point to them.
+  using ValueSlot =
+    std::conditional_t<InternalValue::isInline, InternalValue,
+		       std::conditional_t<hasKeyTags, TaggedSlot, std::shared_ptr<InternalValue>>>;
+  using ValueStore =
+    std::conditional_t<InternalValue::isInline, stable_vector<ValueSlot>, std::vector<ValueSlot>>;
+  using CombinedBatch = combined_batch<KeyT, ValueT>;
+
+  bucket () = default;
+  bucket (const bucket &) = delete;
+  bucket &operator= (const bucket &) = delete;
+
+#ifdef ADD_LOCK_TRACING
+  void
+  setTraceIndex (std::size_t anIndex)
   {
-    bucketMutex = std::make_unique<std::shared_mutex> ();
+    contention.bucketIndex = anIndex;
   }
+#endif
 
   std::size_t
   getSize () const
   {
-    auto bucketLock = Map::getBucketLockFor (&(*bucketMutex), LockType::READ);
+    auto bucketLock = Map::getBucketLockFor (&bucketMutex, LockType::READ, &contention);
     return currentSize;
   }
 
+  /// False if the key is certainly not in the bucket. Takes no lock.
+  bool
+  mayContain (std::size_t keyHash) const
+  {
+    return lookupFilter.mayContain (keyHash);
+  }
+
   std::pair<Iterator, bool>
-  insert (Map const *const map, int bucketIndex, const std::pair<KeyT, ValueT> &aKeyValuePair)
+  insert (Map const *const map, int bucketIndex, const std::pair<KeyT, ValueT> &aKeyValuePair, std::size_t keyHash)
   {
-    auto bucketLock = Map::getBucketLockFor (&(*bucketMutex), LockType::WRITE);
+    auto bucketLock = Map::getBucketLockFor (&bucketMutex, LockType::WRITE, &contention);
+    KeyTag tag (aKeyValuePair.first, keyHash);
 
     int foundPosition = -1;
     int insertPosition = -1;
 
     for (int i = 0; i < int (values.size ()); ++i)
       {
-	auto key = values[i]->getKey ();
+	if (!mayHoldKey (values[i], tag))
+	  {
+	    continue;
+	  }
+	auto key = entryOf (values[i])->getKey ();
 	if (key.has_value () && key.value () == aKeyValuePair.first)
 	  {
 	    foundPosition = i;
@@ -49,58 +101,127 @@ public:
     bool is_value_available = false;
     if (foundPosition != -1)
       {
-	is_value_available = values[foundPosition]->isAvailable ();
+	is_value_available = entryOf (values[foundPosition])->isAvailable ();
       }
 
     if (foundPosition != -1 && is_value_available) // there is a value with this key available
       {
-	auto it = values[foundPosition]->getIterator (map, bucketIndex, foundPosition, bucketLock, LockType::WRITE);
-	return std::make_pair (it, false);
+	auto it =
+	  entryOf (values[foundPosition])->getIterator (map, bucketIndex, foundPosition, bucketLock, LockType::WRITE);
+	return std::make_pair (pin (it), false);
       }
 
     if (foundPosition == -1) // key was not found
       {
-	values.push_back (std::make_shared<InternalValue> (aKeyValuePair));
+	values.push_back (makeSlot (tag, aKeyValuePair.first, aKeyValuePair.second));
+	lookupFilter.add (keyHash);
 	++currentSize;
 	insertPosition = int (values.size ()) - 1;
       }
 
     if (foundPosition != -1 && !is_value_available) // key was found, but previously erased.
       {
-	values[foundPosition]->updateValue (aKeyValuePair.second);
+	entryOf (values[foundPosition])->updateValue (aKeyValuePair.second);
+	lookupFilter.add (keyHash);
 	insertPosition = foundPosition;
       }
 
-    auto it = values[insertPosition]->getIterator (map, bucketIndex, insertPosition, bucketLock, LockType::WRITE);
-    return std::make_pair (it, true);
+    auto it =
+      entryOf (values[insertPosition])->getIterator (map, bucketIndex, insertPosition, bucketLock, LockType::WRITE);
+    return std::make_pair (pin (it), true);
   }
 
   int
-  erase (const KeyT &aKey)
+  erase (const KeyT &aKey, std::size_t keyHash, const double threshold, const CompactionMode mode,
+	 bool &needsCompaction)
   {
-    auto bucketLock = Map::getBucketLockFor (&(*bucketMutex), LockType::WRITE);
+    auto bucketLock = Map::getBucketLockFor (&bucketMutex, LockType::WRITE, &contention);
+    KeyTag tag (aKey, keyHash);
     for (int i = 0; i < int (values.size ()); ++i)
       {
-	if (values[i]->compareKey (aKey))
+	if (mayHoldKey (values[i], tag) && entryOf (values[i])->compareKey (aKey))
 	  {
-	    values[i]->erase ();
+	    entryOf (values[i])->erase ();
 	    --currentSize;
+	    checkCompaction (threshold, mode, needsCompaction);
 	    return i;
 	  }
       }
     return -1;
   }
 
+  /// Erases every value with the key (multimap). Returns how many were erased.
+  std::size_t
+  eraseAll (const KeyT &aKey, std::size_t keyHash, const double threshold, const CompactionMode mode,
+	    bool &needsCompaction)
+  {
+    auto bucketLock = Map::getBucketLockFor (&bucketMutex, LockType::WRITE, &contention);
+    KeyTag tag (aKey, keyHash);
+    std::size_t erasedCount = 0;
+    for (auto &value : values)
+      {
+	if (mayHoldKey (value, tag) && entryOf (value)->compareKey (aKey))
+	  {
+	    entryOf (value)->erase ();
+	    ++erasedCount;
+	  }
+      }
+
+    if (erasedCount > 0)
+      {
+	currentSize -= erasedCount;
+	checkCompaction (threshold, mode, needsCompaction);
+      }
+    return erasedCount;
+  }
+
+  /// Adds the values under the key even if it is already present (multimap), under one bucket lock.
+  template <class InputIt>
+  std::size_t
+  append (const KeyT &aKey, std::size_t keyHash, InputIt first, InputIt last)
+  {
+    auto bucketLock = Map::getBucketLockFor (&bucketMutex, LockType::WRITE, &contention);
+    KeyTag tag (aKey, keyHash);
+    std::size_t appendedCount = 0;
+    for (; first != last; ++first)
+      {
+	values.push_back (makeSlot (tag, aKey, *first));
+	++appendedCount;
+      }
+    if (appendedCount > 0)
+      {
+	lookupFilter.add (keyHash);
+      }
+    currentSize += appendedCount;
+    return appendedCount;
+  }
+
+  bool
+  update (const KeyT &aKey, std::size_t keyHash, const ValueT &aValue)
+  {
+    auto bucketLock = Map::getBucketLockFor (&bucketMutex, LockType::WRITE, &contention);
+    KeyTag tag (aKey, keyHash);
+    for (int i = 0; i < int (values.size ()); ++i)
+      {
+	if (mayHoldKey (values[i], tag) && entryOf (values[i])->compareKey (aKey))
+	  {
+	    entryOf (values[i])->updateValue (aValue);
+	    return true;
+	  }
+      }
+    return false;
+  }
+
   Iterator
   begin (Map const *const aMap, int bucketIndex) const
   {
-    auto bucketLock = Map::getBucketLockFor (&(*bucketMutex), LockType::READ);
+    auto bucketLock = Map::getBucketLockFor (&bucketMutex, LockType::READ, &contention);
 
     for (int i = 0; i < int (values.size ()); ++i)
       {
-	if (values[i]->isAvailable ())
+	if (entryOf (values[i])->isAvailable ())
 	  {
-	    return values[i]->getIterator (aMap, bucketIndex, i, bucketLock, LockType::READ);
+	    return pin (entryOf (values[i])->getIterator (aMap, bucketIndex, i, bucketLock, LockType::READ));
 	  }
       }
 
@@ -118,7 +239,7 @@ public:
 
 	if (nextValueIndex != -1)
 	  {
-	    values[nextValueIndex]->updateIterator (it, currentBucketIndex, nextValueIndex, it.bucketLock);
+	    entryOf (values[nextValueIndex])->updateIterator (it, currentBucketIndex, nextValueIndex, it.bucketLock);
 	    return true;
 	  }
 	else // need to go to next bucket
@@ -128,8 +249,7 @@ public:
       }
     else // need to return the first valid element in this bucket
       {
-	using SharedReadLock = std::shared_ptr<std::shared_lock<std::shared_mutex>>;
-	auto variantBucketLock = Map::getBucketLockFor (&(*bucketMutex), LockType::READ);
+	auto variantBucketLock = Map::getBucketLockFor (&bucketMutex, LockType::READ, &contention);
 	int nextValueIndex = getNextValueIndex (-1);
 
 	if (nextValueIndex == -1)
@@ -137,36 +257,370 @@ public:
 	    return false;
 	  }
 
-	values[nextValueIndex]->updateIterator (it, currentBucketIndex, nextValueIndex, variantBucketLock);
+	entryOf (values[nextValueIndex])->updateIterator (it, currentBucketIndex, nextValueIndex, variantBucketLock);
+	pin (it);
 	return true;
       }
     return false;
   }
 
   Iterator
-  find (Map const *const map, int bucketIndex, KeyT key, LockType lockType) const
+  find (Map const *const map, int bucketIndex, const KeyT &key, std::size_t keyHash, LockType lockType,
+	std::size_t *probeCount = nullptr) const
   {
-    auto bucketLock = Map::getBucketLockFor (&(*bucketMutex), lockType);
+    auto bucketLock = Map::getBucketLockFor (&bucketMutex, lockType, &contention);
+    KeyTag tag (key, keyHash);
 
     for (int i = 0; i < int (values.size ()); ++i)
       {
-	auto it = values[i]->getIteratorForKey (map, key, bucketIndex, i, bucketLock, lockType);
+	if (!mayHoldKey (values[i], tag))
+	  {
+	    continue;
+	  }
+	auto it = entryOf (values[i])->getIteratorForKey (map, key, bucketIndex, i, bucketLock, lockType);
 	if (it != map->end ())
 	  {
-	    return it;
+	    if (probeCount)
+	      {
+		*probeCount = i + 1;
+	      }
+	    return pin (it);
 	  }
       }
 
+    if (probeCount)
+      {
+	*probeCount = values.size ();
+      }
     return map->end ();
   }
 
+  template <class VisitorT>
+  bool
+  visit (const KeyT &aKey, std::size_t keyHash, VisitorT &visitor, std::size_t *probeCount = nullptr) const
+  {
+    KeyTag tag (aKey, keyHash);
+    StackReadLock bucketLock (bucketMutex, std::try_to_lock);
+    if (!bucketLock.owns_lock ())
+      {
+	contention.lockContended (bucketLock);
+      }
+
+    for (std::size_t i = 0; i < values.size (); ++i)
+      {
+	if (mayHoldKey (values[i], tag) && entryOf (values[i])->visitIfKey (aKey, visitor))
+	  {
+	    if (probeCount)
+	      {
+		*probeCount = i + 1;
+	      }
+	    return true;
+	  }
+      }
+
+    if (probeCount)
+      {
+	*probeCount = values.size ();
+      }
+    return false;
+  }
+
+  /// Runs the visitor on every value with the key (multimap). A thread that may already hold locks of this bucket
+  /// (iterators) takes them through the lock maps.
+  template <class VisitorT>
+  std::size_t
+  visitAll (const KeyT &aKey, std::size_t keyHash, VisitorT &visitor, bool throughLockMaps) const
+  {
+    KeyTag tag (aKey, keyHash);
+    std::size_t visitedCount = 0;
+    if (throughLockMaps)
+      {
+	auto bucketLock = Map::getBucketLockFor (&bucketMutex, LockType::READ, &contention);
+	for (auto &value : values)
+	  {
+	    if (mayHoldKey (value, tag) && entryOf (value)->compareKey (aKey))
+	      {
+		const auto keyValue = entryOf (value)->getKeyValuePair ();
+		visitor (keyValue.second);
+		++visitedCount;
+	      }
+	  }
+	return visitedCount;
+      }
+
+    StackReadLock bucketLock (bucketMutex, std::try_to_lock);
+    if (!bucketLock.owns_lock ())
+      {
+	contention.lockContended (bucketLock);
+      }
+
+    for (auto &value : values)
+      {
+	if (mayHoldKey (value, tag) && entryOf (value)->visitIfKey (aKey, visitor))
+	  {
+	    ++visitedCount;
+	  }
+      }
+    return visitedCount;
+  }
+
+  /// Runs modify (std::atomic_ref<ValueT>) on the value of the key under the bucket read lock: concurrent
+  /// modifications of the bucket's values do not exclude each other. They pass no writers gate but announce themselves
+  /// in modifierCount instead; std::nullopt once a migration retired the bucket, for the caller to retry on the new
+  /// table.
+  template <class ModifyT>
+  std::optional<bool>
+  modifyValue (const KeyT &aKey, ModifyT &modify, bool throughLockMaps)
+  {
+    ScopedBucketLock<LockType::READ> bucketLock (*this, throughLockMaps);
+    if (modifierCount.fetch_add (1) & retiredBit)
+      {
+	modifierCount.fetch_sub (1, std::memory_order_release);
+	return std::nullopt;
+      }
+
+    bool isModified = false;
+    for (auto &value : values)
+      {
+	if (entryOf (value)->modifyIfKey (aKey, modify))
+	  {
+	    isModified = true;
+	    break;
+	  }
+      }
+    modifierCount.fetch_sub (1, std::memory_order_release);
+    return isModified;
+  }
+
+  /// For a migration, with the writers gate closed: turns later modifyValue calls away and waits for the running
+  /// ones, after which the values can be copied without the bucket lock.
+  void
+  retire ()
+  {
+    modifierCount.fetch_or (retiredBit);
+    while ((modifierCount.load () & ~retiredBit) != 0)
+      {
+	std::this_thread::yield ();
+      }
+  }
+
+  /// Runs visitor (key, value) on every entry under one bucket read lock (map-wide cvisit_all).
+  template <class VisitorT>
+  void
+  cvisitEntries (VisitorT &visitor, bool throughLockMaps) const
+  {
+    ScopedBucketLock<LockType::READ> bucketLock (*this, throughLockMaps);
+    for (auto &value : values)
+      {
+	entryOf (value)->cvisitEntry (visitor, throughLockMaps);
+      }
+  }
+
+  /// Runs visitor (key, value) with mutable values on every entry under one bucket write lock (map-wide for_each).
+  template <class VisitorT>
+  void
+  visitEntries (VisitorT &visitor, bool throughLockMaps)
+  {
+    ScopedBucketLock<LockType::WRITE> bucketLock (*this, throughLockMaps);
+    for (auto &value : values)
+      {
+	entryOf (value)->visitEntry (visitor, throughLockMaps);
+      }
+  }
+
+  /// Erases every entry for which predicate (key, value) holds, under one bucket write lock. Returns how many were
+  /// erased.
+  template <class PredicateT>
+  std::size_t
+  eraseIf (PredicateT &predicate, const double threshold, const CompactionMode mode, bool &needsCompaction,
+	   bool throughLockMaps)
+  {
+    ScopedBucketLock<LockType::WRITE> bucketLock (*this, throughLockMaps);
+    std::size_t erasedCount = 0;
+    for (auto &value : values)
+      {
+	bool isMatching = false;
+	auto test = [&predicate, &isMatching] (const KeyT &aKey, const ValueT &aValue) {
+	  isMatching = predicate (aKey, aValue);
+	};
+	if (entryOf (value)->cvisitEntry (test, throughLockMaps) && isMatching)
+	  {
+	    entryOf (value)->eraseLocked ();
+	    ++erasedCount;
+	  }
+      }
+
+    if (erasedCount > 0)
+      {
+	currentSize -= erasedCount;
+	checkCompaction (threshold, mode, needsCompaction);
+      }
+
+    // An inline compaction is done under the lock already held, unless this thread holds the bucket through its
+    // iterators: compacting would move the entries they point to, so the caller schedules it instead.
+    if (needsCompaction && mode == CompactionMode::INLINE && !throughLockMaps)
+      {
+	compactLocked ();
+	needsCompaction = false;
+      }
+    return erasedCount;
+  }
+
+  /// Drops every entry and releases the storage. Returns how many entries were live.
+  std::size_t
+  clear (bool throughLockMaps)
+  {
+    ScopedBucketLock<LockType::WRITE> bucketLock (*this, throughLockMaps);
+    auto liveCount = currentSize;
+    if (isPinned ())
+      {
+	// Iterators point into the storage: the entries are only marked erased.
+	for (auto &value : values)
+	  {
+	    entryOf (value)->eraseLocked ();
+	  }
+      }
+    else
+      {
+	ValueStore ().swap (values);
+	lookupFilter.rebuild (0);
+      }
+    currentSize = 0;
+    return liveCount;
+  }
+
+  /// Applies a batch of writes to this bucket. The batch is published first; whichever thread gets the bucket lock
+  /// applies every published batch under that one lock, so a thread waiting on a hot bucket usually finds its batch
+  /// already applied and never takes the lock.
+  void
+  combineWrites (CombinedBatch &batch, const double threshold, const CompactionMode mode, bool throughLockMaps)
+  {
+    if (throughLockMaps) // this thread may already hold the bucket through an iterator
+      {
+	auto bucketLock = Map::getBucketLockFor (&bucketMutex, LockType::WRITE, &contention);
+	applyBatch (batch, threshold, mode);
+	return;
+      }
+
+    batch.next = pendingBatches.load (std::memory_order_relaxed);
+    while (!pendingBatches.compare_exchange_weak (batch.next, &batch, std::memory_order_release,
+						 std::memory_order_relaxed))
+      {
+      }
+
+    // A few tries give a thread holding the bucket the time to apply our batch; after that we block on the lock, since
+    // the holder may be a reader (an iterator, a slow for_each) that never drains.
+    for (int attempt = 0; !batch.isApplied.load (std::memory_order_acquire); ++attempt)
+      {
+	StackWriteLock bucketLock (bucketMutex, std::try_to_lock);
+	if (!bucketLock.owns_lock ())
+	  {
+	    if (attempt < combineSpinCount)
+	      {
+		std::this_thread::yield ();
+		continue;
+	      }
+	    contention.lockContended (bucketLock);
+	  }
+
+	// Our batch was published before the lock was taken, so this drain applies it. Every batch taken off the list
+	// is marked applied, even when it fails: its error goes back to its own thread.
+	for (auto pending = pendingBatches.exchange (nullptr, std::memory_order_acquire); pending;)
+	  {
+	    auto next = pending->next;
+	    try
+	      {
+		applyBatch (*pending, threshold, mode);
+	      }
+	    catch (...)
+	      {
+		pending->error = std::current_exception ();
+	      }
+	    pending->isApplied.store (true, std::memory_order_release);
+	    pending = next;
+	  }
+      }
+
+    if (batch.error)
+      {
+	std::rethrow_exception (batch.error);
+      }
+  }
+
+  // The *Locked operations are for a caller holding the bucket write lock (atomically); they skip the value locks.
+
+  ValueT *
+  findLocked (const KeyT &aKey, std::size_t keyHash)
+  {
+    KeyTag tag (aKey, keyHash);
+    for (auto &value : values)
+      {
+	if (!mayHoldKey (value, tag))
+	  {
+	    continue;
+	  }
+	if (auto aValue = entryOf (value)->getValueLocked (aKey))
+	  {
+	    return aValue;
+	  }
+      }
+    return nullptr;
+  }
+
+  /// The first live entry with the key at anIndex or after, leaving anIndex at its position; nullptr if there is none.
+  /// The caller holds the bucket lock, which keeps the entries where they are (key_range).
+  const typename InternalValue::Entry *
+  findNextLocked (const KeyT &aKey, std::size_t keyHash, int &anIndex) const
+  {
+    KeyTag tag (aKey, keyHash);
+    for (; anIndex < int (values.size ()); ++anIndex)
+      {
+	if (!mayHoldKey (values[anIndex], tag))
+	  {
+	    continue;
+	  }
+	if (auto entry = entryOf (values[anIndex])->getEntryLocked (aKey))
+	  {
+	    return entry;
+	  }
+      }
+    return nullptr;
+  }
+
+  /// The caller checked that the key is not in the bucket.
+  void
+  insertLocked (const KeyT &aKey, std::size_t keyHash, const ValueT &aValue)
+  {
+    values.push_back (makeSlot (KeyTag (aKey, keyHash), aKey, aValue));
+    lookupFilter.add (keyHash);
+    ++currentSize;
+  }
+
+  bool
+  eraseLocked (const KeyT &aKey, std::size_t keyHash, const double threshold, const CompactionMode mode,
+	       bool &needsCompaction)
+  {
+    KeyTag tag (aKey, keyHash);
+    for (auto &value : values)
+      {
+	if (mayHoldKey (value, tag) && entryOf (value)->getValueLocked (aKey))
+	  {
+	    entryOf (value)->eraseLocked ();
+	    --currentSize;
+	    checkCompaction (threshold, mode, needsCompaction);
+	    return true;
+	  }
+      }
+    return false;
+  }
+
   int
   getNextValueIndex (int index) const
   {
-    auto valueLock = Map::getBucketLockFor (&(*bucketMutex), LockType::READ);
+    auto valueLock = Map::getBucketLockFor (&bucketMutex, LockType::READ, &contention);
     for (int i = index + 1; i < int (values.size ()); ++i)
       {
-	if (values[i]->isAvailable ())
+	if (entryOf (values[i])->isAvailable ())
 	  {
 	    return i;
 	  }
@@ -174,46 +628,292 @@ public:
     return -1;
   }
 
-private:
-  void
-  add (const std::pair<KeyT, ValueT> &aKeyValuePair)
+  static InternalValue *
+  entryOf (ValueSlot &slot)
   {
-    values.push_back (InternalValue (aKeyValuePair.first, aKeyValuePair.second));
-    ++currentSize;
+    if constexpr (InternalValue::isInline)
+      {
+	return &slot;
+      }
+    else if constexpr (hasKeyTags)
+      {
+	return slot.entry.get ();
+      }
+    else
+      {
+	return slot.get ();
+      }
   }
 
-  std::size_t
-  eraseUnavailableValues (Map const *const aMap, const int bucketIndex, const double threshold)
+  static const InternalValue *
+  entryOf (const ValueSlot &slot)
+  {
+    return entryOf (const_cast<ValueSlot &> (slot));
+  }
+
+  /// Shares the entry whose value mutex is at aMutexAddress, so that an async_ operation can wait for that mutex after
+  /// releasing the bucket lock without the entry being freed meanwhile; nullptr if no entry has it. The caller holds
+  /// the bucket lock.
+  std::shared_ptr<const InternalValue>
+  shareEntryWithValueMutex (const void *aMutexAddress) const
+  {
+    if constexpr (InternalValue::hasValueMutex)
+      {
+	for (const auto &value : values)
+	  {
+	    if (entryOf (value)->hasValueMutexAt (aMutexAddress))
+	      {
+		if constexpr (hasKeyTags)
+		  {
+		    return value.entry;
+		  }
+		else
+		  {
+		    return value;
+		  }
+	      }
+	  }
+      }
+    return nullptr;
+  }
+
+  /// Bucket lock of a bulk or multi-key operation: through the lock maps for a thread that may already hold the bucket
+  /// (iterators), otherwise stack-scoped, skipping the lock map bookkeeping. Either way its release wakes the async_
+  /// operations suspended on the bucket.
+  template <LockType lockType> class ScopedBucketLock
   {
+    using StackLock = std::conditional_t<lockType == LockType::READ, StackReadLock, StackWriteLock>;
+
+  public:
+    ScopedBucketLock (const bucket &aBucket, bool throughLockMaps)
     {
-      auto bucketLock = Map::getBucketLockFor (&(*bucketMutex), LockType::READ);
-      if (double (currentSize) > double (values.size ()) * threshold)
+      if (throughLockMaps)
+	{
+	  sharedLock = Map::getBucketLockFor (&aBucket.bucketMutex, lockType, &aBucket.contention);
+	  return;
+	}
+
+      stackLock = StackLock (aBucket.bucketMutex, std::try_to_lock);
+      if (!stackLock.owns_lock ())
 	{
-	  return currentSize;
+	  aBucket.contention.lockContended (stackLock);
 	}
     }
 
-    auto bucketLock = Map::getBucketLockFor (&(*bucketMutex), LockType::WRITE);
-    std::vector<std::shared_ptr<InternalValue>> newValues;
+  private:
+    typename lock_types<Mutex>::SharedVariantLock sharedLock;
+    StackLock stackLock;
+  };
+
+private:
+  static ValueSlot
+  makeSlot (const KeyTag &tag, const KeyT &aKey, const ValueT &aValue)
+  {
+    if constexpr (InternalValue::isInline)
+      {
+	return InternalValue (aKey, aValue);
+      }
+    else if constexpr (hasKeyTags)
+      {
+	return TaggedSlot { std::make_shared<InternalValue> (aKey, aValue), tag };
+      }
+    else
+      {
+	return std::make_shared<InternalValue> (aKey, aValue);
+      }
+  }
+
+  /// Makes the iterator keep this bucket's inline entries in place for as long as it points into the bucket.
+  Iterator &
+  pin (Iterator &it) const
+  {
+    if constexpr (InternalValue::isInline)
+      {
+	if (!it.isEnd)
+	  {
+	    it.bucketPin = BucketPin (&pinCount);
+	  }
+      }
+    return it;
+  }
+
+  Iterator &&
+  pin (Iterator &&it) const
+  {
+    return std::move (pin (it));
+  }
+
+  /// Whether an iterator points to one of this bucket's inline entries, which must then stay where they are.
+  bool
+  isPinned () const
+  {
+    return InternalValue::isInline && pinCount.load (std::memory_order_acquire) > 0;
+  }
+
+  /// False if the slot's entry certainly has another key; checked before loading the entry.
+  static bool
+  mayHoldKey (const ValueSlot &slot, const KeyTag &tag)
+  {
+    if constexpr (hasKeyTags)
+      {
+	return slot.tag == tag;
+      }
+    else
+      {
+	return true;
+      }
+  }
+
+  /// The hash of the slot's key: kept in its tag, otherwise computed again (compaction, rehash).
+  static std::size_t
+  getKeyHash (const ValueSlot &slot)
+  {
+    if constexpr (hasKeyTags)
+      {
+	return slot.tag.keyHash;
+      }
+    else
+      {
+	return HashFuncT () (entryOf (slot)->getKeyLocked ());
+      }
+  }
+
+  void
+  checkCompaction (const double threshold, const CompactionMode mode, bool &needsCompaction)
+  {
+    if (double (currentSize) <= double (values.size ()) * threshold)
+      {
+	// A deferred compaction is queued only once per bucket.
+	needsCompaction = mode == CompactionMode::INLINE || !isQueuedForCompaction;
+	isQueuedForCompaction = isQueuedForCompaction || mode == CompactionMode::DEFERRED;
+      }
+  }
+
+  void
+  add (const std::pair<KeyT, ValueT> &aKeyValuePair, std::size_t keyHash)
+  {
+    values.push_back (makeSlot (KeyTag (aKeyValuePair.first, keyHash), aKeyValuePair.first, aKeyValuePair.second));
+    lookupFilter.add (keyHash);
+    ++currentSize;
+  }
+
+  // The caller holds the bucket write lock. Writes are applied in their buffered order.
+  void
+  applyBatch (CombinedBatch &batch, const double threshold, const CompactionMode mode)
+  {
+    for (auto write = batch.first; write != batch.last; ++write)
+      {
+	KeyTag tag (write->key, write->keyHash);
+	InternalValue *found = nullptr;
+	for (auto &value : values)
+	  {
+	    if (mayHoldKey (value, tag) && entryOf (value)->compareKey (write->key))
+	      {
+		found = entryOf (value);
+		break;
+	      }
+	  }
+
+	switch (write->type)
+	  {
+	  case BufferedWriteType::INSERT:
+	    if (!found)
+	      {
+		values.push_back (makeSlot (tag, write->key, write->value));
+		lookupFilter.add (write->keyHash);
+		++currentSize;
+		++batch.insertedCount;
+	      }
+	    break;
+	  case BufferedWriteType::UPDATE:
+	    if (found)
+	      {
+		found->updateValue (write->value);
+	      }
+	    break;
+	  case BufferedWriteType::ERASE:
+	    if (found)
+	      {
+		found->erase ();
+		--currentSize;
+		++batch.erasedCount;
+		bool eraseNeedsCompaction = false;
+		checkCompaction (threshold, mode, eraseNeedsCompaction);
+		batch.needsCompaction = batch.needsCompaction || eraseNeedsCompaction;
+	      }
+	    break;
+	  }
+      }
+  }
+
+  /// False if the bucket was left as it is (see compactLocked).
+  bool
+  eraseUnavailableValues ()
+  {
+    auto bucketLock = Map::getBucketLockFor (&bucketMutex, LockType::WRITE, &contention);
+    return compactLocked ();
+  }
+
+  // The caller holds the bucket write lock. False, without compacting, while iterators pin the bucket.
+  bool
+  compactLocked ()
+  {
+    // Moving the entries would leave the iterators pinning the bucket dangling; a later erase asks again.
+    if (isPinned ())
+      {
+	isQueuedForCompaction = false;
+	return false;
+      }
+
+#ifdef ADD_PERFORMANCE_COUNTERS
+    auto startTime = std::chrono::steady_clock::now ();
+#endif
+#ifdef ADD_LOCK_TRACING
+    LockTrace::record (LockTrace::EventType::COMPACTION_BEGIN, &bucketMutex, contention.bucketIndex, LockType::WRITE);
+#endif
+
+    ValueStore newValues;
     std::size_t count = 0;
+    uint64_t keyMasks = 0;
 
     for (std::size_t i = 0; i < values.size (); ++i)
       {
-	if (values[i]->isAvailable ())
+	if (entryOf (values[i])->isAvailable ())
 	  {
-	    newValues.push_back (values[i]);
+	    keyMasks |= LookupFilter::maskFor (getKeyHash (values[i]));
+	    newValues.push_back (std::move (values[i]));
 	    count++;
 	  }
       }
+
+#ifdef ADD_PERFORMANCE_COUNTERS
+    GlobalCounter::addBucketCompaction (values.size () - count, startTime, std::chrono::steady_clock::now ());
+#endif
+
     values = std::move (newValues);
+    lookupFilter.rebuild (keyMasks);
     currentSize = count;
-    return count;
+    isQueuedForCompaction = false;
+
+#ifdef ADD_LOCK_TRACING
+    LockTrace::record (LockTrace::EventType::COMPACTION_END, &bucketMutex, contention.bucketIndex, LockType::WRITE);
+#endif
+    return true;
   }
 
 private:
-  std::unique_ptr<std::shared_mutex> bucketMutex;
-  std::vector<std::shared_ptr<InternalValue>> values;
+  mutable Mutex bucketMutex;
+  mutable BucketContention contention;
+  LookupFilter lookupFilter; // next to values rather than to the mutex, whose line lockers keep writing
+  ValueStore values;
+  std::atomic<CombinedBatch *> pendingBatches { nullptr };
   std::size_t currentSize = 0;
+  bool isQueuedForCompaction = false;
+  mutable std::atomic<uint32_t> pinCount { 0 }; // iterators to inline entries of this bucket
+  std::atomic<uint32_t> modifierCount { 0 };     // running modifyValue calls, plus retiredBit once migrated
+
+  static constexpr uint32_t retiredBit = uint32_t (1) << 31;
+  static constexpr int combineSpinCount = 64; // failed try_locks before combineWrites blocks on the bucket lock
 
   friend Map;
 };
@@ -0,0 +1,88 @@
+#ifndef _BUCKET_TABLE_HPP_
+#define _BUCKET_TABLE_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+/// The bucket array of a concurrent_unordered_map. Replaced as a whole by rehash / shrink_to_fit.
+/// Buckets are allocated in fixed-size chunks the first time a bucket of the chunk is written, so a table costs one
+/// pointer per chunk until it is used.
+template <class BucketT> class bucket_table
+{
+public:
+  explicit bucket_table (std::size_t aBucketCount)
+    : bucketCount (aBucketCount), chunkCount ((aBucketCount + chunkSize - 1) / chunkSize),
+      chunks (new std::atomic<BucketT *>[chunkCount] ())
+  {
+  }
+
+  bucket_table (const bucket_table &) = delete;
+  bucket_table &operator= (const bucket_table &) = delete;
+
+  ~bucket_table ()
+  {
+    for (std::size_t i = 0; i < chunkCount; ++i)
+      {
+	delete[] chunks[i].load ();
+      }
+  }
+
+  std::size_t
+  size () const
+  {
+    return bucketCount;
+  }
+
+  /// Returns nullptr if the bucket's chunk was never allocated (the bucket is empty).
+  BucketT *
+  find (std::size_t index) const
+  {
+    auto chunk = chunks[index / chunkSize].load (std::memory_order_acquire);
+    return chunk ? &chunk[index % chunkSize] : nullptr;
+  }
+
+  /// Allocates the bucket's chunk if needed.
+  BucketT &
+  operator[] (std::size_t index)
+  {
+    auto &chunkSlot = chunks[index / chunkSize];
+    auto chunk = chunkSlot.load (std::memory_order_acquire);
+    if (!chunk)
+      {
+	auto chunkLength = getChunkLength (index / chunkSize);
+	auto newChunk = new BucketT[chunkLength];
+#ifdef ADD_LOCK_TRACING
+	for (std::size_t i = 0; i < chunkLength; ++i)
+	  {
+	    newChunk[i].setTraceIndex (index - index % chunkSize + i);
+	  }
+#endif
+	if (chunkSlot.compare_exchange_strong (chunk, newChunk, std::memory_order_acq_rel))
+	  {
+	    chunk = newChunk;
+	  }
+	else
+	  {
+	    delete[] newChunk; // another thread allocated it first
+	  }
+      }
+    return chunk[index % chunkSize];
+  }
+
+private:
+  static constexpr std::size_t chunkSize = 1024;
+
+  std::size_t
+  getChunkLength (std::size_t chunkIndex) const
+  {
+    return std::min (chunkSize, bucketCount - chunkIndex * chunkSize);
+  }
+
+  std::size_t bucketCount;
+  std::size_t chunkCount;
+  std::unique_ptr<std::atomic<BucketT *>[]> chunks;
+};
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef _BUFFERED_WRITE_HPP_
+#define _BUFFERED_WRITE_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <exception>
+
+enum class BufferedWriteType
+{
+  INSERT = 0, // like concurrent_unordered_map::insert: a present key keeps its value
+  UPDATE,     // like concurrent_unordered_map::update: only a present key is changed
+  ERASE
+};
+
+/// One operation held by a write_combining_buffer until it is flushed.
+template <class KeyT, class ValueT> struct buffered_write
+{
+  BufferedWriteType type;
+  KeyT key;
+  ValueT value;
+  int bucketIndex;
+  std::size_t keyHash;
+};
+
+/// A run of buffered writes to one bucket, published to the bucket so that whichever thread holds its lock applies
+/// it (flat combining). The results are written by the applying thread before isApplied is set.
+template <class KeyT, class ValueT> struct combined_batch
+{
+  const buffered_write<KeyT, ValueT> *first;
+  const buffered_write<KeyT, ValueT> *last;
+  combined_batch *next = nullptr;
+
+  std::size_t insertedCount = 0;
+  std::size_t erasedCount = 0;
+  bool needsCompaction = false;
+  std::exception_ptr error; // what applying the batch threw, rethrown by the publishing thread
+  std::atomic<bool> isApplied { false };
+};
+
+#endif
@@ -0,0 +1,640 @@
+#ifndef _CONCURRENT_ORDERED_MAP_HPP_
+#define _CONCURRENT_ORDERED_MAP_HPP_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "lock_policies.hpp"
+#include "read_epoch.hpp"
+#include "unordered_map_utils.hpp"
+
+/// A concurrent sorted map, for point lookups together with ordered range scans (time-ordered keys): a lazy skip list
+/// (Herlihy, Lev, Luchangco and Shavit). Lookups and cursors take no lock. A writer locks only the nodes just before
+/// its key on each level (and the erased node), so writers on different parts of the key range run in parallel.
+/// Values are guarded like concurrent_unordered_map's entries: a value lock of the lock policy, or lock-free atomic
+/// loads and stores for small trivially copyable values. Erased nodes are freed once no reader can still see them,
+/// through a read epoch that the erasing thread never waits on.
+template <class KeyT, class ValueT, class CompareT = std::less<KeyT>, class LockPolicyT = shared_mutex_policy>
+class concurrent_ordered_map
+{
+  using Mutex = typename LockPolicyT::mutex_type;
+  struct Node;
+
+public:
+  /// Walks a key range in ascending order without holding any lock between two calls to next (), weakly consistent
+  /// like weak_cursor: every key present in the range for the whole walk is returned exactly once; a key inserted or
+  /// erased meanwhile may or may not be, and a value may be older than the map's current one. An open cursor keeps
+  /// erased nodes from being freed, so it should not be kept for long. Not thread safe.
+  class cursor
+  {
+  public:
+    cursor (cursor &&) = default;
+    cursor (const cursor &) = delete;
+    cursor &operator= (const cursor &) = delete;
+
+    /// <summary>Moves to the next element of the range.</summary>
+    /// <param></param>
+    /// <returns>A copy of the element, valid until the next call; nullptr once the range was walked.</returns>
+    const std::pair<KeyT, ValueT> *
+    next ()
+    {
+      while (node)
+	{
+	  auto aNode = node;
+	  node = aNode->next (0).load ();
+	  if (last && !map->compare (aNode->key, *last))
+	    {
+	      node = nullptr;
+	      break;
+	    }
+	  // Skips erased nodes (the cursor may sit on one that was unlinked) and nodes not yet linked on every level.
+	  if (!aNode->isMarked && aNode->isFullyLinked)
+	    {
+	      current.emplace (aNode->key, aNode->loadValue ());
+	      return &*current;
+	    }
+	}
+      return nullptr;
+    }
+
+  private:
+    cursor (const concurrent_ordered_map &aMap, const KeyT *first, bool isFirstIncluded, std::optional<KeyT> aLast)
+      : map (&aMap), epochGuard (aMap.readEpoch), node (nullptr), last (std::move (aLast))
+    {
+      node = first ? aMap.findFirstNode (*first, isFirstIncluded) : aMap.head.next (0).load ();
+    }
+
+    const concurrent_ordered_map *map;
+    ReadEpoch::Guard epochGuard; // nodes seen by the cursor are freed only after it is gone
+    Node *node;                  // the next node to visit
+    std::optional<KeyT> last;    // excluded end of the range
+    std::optional<std::pair<KeyT, ValueT>> current;
+
+    friend concurrent_ordered_map;
+  };
+
+public:
+  /// <summary>Constructor.</summary>
+  /// <param></param>
+  /// <returns></returns>
+  concurrent_ordered_map ();
+
+  /// <summary>Destructor. Frees every node; no other thread may use the map or hold a cursor.</summary>
+  ~concurrent_ordered_map ();
+
+  concurrent_ordered_map (const concurrent_ordered_map &) = delete;
+  concurrent_ordered_map &operator= (const concurrent_ordered_map &) = delete;
+
+  /// <summary>Gets the number of elements in the map</summary>
+  /// <param></param>
+  /// <returns></returns>
+  std::size_t size () const;
+
+  /// <summary>Inserts a key and a value, unless the key is already in the map.</summary>
+  /// <param name="aKey">The key</param>
+  /// <param name="aValue">The value</param>
+  /// <returns>True if the pair was inserted.</returns>
+  bool insert (const KeyT &aKey, const ValueT &aValue);
+
+  /// <summary>Erases the element with the key.</summary>
+  /// <param name="aKey">The key</param>
+  /// <returns>True if element was present in the map.</returns>
+  bool erase (const KeyT &aKey);
+
+  /// <summary>Replaces the value of an existing element.</summary>
+  /// <param name="aKey">The key</param>
+  /// <param name="aValue">The new value</param>
+  /// <returns>True if the key was present in the map.</returns>
+  bool update (const KeyT &aKey, const ValueT &aValue);
+
+  /// <summary>Runs a callback on the value of an element while holding its value read lock (if it has one). Takes no
+  /// other lock.</summary>
+  /// <param name="aKey">The key</param>
+  /// <param name="visitor">Called as visitor (const ValueT &amp;); must not call back into the map</param>
+  /// <returns>True if the key was found (and the visitor called).</returns>
+  template <class VisitorT> bool cvisit (const KeyT &aKey, VisitorT &&visitor) const;
+
+  /// <summary>Copies the value of an element.</summary>
+  /// <param name="aKey">The key</param>
+  /// <returns>The value, or std::nullopt if the key is not found.</returns>
+  std::optional<ValueT> get (const KeyT &aKey) const;
+
+  /// <summary>Checks whether the map holds an element with the key.</summary>
+  /// <param name="aKey">The key</param>
+  /// <returns></returns>
+  bool contains (const KeyT &aKey) const;
+
+  /// <summary>Walks the elements whose key is not less than aKey.</summary>
+  /// <param name="aKey">The first key of the range</param>
+  /// <returns>A cursor over the range.</returns>
+  cursor lower_bound (const KeyT &aKey) const;
+
+  /// <summary>Walks the elements whose key is greater than aKey.</summary>
+  /// <param name="aKey">The key before the range</param>
+  /// <returns>A cursor over the range.</returns>
+  cursor upper_bound (const KeyT &aKey) const;
+
+  /// <summary>Walks the elements with a key in [first, last).</summary>
+  /// <param name="first">The first key of the range</param>
+  /// <param name="last">The key after the range</param>
+  /// <returns>A cursor over the range.</returns>
+  cursor range (const KeyT &first, const KeyT &last) const;
+
+  /// <summary>Walks every element.</summary>
+  /// <param></param>
+  /// <returns>A cursor over the map.</returns>
+  cursor scan () const;
+
+private:
+  static constexpr int maxLevel = 24;
+  static constexpr std::size_t reclaimInterval = 64; // erased nodes between two attempts to free them
+
+  static constexpr bool isInline = isAtomicValue<ValueT> ();
+  static constexpr bool hasValueMutex = !isInline;
+
+  /// The links of a node or of the head of the list. The level 0 link is kept in the node, so that a range scan loads
+  /// one cache line per element; half of the nodes have no other level.
+  struct Links
+  {
+    explicit Links (int aTopLevel)
+      : topLevel (aTopLevel), upperLinks (aTopLevel > 0 ? new std::atomic<Node *>[aTopLevel] () : nullptr)
+    {
+    }
+
+    std::atomic<Node *> &
+    next (int level)
+    {
+      return level == 0 ? bottomLink : upperLinks[level - 1];
+    }
+
+    int topLevel;
+    std::atomic<Node *> bottomLink { nullptr };        // nullptr ends a level
+    std::unique_ptr<std::atomic<Node *>[]> upperLinks; // levels 1 to topLevel
+    std::atomic<bool> isMarked { false };              // erased; set under the link mutex and never cleared
+  };
+
+  struct Head : Links
+  {
+    Head () : Links (maxLevel - 1)
+    {
+    }
+
+    Mutex linkMutex;
+  };
+
+  struct Node : Links
+  {
+    Node (const KeyT &aKey, const ValueT &aValue, int aTopLevel) : Links (aTopLevel), key (aKey), value (aValue)
+    {
+    }
+
+    ValueT
+    loadValue () const
+    {
+      if constexpr (isInline)
+	{
+	  return std::atomic_ref<ValueT> (const_cast<ValueT &> (value)).load (std::memory_order_relaxed);
+	}
+      else
+	{
+	  std::shared_lock<Mutex> valueLock (valueMutex);
+	  return value;
+	}
+    }
+
+    const KeyT key;
+    ValueT value;
+    std::atomic<bool> isFullyLinked { false }; // linked on every level: only then is the node in the map
+    [[no_unique_address]] mutable std::conditional_t<hasValueMutex, Mutex, std::monostate> valueMutex;
+    Mutex linkMutex; // held while the node's links or isMarked change; after the fields a scan reads
+
+    Node *nextRetired = nullptr;
+    uint64_t retireEpoch = 0;
+  };
+
+  using PredecessorLocks = std::array<std::unique_lock<Mutex>, maxLevel>;
+
+  // Fills the last node before the key and the node after it on every level. Returns the highest level on which a
+  // node with the key was found, -1 if none was.
+  int findNode (const KeyT &aKey, Links **preds, Node **succs) const;
+  // The node holding the key if it is in the map, otherwise nullptr.
+  Node *findLiveNode (const KeyT &aKey) const;
+  Node *findFirstNode (const KeyT &aKey, bool isKeyIncluded) const;
+  // Locks the distinct predecessors of levels 0 to topLevel, the lowest level (the greatest key) first: every writer
+  // locks in descending key order, so two writers never wait on each other in a cycle. False if a predecessor or,
+  // with checkSuccessors, a successor changed since findNode; the caller then searches again.
+  bool lockPredecessors (Links **preds, Node **succs, int topLevel, bool checkSuccessors,
+			 PredecessorLocks &predLocks) const;
+  Mutex &getLinkMutex (Links *links) const;
+  static int getRandomLevel ();
+
+  void retire (Node *aNode);
+  void reclaimRetired ();
+
+private:
+  CompareT compare;
+  mutable Head head;
+  std::atomic<std::size_t> elementCount;
+
+  // Lookups and cursors read nodes inside a read epoch; an erased node is freed three epochs after it was unlinked.
+  mutable ReadEpoch readEpoch;
+  std::atomic<Node *> retiredNodes;
+  std::atomic<std::size_t> retiredCount;
+  std::mutex reclaimMutex;
+  std::vector<Node *> reclaimableNodes; // guarded by reclaimMutex
+};
+
+template <class KeyT, class ValueT, class CompareT, class LockPolicyT>
+concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::concurrent_ordered_map ()
+{
+  elementCount = 0;
+  retiredNodes = nullptr;
+  retiredCount = 0;
+}
+
+template <class KeyT, class ValueT, class CompareT, class LockPolicyT>
+concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::~concurrent_ordered_map ()
+{
+  for (auto aNode = head.next (0).load (); aNode;)
+    {
+      auto nextNode = aNode->next (0).load ();
+      delete aNode;
+      aNode = nextNode;
+    }
+  for (auto aNode = retiredNodes.load (); aNode;)
+    {
+      auto nextNode = aNode->nextRetired;
+      delete aNode;
+      aNode = nextNode;
+    }
+  for (auto aNode : reclaimableNodes)
+    {
+      delete aNode;
+    }
+}
+
+template <class KeyT, class ValueT, class CompareT, class LockPolicyT>
+std::size_t
+concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::size () const
+{
+  return elementCount;
+}
+
+template <class KeyT, class ValueT, class CompareT, class LockPolicyT>
+bool
+concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::insert (const KeyT &aKey, const ValueT &aValue)
+{
+  auto topLevel = getRandomLevel ();
+  Links *preds[maxLevel];
+  Node *succs[maxLevel];
+  ReadEpoch::Guard epochGuard (readEpoch);
+
+  while (true)
+    {
+      auto levelFound = findNode (aKey, preds, succs);
+      if (levelFound != -1)
+	{
+	  auto found = succs[levelFound];
+	  if (found->isMarked)
+	    {
+	      continue; // being erased: search again once it is unlinked
+	    }
+	  while (!found->isFullyLinked) // another insert of the key is still linking it
+	    {
+	      std::this_thread::yield ();
+	    }
+	  return false;
+	}
+
+      PredecessorLocks predLocks;
+      if (!lockPredecessors (preds, succs, topLevel, true, predLocks))
+	{
+	  continue;
+	}
+
+      auto newNode = new Node (aKey, aValue, topLevel);
+      for (int level = 0; level <= topLevel; ++level)
+	{
+	  newNode->next (level) = succs[level];
+	}
+      for (int level = 0; level <= topLevel; ++level)
+	{
+	  preds[level]->next (level) = newNode;
+	}
+      newNode->isFullyLinked = true;
+      ++elementCount;
+      return true;
+    }
+}
+
+template <class KeyT, class ValueT, class CompareT, class LockPolicyT>
+bool
+concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::erase (const KeyT &aKey)
+{
+  Links *preds[maxLevel];
+  Node *succs[maxLevel];
+  Node *victim = nullptr;
+  {
+    ReadEpoch::Guard epochGuard (readEpoch);
+    std::unique_lock<Mutex> victimLock;
+
+    while (true)
+      {
+	auto levelFound = findNode (aKey, preds, succs);
+	if (!victimLock.owns_lock ())
+	  {
+	    // Only a node linked on all of its levels and not erased yet is in the map.
+	    victim = levelFound != -1 ? succs[levelFound] : nullptr;
+	    if (!victim || !victim->isFullyLinked || victim->topLevel != levelFound || victim->isMarked)
+	      {
+		return false;
+	      }
+
+	    victimLock = std::unique_lock<Mutex> (victim->linkMutex);
+	    if (victim->isMarked) // another erase got there first
+	      {
+		return false;
+	      }
+	    victim->isMarked = true;
+	  }
+
+	PredecessorLocks predLocks;
+	if (!lockPredecessors (preds, succs, victim->topLevel, false, predLocks))
+	  {
+	    continue; // the node stays marked, so only this thread unlinks it
+	  }
+
+	for (int level = victim->topLevel; level >= 0; --level)
+	  {
+	    preds[level]->next (level) = victim->next (level).load ();
+	  }
+	--elementCount;
+	break;
+      }
+  }
+
+  retire (victim);
+  return true;
+}
+
+template <class KeyT, class ValueT, class CompareT, class LockPolicyT>
+bool
+concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::update (const KeyT &aKey, const ValueT &aValue)
+{
+  ReadEpoch::Guard epochGuard (readEpoch);
+  auto aNode = findLiveNode (aKey);
+  if (!aNode)
+    {
+      return false;
+    }
+
+  if constexpr (isInline)
+    {
+      std::atomic_ref<ValueT> (aNode->value).store (aValue, std::memory_order_relaxed);
+    }
+  else
+    {
+      std::unique_lock<Mutex> valueLock (aNode->valueMutex);
+      aNode->value = aValue;
+    }
+  return true;
+}
+
+template <class KeyT, class ValueT, class CompareT, class LockPolicyT>
+template <class VisitorT>
+bool
+concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::cvisit (const KeyT &aKey, VisitorT &&visitor) const
+{
+  ReadEpoch::Guard epochGuard (readEpoch);
+  auto aNode = findLiveNode (aKey);
+  if (!aNode)
+    {
+      return false;
+    }
+
+  if constexpr (isInline)
+    {
+      const auto value = aNode->loadValue ();
+      visitor (value);
+    }
+  else
+    {
+      std::shared_lock<Mutex> valueLock (aNode->valueMutex);
+      visitor (std::as_const (aNode->value));
+    }
+  return true;
+}
+
+template <class KeyT, class ValueT, class CompareT, class LockPolicyT>
+std::optional<ValueT>
+concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::get (const KeyT &aKey) const
+{
+  std::optional<ValueT> result;
+  cvisit (aKey, [&result] (const ValueT &aValue) { result = aValue; });
+  return result;
+}
+
+template <class KeyT, class ValueT, class CompareT, class LockPolicyT>
+bool
+concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::contains (const KeyT &aKey) const
+{
+  ReadEpoch::Guard epochGuard (readEpoch);
+  return findLiveNode (aKey) != nullptr;
+}
+
+template <class KeyT, class ValueT, class CompareT, class LockPolicyT>
+typename concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::cursor
+concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::lower_bound (const KeyT &aKey) const
+{
+  return cursor (*this, &aKey, true, std::nullopt);
+}
+
+template <class KeyT, class ValueT, class CompareT, class LockPolicyT>
+typename concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::cursor
+concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::upper_bound (const KeyT &aKey) const
+{
+  return cursor (*this, &aKey, false, std::nullopt);
+}
+
+template <class KeyT, class ValueT, class CompareT, class LockPolicyT>
+typename concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::cursor
+concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::range (const KeyT &first, const KeyT &last) const
+{
+  return cursor (*this, &first, true, last);
+}
+
+template <class KeyT, class ValueT, class CompareT, class LockPolicyT>
+typename concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::cursor
+concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::scan () const
+{
+  return cursor (*this, nullptr, true, std::nullopt);
+}
+
+template <class KeyT, class ValueT, class CompareT, class LockPolicyT>
+int
+concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::findNode (const KeyT &aKey, Links **preds,
+								       Node **succs) const
+{
+  int levelFound = -1;
+  Links *pred = &head;
+  for (int level = maxLevel - 1; level >= 0; --level)
+    {
+      auto succ = pred->next (level).load ();
+      while (succ && compare (succ->key, aKey))
+	{
+	  pred = succ;
+	  succ = pred->next (level).load ();
+	}
+      if (levelFound == -1 && succ && !compare (aKey, succ->key))
+	{
+	  levelFound = level;
+	}
+      preds[level] = pred;
+      succs[level] = succ;
+    }
+  return levelFound;
+}
+
+template <class KeyT, class ValueT, class CompareT, class LockPolicyT>
+typename concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::Node *
+concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::findLiveNode (const KeyT &aKey) const
+{
+  Links *pred = &head;
+  for (int level = maxLevel - 1; level >= 0; --level)
+    {
+      auto succ = pred->next (level).load ();
+      while (succ && compare (succ->key, aKey))
+	{
+	  pred = succ;
+	  succ = pred->next (level).load ();
+	}
+      if (succ && !compare (aKey, succ->key)) // found on its highest level, no need to go down
+	{
+	  return succ->isFullyLinked && !succ->isMarked ? succ : nullptr;
+	}
+    }
+  return nullptr;
+}
+
+template <class KeyT, class ValueT, class CompareT, class LockPolicyT>
+typename concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::Node *
+concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::findFirstNode (const KeyT &aKey,
+									    bool isKeyIncluded) const
+{
+  Links *pred = &head;
+  Node *succ = nullptr;
+  for (int level = maxLevel - 1; level >= 0; --level)
+    {
+      succ = pred->next (level).load ();
+      while (succ && (isKeyIncluded ? compare (succ->key, aKey) : !compare (aKey, succ->key)))
+	{
+	  pred = succ;
+	  succ = pred->next (level).load ();
+	}
+    }
+  return succ;
+}
+
+template <class KeyT, class ValueT, class CompareT, class LockPolicyT>
+bool
+concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::lockPredecessors (Links **preds, Node **succs,
+									       int topLevel, bool checkSuccessors,
+									       PredecessorLocks &predLocks) const
+{
+  Links *lockedPred = nullptr;
+  for (int level = 0; level <= topLevel; ++level)
+    {
+      auto pred = preds[level];
+      auto succ = succs[level];
+      if (pred != lockedPred)
+	{
+	  predLocks[level] = std::unique_lock<Mutex> (getLinkMutex (pred));
+	  lockedPred = pred;
+	}
+      if (pred->isMarked || pred->next (level).load () != succ || (checkSuccessors && succ && succ->isMarked))
+	{
+	  return false;
+	}
+    }
+  return true;
+}
+
+template <class KeyT, class ValueT, class CompareT, class LockPolicyT>
+typename LockPolicyT::mutex_type &
+concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::getLinkMutex (Links *links) const
+{
+  return links == &head ? head.linkMutex : static_cast<Node *> (links)->linkMutex;
+}
+
+template <class KeyT, class ValueT, class CompareT, class LockPolicyT>
+int
+concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::getRandomLevel ()
+{
+  // Each level holds about half of the nodes of the level below it.
+  static std::atomic<uint64_t> seedCounter { 0 };
+  static thread_local uint64_t state = (++seedCounter * 0x9e3779b97f4a7c15ull) | 1;
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return std::min (std::countr_one (state), maxLevel - 1);
+}
+
+template <class KeyT, class ValueT, class CompareT, class LockPolicyT>
+void
+concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::retire (Node *aNode)
+{
+  aNode->retireEpoch = readEpoch.getEpoch (); // read after the node was unlinked
+  aNode->nextRetired = retiredNodes.load ();
+  while (!retiredNodes.compare_exchange_weak (aNode->nextRetired, aNode))
+    {
+    }
+
+  if (++retiredCount % reclaimInterval == 0)
+    {
+      reclaimRetired ();
+    }
+}
+
+template <class KeyT, class ValueT, class CompareT, class LockPolicyT>
+void
+concurrent_ordered_map<KeyT, ValueT, CompareT, LockPolicyT>::reclaimRetired ()
+{
+  // One thread frees nodes at a time; the others go on, their nodes are freed by a later call.
+  std::unique_lock<std::mutex> reclaimLock (reclaimMutex, std::try_to_lock);
+  if (!reclaimLock.owns_lock ())
+    {
+      return;
+    }
+
+  readEpoch.tryAdvance ();
+  for (auto aNode = retiredNodes.exchange (nullptr); aNode; aNode = aNode->nextRetired)
+    {
+      reclaimableNodes.push_back (aNode);
+    }
+
+  auto epoch = readEpoch.getEpoch ();
+  std::erase_if (reclaimableNodes, [epoch] (Node *aNode) {
+    if (aNode->retireEpoch + 3 > epoch)
+      {
+	return false;
+      }
+    delete aNode;
+    return true;
+  });
+}
+
+#endif
@@ -1,31 +1,77 @@
 ﻿#ifndef _CONCURRENT_HASH_MAP_HPP_
 #define _CONCURRENT_HASH_MAP_HPP_
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <functional>
+#include <initializer_list>
 #include <map>
-#include <shared_mutex>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "async_task.hpp"
+#include "async_wait_queue.hpp"
 #include "bucket.hpp"
+#include "bucket_table.hpp"
+#include "fast_hash.hpp"
 #include "internal_value.hpp"
 #include "iterator.hpp"
+#include "locked_entries.hpp"
+#include "lock_trace.hpp"
+#include "lock_policies.hpp"
+#include "map_statistics.hpp"
 #include "performance_counters.hpp"
+#include "read_epoch.hpp"
 #include "unordered_map_utils.hpp"
+#include "work_stealing_executor.hpp"
+#include "writers_gate.hpp"
 
-template <class KeyT, class ValueT, class HashFuncT = std::hash<KeyT>> class concurrent_unordered_map
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT> class concurrent_unordered_multimap;
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT> class write_combining_buffer;
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT> class weak_cursor;
+
+/// Entries whose key and value are small and trivially copyable (is_inline_storable_v) are stored inline in their
+/// bucket. An Iterator to such an entry points into the bucket's storage, which never moves an entry while an Iterator
+/// points into the bucket: inserts add storage instead of reallocating it, and compaction skips the bucket. Their
+/// values may also be changed by fetch_add, fetch_sub and compare_exchange while a read-locked Iterator points to them;
+/// read such values with get (), cvisit () or Iterator::load (), not through it->second, which is a plain read.
+template <class KeyT, class ValueT, class HashFuncT = default_hash<KeyT>, class LockPolicyT = shared_mutex_policy>
+class concurrent_unordered_map
 {
 public:
-  using iterator = Iterator<KeyT, ValueT, HashFuncT>;
-  using const_iterator = const Iterator<KeyT, ValueT, HashFuncT>;
+  using iterator = Iterator<KeyT, ValueT, HashFuncT, LockPolicyT>;
+  using const_iterator = const Iterator<KeyT, ValueT, HashFuncT, LockPolicyT>;
+  using locked_entries_type = locked_entries<KeyT, ValueT, HashFuncT, LockPolicyT>;
+
+  /// Whether fetch_add and fetch_sub are available.
+  static constexpr bool hasAtomicCounters =
+    is_inline_storable_v<KeyT, ValueT> && std::is_integral_v<ValueT> && !std::is_same_v<ValueT, bool>;
 
 public:
-  /// <summary>Constructor</summary>
+  /// <summary>Constructor. Buckets are allocated in chunks on first insert, so an unused map is cheap.</summary>
   /// <param name="bucketCount">How many buckets to start with</param>
+  /// <param name="anExecutor">Runs the map-wide operations (erase_if, ...); nullptr uses
+  /// WorkStealingExecutor::getDefault (). Must outlive the map</param>
   /// <returns></returns>
-  concurrent_unordered_map (std::size_t bucketCount = 500009, float erase_threshold_value = 0.7);
+  concurrent_unordered_map (std::size_t bucketCount = 500009, float erase_threshold_value = 0.7,
+			    WorkStealingExecutor *anExecutor = nullptr);
+
+  /// <summary>Destructor. Stops the maintenance thread if it was started.</summary>
+  ~concurrent_unordered_map ();
 
   /// <summary>Gets the number of elements in the map</summary>
   /// <param></param>
@@ -73,6 +119,23 @@ public:
   /// <returns>Write-locked iterator to the found element (will be end() if key is not found).</returns>
   const iterator find (const KeyT &aKey) const;
 
+  /// <summary>Runs a callback on the value of an element while holding its bucket and value read locks. Does not
+  /// allocate and does not create an iterator.</summary>
+  /// <param name="aKey">The key</param>
+  /// <param name="visitor">Called as visitor (const ValueT &amp;); must not call back into the map</param>
+  /// <returns>True if the key was found (and the visitor called).</returns>
+  template <class VisitorT> bool cvisit (const KeyT &aKey, VisitorT &&visitor) const;
+
+  /// <summary>Copies the value of an element.</summary>
+  /// <param name="aKey">The key</param>
+  /// <returns>The value, or std::nullopt if the key is not found.</returns>
+  std::optional<ValueT> get (const KeyT &aKey) const;
+
+  /// <summary>Checks whether the map holds an element with the key.</summary>
+  /// <param name="aKey">The key</param>
+  /// <returns></returns>
+  bool contains (const KeyT &aKey) const;
+
   /// <summary>Erases the element pointed by the Iterator. Invalidates the Iterator</summary>
   /// <param name="anIterator">The Iterator</param>
   /// <returns>True if element was present in the map (IE Iterator was valid).</returns>
@@ -83,21 +146,245 @@ public:
   /// <returns>True if element was present in the map.</returns>
   bool erase (const KeyT &aKey);
 
-  /// <summary>Increases the number of buckets and starts moving all valid (not erased) to the new buckets.</summary>
+  /// <summary>Replaces the value of an existing element.</summary>
+  /// <param name="aKey">The key</param>
+  /// <param name="aValue">The new value</param>
+  /// <returns>True if the key was present in the map.</returns>
+  bool update (const KeyT &aKey, const ValueT &aValue);
+
+  /// <summary>Adds to the value of an element. Once the key is in the map this is an atomic read-modify-write under
+  /// the bucket read lock, so concurrent counters on the same bucket do not serialize; the first call for a key
+  /// inserts it with the value delta. Only for integral values stored inline (is_inline_storable_v).</summary>
+  /// <param name="aKey">The key</param>
+  /// <param name="delta">Added to the value</param>
+  /// <returns>The value before the addition; ValueT () if the key was inserted.</returns>
+  ValueT fetch_add (const KeyT &aKey, ValueT delta)
+    requires (hasAtomicCounters);
+
+  /// <summary>Same as fetch_add, subtracting delta; a key seen for the first time is inserted as -delta.</summary>
+  ValueT fetch_sub (const KeyT &aKey, ValueT delta)
+    requires (hasAtomicCounters);
+
+  /// <summary>Replaces the value of an element with desired if it equals expected, as an atomic compare-exchange
+  /// under the bucket read lock. A key that is not in the map counts as holding ValueT (): exchanging it inserts the
+  /// key. Only for values stored inline (is_inline_storable_v).</summary>
+  /// <param name="aKey">The key</param>
+  /// <param name="expected">The value expected; receives the current value if the exchange fails</param>
+  /// <param name="desired">The new value</param>
+  /// <returns>True if the value was replaced.</returns>
+  bool compare_exchange (const KeyT &aKey, ValueT &expected, const ValueT &desired)
+    requires (is_inline_storable_v<KeyT, ValueT>);
+
+  /// <summary>Runs a callback with exclusive access to several keys, so that it can change them together (move an
+  /// amount between two counters, rename a key). Only the buckets of the keys are write-locked, in ascending bucket
+  /// order, so calls on other buckets run concurrently. The thread must not hold an iterator of this map.</summary>
+  /// <param name="keys">The keys the callback may access</param>
+  /// <param name="func">Called as func (locked_entries_type &amp;); must not call back into the map</param>
+  /// <returns>What func returns.</returns>
+  template <class FuncT>
+  std::invoke_result_t<FuncT &, locked_entries_type &> atomically (std::initializer_list<KeyT> keys, FuncT &&func);
+
+  /// <summary>Exchanges the values of two keys atomically (see atomically).</summary>
+  /// <param name="aKey">The first key</param>
+  /// <param name="otherKey">The second key</param>
+  /// <returns>True if both keys were in the map (and the values exchanged).</returns>
+  bool swap_values (const KeyT &aKey, const KeyT &otherKey);
+
+  /// <summary>Erases every element for which the predicate holds. The buckets are split into ranges processed by up
+  /// to threadCount threads of the map's executor, each locking a bucket once for all of its elements. A thread
+  /// holding iterators runs the whole sweep itself, since other threads would wait on the buckets it holds.</summary>
+  /// <param name="predicate">Called as predicate (const KeyT &amp;, const ValueT &amp;) from several threads at once;
+  /// must not call back into the map</param>
+  /// <param name="threadCount">Threads to use, the calling one included; 0 uses the whole executor</param>
+  /// <returns>The number of elements erased.</returns>
+  template <class PredicateT> std::size_t erase_if (PredicateT &&predicate, unsigned threadCount = 0);
+
+  /// <summary>Erases every element, releasing the buckets' storage, in parallel like erase_if. Invalidates every
+  /// Iterator of the calling thread.</summary>
+  /// <param name="threadCount">Threads to use, the calling one included; 0 uses the whole executor</param>
+  /// <returns></returns>
+  void clear (unsigned threadCount = 0);
+
+  /// <summary>Runs a callback on every element with its value writable, in parallel like erase_if (each bucket is
+  /// write-locked once).</summary>
+  /// <param name="visitor">Called as visitor (const KeyT &amp;, ValueT &amp;) from several threads at once; must not
+  /// call back into the map</param>
+  /// <param name="threadCount">Threads to use, the calling one included; 0 uses the whole executor</param>
+  /// <returns></returns>
+  template <class VisitorT> void for_each (VisitorT &&visitor, unsigned threadCount = 0);
+
+  /// <summary>Runs a callback on every element, in parallel like erase_if (each bucket is read-locked once). An
+  /// element inserted or erased meanwhile may or may not be seen.</summary>
+  /// <param name="visitor">Called as visitor (const KeyT &amp;, const ValueT &amp;) from several threads at once; must
+  /// not call back into the map</param>
+  /// <param name="threadCount">Threads to use, the calling one included; 0 uses the whole executor</param>
+  /// <returns></returns>
+  template <class VisitorT> void cvisit_all (VisitorT &&visitor, unsigned threadCount = 0) const;
+
+  /// <summary>Finds an element without blocking the calling thread on a contended bucket or value. If either is
+  /// locked, the coroutine is suspended and resumed when the owner releases it.</summary>
+  /// <param name="aKey">The key (copied into the coroutine frame)</param>
+  /// <param name="scheduler">Resumes the coroutine after a wait; nullptr uses
+  /// AsyncWaitQueue::getDefaultScheduler ()</param>
+  /// <returns>Task yielding a copy of the value, or std::nullopt if the key is not found.</returns>
+  AsyncTask<std::optional<ValueT>> async_find (KeyT aKey, AsyncScheduler *scheduler = nullptr) const;
+
+  /// <summary>Inserts a key-value pair, suspending instead of blocking on a contended bucket.</summary>
+  /// <param name="aKeyValuePair">The pair to be inserted (copied into the coroutine frame)</param>
+  /// <param name="scheduler">Resumes the coroutine after a wait; nullptr uses
+  /// AsyncWaitQueue::getDefaultScheduler ()</param>
+  /// <returns>Task yielding true if the pair was inserted, false if the key was already present.</returns>
+  AsyncTask<bool> async_insert (std::pair<KeyT, ValueT> aKeyValuePair, AsyncScheduler *scheduler = nullptr);
+
+  /// <summary>Replaces the value of an element, suspending instead of blocking on a contended bucket.</summary>
+  /// <param name="aKey">The key (copied into the coroutine frame)</param>
+  /// <param name="aValue">The new value (copied into the coroutine frame)</param>
+  /// <param name="scheduler">Resumes the coroutine after a wait; nullptr uses
+  /// AsyncWaitQueue::getDefaultScheduler ()</param>
+  /// <returns>Task yielding true if the key was present in the map.</returns>
+  AsyncTask<bool> async_update (KeyT aKey, ValueT aValue, AsyncScheduler *scheduler = nullptr);
+
+  /// <summary>Finds an element, giving up if a bucket or value lock is not acquired within the budget.</summary>
+  /// <param name="aKey">The key</param>
+  /// <param name="budget">A deadline, a timeout or LockWaitBudget::spins (n)</param>
+  /// <returns>std::nullopt if the operation would block, otherwise the write-locked iterator (can be end).</returns>
+  std::optional<iterator> try_find (const KeyT &aKey, LockWaitBudget budget);
+
+  /// <summary>Finds an element, giving up if a bucket or value lock is not acquired within the budget.</summary>
+  /// <param name="aKey">The key</param>
+  /// <param name="budget">A deadline, a timeout or LockWaitBudget::spins (n)</param>
+  /// <returns>std::nullopt if the operation would block, otherwise the read-locked iterator (can be end).</returns>
+  std::optional<const iterator> try_find (const KeyT &aKey, LockWaitBudget budget) const;
+
+  /// <summary>Inserts a key-value pair, giving up if a lock is not acquired within the budget.</summary>
+  /// <param name="aKeyValuePair">The pair to be inserted</param>
+  /// <param name="budget">A deadline, a timeout or LockWaitBudget::spins (n)</param>
+  /// <returns>std::nullopt if the operation would block, otherwise the same result as insert.</returns>
+  std::optional<std::pair<iterator, bool>> try_insert (const std::pair<KeyT, ValueT> &aKeyValuePair,
+						       LockWaitBudget budget);
+
+  /// <summary>Erases the element with the key, giving up if a lock is not acquired within the budget.</summary>
+  /// <param name="aKey">The key</param>
+  /// <param name="budget">A deadline, a timeout or LockWaitBudget::spins (n)</param>
+  /// <returns>std::nullopt if the operation would block, otherwise true if the element was present.</returns>
+  std::optional<bool> try_erase (const KeyT &aKey, LockWaitBudget budget);
+
+  /// <summary>Replaces the value of an element, giving up if a lock is not acquired within the budget.</summary>
+  /// <param name="aKey">The key</param>
+  /// <param name="aValue">The new value</param>
+  /// <param name="budget">A deadline, a timeout or LockWaitBudget::spins (n)</param>
+  /// <returns>std::nullopt if the operation would block, otherwise true if the element was present.</returns>
+  std::optional<bool> try_update (const KeyT &aKey, const ValueT &aValue, LockWaitBudget budget);
+
+  /// <summary>Chooses whether erase compacts a bucket itself once its live/total ratio drops below the erase
+  /// threshold (INLINE, the default) or only queues it for compact () (DEFERRED).</summary>
+  /// <param name="mode">The compaction mode</param>
+  /// <returns></returns>
+  void set_compaction_mode (CompactionMode mode);
+
+  /// <summary>Compacts buckets queued by erase in DEFERRED mode until the time slice is used up. A bucket locked by
+  /// another thread stays queued for the next call. Also runs a shrink requested by the low watermark.</summary>
+  /// <param name="timeSlice">Upper bound for the time spent in this call</param>
+  /// <returns>The number of buckets compacted.</returns>
+  std::size_t compact (std::chrono::microseconds timeSlice);
+
+  /// <summary>Switches to DEFERRED compaction and starts a thread that calls compact () periodically.</summary>
+  /// <param name="interval">Pause between two compaction steps</param>
+  /// <param name="timeSlice">Time slice of each compaction step</param>
+  /// <returns></returns>
+  void start_maintenance (std::chrono::milliseconds interval = std::chrono::milliseconds (10),
+			  std::chrono::microseconds timeSlice = std::chrono::microseconds (500));
+
+  /// <summary>Stops the maintenance thread. Buckets still queued are compacted by later compact () calls.</summary>
+  /// <param></param>
+  /// <returns></returns>
+  void stop_maintenance ();
+
+  /// <summary>Gets the number of buckets</summary>
+  /// <param></param>
+  /// <returns></returns>
+  std::size_t bucket_count () const;
+
+  /// <summary>Sizes the bucket array for at least count elements in a single step. Does nothing if the map already
+  /// has enough buckets. Same concurrency rules as rehash (); throws std::length_error past the largest bucket count of
+  /// the prime table.</summary>
+  /// <param name="count">The expected number of elements</param>
+  /// <returns></returns>
+  void reserve (std::size_t count);
+
+  /// <summary>Collects chain lengths, tombstones, load factor, sampled probe counts and the most contended buckets.
+  /// Takes each bucket's read lock briefly, one bucket at a time. Lock waits are counted per bucket table, so they
+  /// restart after a rehash / shrink.</summary>
+  /// <param name="topCount">How many of the most contended buckets to report</param>
+  /// <returns>The statistics; toText () and toJson () export them.</returns>
+  MapStatistics get_statistics (std::size_t topCount = 10) const;
+
+  /// <summary>Increases the number of buckets and moves all valid (not erased) elements to the new buckets.
+  /// Readers are not blocked; writers wait until the move is done, and the move waits until the iterators returned by
+  /// the non-const find () and insert () are released. Must not be called by a thread holding an iterator of this
+  /// map. Throws std::length_error if the map already has the largest bucket count of the prime
+  /// table.</summary>
   /// <param ></param>
   /// <returns></returns>
   void rehash ();
 
+  /// <summary>Moves all valid elements to the smallest bucket array from the prime table that keeps the load factor
+  /// at or below 1, and returns the old one to the allocator. Same concurrency rules as rehash ().</summary>
+  /// <param></param>
+  /// <returns>True if the bucket array was replaced.</returns>
+  bool shrink_to_fit ();
+
+  /// <summary>Requests a shrink_to_fit () once an erase leaves size () / bucket_count () below the watermark.
+  /// The shrink runs in compact (), so it needs the maintenance thread or periodic compact () calls.</summary>
+  /// <param name="loadFactor">The low watermark; 0 (the default) disables the automatic shrink</param>
+  /// <returns></returns>
+  void set_shrink_watermark (double loadFactor);
+
+  /// <summary>Chooses whether lookups (find, contains, erase, ...) check the bucket's lookup filter before locking
+  /// it. The filter is a blocked Bloom filter of 64 bits per bucket, kept up to date by every insert whether or not
+  /// it is checked, so it can be switched on at any time; a lookup of a missing key then usually returns after one
+  /// probe of the bucket, without taking a lock or scanning the bucket.</summary>
+  /// <param name="enabled">True to check the filter; off by default</param>
+  /// <returns></returns>
+  void set_lookup_filter (bool enabled);
+
 private:
-  using InternalValue = internal_value<KeyT, ValueT, HashFuncT>;
-  using Bucket = bucket<KeyT, ValueT, HashFuncT>;
+  using InternalValue = internal_value<KeyT, ValueT, HashFuncT, LockPolicyT>;
+  using Bucket = bucket<KeyT, ValueT, HashFuncT, LockPolicyT>;
+  using Mutex = typename LockPolicyT::mutex_type;
+  using ReadLock = typename lock_types<Mutex>::ReadLock;
+  using SharedReadLock = typename lock_types<Mutex>::SharedReadLock;
+  using WriteLock = typename lock_types<Mutex>::WriteLock;
+  using SharedWriteLock = typename lock_types<Mutex>::SharedWriteLock;
+  using VariantLock = typename lock_types<Mutex>::VariantLock;
+  using SharedVariantLock = typename lock_types<Mutex>::SharedVariantLock;
+  using LockMap = typename lock_types<Mutex>::LockMap;
+  using BucketTable = bucket_table<Bucket>;
+  using GateLock = std::shared_lock<WritersGate>;
 
 private:
+  // Operations hash the key once: the hash picks the bucket and is passed on to the bucket for its key tags.
+  std::size_t getBucketIndexForHash (std::size_t keyHash, const BucketTable &aTable) const;
+  // The bucket that may hold the key; nullptr if it certainly does not: never allocated, or rejected by its lookup
+  // filter. Takes no lock.
+  Bucket *findBucket (const BucketTable &aTable, std::size_t bucketIndex, std::size_t keyHash) const;
+  void pinToTable (iterator &it, const BucketTable *aTable, ReadEpoch::Guard &&epochGuard,
+		   GateLock &&writersPass = GateLock ()) const;
+  GateLock lockWritersGate ();
+  void migrateTo (std::size_t newBucketCount);
+
   std::size_t getNextPopulatedBucketIndex (std::size_t anIndex) const;
-  SharedVariantLock aquireBucketLock (int bucketIndex) const;
-  static SharedVariantLock getValueLockFor (std::shared_mutex *mutexAddress, LockType lockType);
-  static SharedVariantLock getBucketLockFor (std::shared_mutex *mutexAddress, LockType lockType);
-  static SharedVariantLock aquireLockFor (std::shared_mutex *mutexAddress, LockType lockType, LockMap &lockMap);
+  SharedVariantLock aquireBucketLock (const BucketTable *aTable, int bucketIndex) const;
+  static SharedVariantLock getValueLockFor (Mutex *mutexAddress, LockType lockType);
+  static SharedVariantLock getBucketLockFor (Mutex *mutexAddress, LockType lockType,
+					     BucketContention *contention = nullptr);
+  static SharedVariantLock tryGetBucketLockFor (Mutex *mutexAddress, LockType lockType,
+						BucketContention *contention = nullptr);
+  static LockMap &getBucketLockMap ();
+  static LockMap &getValueLockMap ();
+  static SharedVariantLock aquireLockFor (Mutex *mutexAddress, LockType lockType, LockMap &lockMap,
+					  bool notifyWaiters, bool tryOnly = false,
+					  BucketContention *contention = nullptr);
 
   /// <summary>Gets the key of the first element - equivalent to begin()</summary>
   /// <param></param>
@@ -110,130 +397,290 @@ private:
 
   void unlockResource (std::size_t &bucketIndex, int &valueIndex) const;
 
+  void scheduleCompaction (int bucketIndex);
+
+  // Used by concurrent_unordered_multimap, which keeps several values per key in the same buckets.
+  template <class InputIt> std::size_t appendValues (const KeyT &aKey, InputIt first, InputIt last);
+  template <class VisitorT> std::size_t cvisitAll (const KeyT &aKey, VisitorT &&visitor) const;
+  std::size_t eraseAll (const KeyT &aKey);
+
+  // Runs modify (std::atomic_ref<ValueT>) on the value of the key; false if the key is not in the map.
+  template <class ModifyT> bool modifyValue (const KeyT &aKey, ModifyT &&modify);
+
+  // Used by write_combining_buffer: applies the writes with one bucket lock per bucket (or none, when another thread
+  // holding the bucket applies them). Reorders the writes by bucket, keeping the order of each key's writes.
+  void applyWrites (std::vector<buffered_write<KeyT, ValueT>> &writes);
+
+  // Runs bucketFn (bucketIndex, bucket) on every allocated bucket of the table, split into ranges run on up to
+  // threadCount threads of the executor.
+  template <class BucketFuncT>
+  void forEachBucket (const BucketTable &aTable, unsigned threadCount, BucketFuncT &&bucketFn) const;
+
 private:
   HashFuncT hashFunc;
-  std::vector<Bucket> buckets;
-  std::size_t currentBucketCount;
+  std::atomic<BucketTable *> table;
   std::atomic<uint64_t> valueCount;
   std::atomic<uint64_t> erasedCount;
   float erase_threshold;
 
+  std::atomic<CompactionMode> compactionMode;
+  std::mutex compactionQueueMutex;
+  std::deque<int> compactionQueue;
+
+  std::thread maintenanceThread;
+  std::mutex maintenanceMutex;
+  std::condition_variable maintenanceCondition;
+  bool isMaintenanceRunning;
+
+  // Operations read the bucket table inside a read epoch, so a replaced table is freed only after they are done.
+  // Writers also pass the gate; a migration closes it while it moves the elements.
+  mutable ReadEpoch readEpoch;
+  WritersGate writersGate;
+  std::mutex migrationMutex;
+  std::atomic<double> shrinkWatermark;
+  std::atomic<bool> shrinkRequested;
+  std::atomic<bool> isLookupFilterEnabled;
+
+  mutable ProbeSampler probeSampler;
+  WorkStealingExecutor *executor;
+
   friend iterator;
   friend InternalValue;
   friend Bucket;
+  friend concurrent_unordered_multimap<KeyT, ValueT, HashFuncT, LockPolicyT>;
+  friend write_combining_buffer<KeyT, ValueT, HashFuncT, LockPolicyT>;
+  friend weak_cursor<KeyT, ValueT, HashFuncT, LockPolicyT>;
+  friend locked_entries_type;
 };
 
-template <class KeyT, class ValueT, class HashFuncT>
-concurrent_unordered_map<KeyT, ValueT, HashFuncT>::concurrent_unordered_map (std::size_t bucketCount,
-									     float erase_threshold_value)
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::concurrent_unordered_map (std::size_t bucketCount,
+											  float erase_threshold_value,
+											  WorkStealingExecutor *anExecutor)
 {
-  buckets.resize (bucketCount);
-  currentBucketCount = bucketCount;
+  table = new BucketTable (bucketCount);
+  executor = anExecutor;
   valueCount = 0;
   erasedCount = 0;
   erase_threshold = erase_threshold_value;
+  compactionMode = CompactionMode::INLINE;
+  isMaintenanceRunning = false;
+  shrinkWatermark = 0;
+  shrinkRequested = false;
+  isLookupFilterEnabled = false;
 }
 
-template <class KeyT, class ValueT, class HashFuncT>
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::~concurrent_unordered_map ()
+{
+  stop_maintenance ();
+  delete table.load ();
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
 std::size_t
-concurrent_unordered_map<KeyT, ValueT, HashFuncT>::size () const
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::size () const
 {
   return valueCount - erasedCount;
 }
 
-template <class KeyT, class ValueT, class HashFuncT>
-typename concurrent_unordered_map<KeyT, ValueT, HashFuncT>::iterator
-concurrent_unordered_map<KeyT, ValueT, HashFuncT>::begin () const
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+std::size_t
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::bucket_count () const
+{
+  ReadEpoch::Guard epochGuard (readEpoch);
+  return table.load ()->size ();
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+typename concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::iterator
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::begin () const
 {
-  for (int i = 0; i < int (buckets.size ()); ++i)
+  ReadEpoch::Guard epochGuard (readEpoch);
+  auto aTable = table.load ();
+
+  for (int i = 0; i < int (aTable->size ()); ++i)
     {
-      if (buckets[i].getSize () > 0)
+      auto aBucket = aTable->find (i);
+      if (aBucket && aBucket->getSize () > 0)
 	{
-	  return buckets[i].begin (this, i);
+	  auto it = aBucket->begin (this, i);
+	  pinToTable (it, aTable, std::move (epochGuard));
+	  return it;
 	}
     }
   return end ();
 }
 
-template <class KeyT, class ValueT, class HashFuncT>
-typename concurrent_unordered_map<KeyT, ValueT, HashFuncT>::iterator
-concurrent_unordered_map<KeyT, ValueT, HashFuncT>::end () const
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+typename concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::iterator
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::end () const
 {
   return Iterator (this, true /*isEnd*/);
 }
 
-template <class KeyT, class ValueT, class HashFuncT>
-std::pair<typename concurrent_unordered_map<KeyT, ValueT, HashFuncT>::iterator, bool>
-concurrent_unordered_map<KeyT, ValueT, HashFuncT>::insert (const std::pair<KeyT, ValueT> &aKeyValuePair)
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+std::pair<typename concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::iterator, bool>
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::insert (const std::pair<KeyT, ValueT> &aKeyValuePair)
 {
-  auto hashResult = hashFunc (aKeyValuePair.first);
-  int bucketIndex = int (hashResult) % currentBucketCount;
+  ReadEpoch::Guard epochGuard (readEpoch);
+  auto gateLock = lockWritersGate ();
+  auto aTable = table.load ();
+  auto keyHash = hashFunc (aKeyValuePair.first);
+  int bucketIndex = getBucketIndexForHash (keyHash, *aTable);
 
-  auto result = buckets[bucketIndex].insert (this, bucketIndex, aKeyValuePair);
+  auto result = (*aTable)[bucketIndex].insert (this, bucketIndex, aKeyValuePair, keyHash);
   if (result.second)
     {
       ++valueCount;
     }
 
+  pinToTable (result.first, aTable, std::move (epochGuard), std::move (gateLock));
   return result;
 }
 
-template <class KeyT, class ValueT, class HashFuncT>
-std::pair<typename concurrent_unordered_map<KeyT, ValueT, HashFuncT>::iterator, bool>
-concurrent_unordered_map<KeyT, ValueT, HashFuncT>::insert (const KeyT &aKey, const ValueT &aValue)
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+std::pair<typename concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::iterator, bool>
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::insert (const KeyT &aKey, const ValueT &aValue)
 {
-  auto hashResult = hashFunc (aKey);
-  int bucketIndex = int (hashResult) % currentBucketCount;
+  return insert (std::make_pair (aKey, aValue));
+}
 
-  auto result = buckets[bucketIndex].insert (this, bucketIndex, std::make_pair (aKey, aValue));
-  if (result.second)
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+typename concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::iterator const
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::find (const KeyT &aKey) const
+{
+  ReadEpoch::Guard epochGuard (readEpoch);
+  auto aTable = table.load ();
+  auto keyHash = hashFunc (aKey);
+  int bucketIndex = getBucketIndexForHash (keyHash, *aTable);
+  auto aBucket = findBucket (*aTable, bucketIndex, keyHash);
+  if (!aBucket)
     {
-      ++valueCount;
+      return end ();
     }
 
-  return result;
+  std::size_t probeCount = 0;
+  bool isSampled = ProbeSampler::shouldSample ();
+  auto it = aBucket->find (this, bucketIndex, aKey, keyHash, LockType::READ, isSampled ? &probeCount : nullptr);
+  if (isSampled)
+    {
+      probeSampler.record (probeCount);
+    }
+  pinToTable (it, aTable, std::move (epochGuard));
+  return it;
 }
 
-template <class KeyT, class ValueT, class HashFuncT>
-typename concurrent_unordered_map<KeyT, ValueT, HashFuncT>::iterator const
-concurrent_unordered_map<KeyT, ValueT, HashFuncT>::find (const KeyT &aKey) const
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+typename concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::iterator
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::find (const KeyT &aKey)
 {
-  auto hashResult = hashFunc (aKey);
-  int bucketIndex = int (hashResult) % currentBucketCount;
+  ReadEpoch::Guard epochGuard (readEpoch);
+  auto gateLock = lockWritersGate ();
+  auto aTable = table.load ();
+  auto keyHash = hashFunc (aKey);
+  int bucketIndex = getBucketIndexForHash (keyHash, *aTable);
+  auto aBucket = findBucket (*aTable, bucketIndex, keyHash);
+  if (!aBucket)
+    {
+      return end ();
+    }
 
-  return buckets[bucketIndex].find (this, bucketIndex, aKey, LockType::READ);
+  std::size_t probeCount = 0;
+  bool isSampled = ProbeSampler::shouldSample ();
+  auto it = aBucket->find (this, bucketIndex, aKey, keyHash, LockType::WRITE, isSampled ? &probeCount : nullptr);
+  if (isSampled)
+    {
+      probeSampler.record (probeCount);
+    }
+  pinToTable (it, aTable, std::move (epochGuard), std::move (gateLock));
+  return it;
 }
 
-template <class KeyT, class ValueT, class HashFuncT>
-typename concurrent_unordered_map<KeyT, ValueT, HashFuncT>::iterator
-concurrent_unordered_map<KeyT, ValueT, HashFuncT>::find (const KeyT &aKey)
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+template <class VisitorT>
+bool
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::cvisit (const KeyT &aKey, VisitorT &&visitor) const
 {
-  auto hashResult = hashFunc (aKey);
-  int bucketIndex = int (hashResult) % currentBucketCount;
+  // A thread that holds iterators may already own these locks; it goes through the lock maps like find () does.
+  if (!getBucketLockMap ().empty () || !getValueLockMap ().empty ())
+    {
+      auto it = find (aKey);
+      if (it == end ())
+	{
+	  return false;
+	}
+      visitor (std::as_const (it->second));
+      return true;
+    }
+
+  ReadEpoch::Guard epochGuard (readEpoch);
+  auto aTable = table.load ();
+  auto keyHash = hashFunc (aKey);
+  auto aBucket = findBucket (*aTable, getBucketIndexForHash (keyHash, *aTable), keyHash);
+  if (!aBucket)
+    {
+      return false;
+    }
+
+  std::size_t probeCount = 0;
+  bool isSampled = ProbeSampler::shouldSample ();
+  bool isFound = aBucket->visit (aKey, keyHash, visitor, isSampled ? &probeCount : nullptr);
+  if (isSampled)
+    {
+      probeSampler.record (probeCount);
+    }
+  return isFound;
+}
 
-  return buckets[bucketIndex].find (this, bucketIndex, aKey, LockType::WRITE);
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+std::optional<ValueT>
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::get (const KeyT &aKey) const
+{
+  std::optional<ValueT> result;
+  cvisit (aKey, [&result] (const ValueT &aValue) { result = aValue; });
+  return result;
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+bool
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::contains (const KeyT &aKey) const
+{
+  return cvisit (aKey, [] (const ValueT &) {});
 }
 
-template <class KeyT, class ValueT, class HashFuncT>
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
 bool
-concurrent_unordered_map<KeyT, ValueT, HashFuncT>::erase (const iterator &anIterator)
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::erase (const iterator &anIterator)
 {
   return erase (anIterator.key);
 }
 
-template <class KeyT, class ValueT, class HashFuncT>
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
 bool
-concurrent_unordered_map<KeyT, ValueT, HashFuncT>::erase (const KeyT &aKey)
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::erase (const KeyT &aKey)
 {
-  auto hashResult = hashFunc (aKey);
-  auto bucketIndex = int (hashResult) % currentBucketCount;
+  ReadEpoch::Guard epochGuard (readEpoch);
+  auto gateLock = lockWritersGate ();
+  auto aTable = table.load ();
+  auto keyHash = hashFunc (aKey);
+  auto bucketIndex = getBucketIndexForHash (keyHash, *aTable);
+  auto aBucket = findBucket (*aTable, bucketIndex, keyHash);
 
-  int position = buckets[bucketIndex].erase (aKey);
+  bool needsCompaction = false;
+  int position = aBucket ? aBucket->erase (aKey, keyHash, erase_threshold, compactionMode, needsCompaction) : -1;
 
   if (position != -1)
     {
       ++erasedCount;
-      buckets[bucketIndex].eraseUnavailableValues (this, bucketIndex, erase_threshold);
+      if (needsCompaction)
+	{
+	  scheduleCompaction (bucketIndex);
+	}
+      if (double (size ()) < double (aTable->size ()) * shrinkWatermark)
+	{
+	  shrinkRequested = true;
+	}
     }
 
   if (position != -1)
@@ -243,13 +690,779 @@ concurrent_unordered_map<KeyT, ValueT, HashFuncT>::erase (const KeyT &aKey)
   return false;
 }
 
-template <class KeyT, class ValueT, class HashFuncT>
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+bool
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::update (const KeyT &aKey, const ValueT &aValue)
+{
+  ReadEpoch::Guard epochGuard (readEpoch);
+  auto gateLock = lockWritersGate ();
+  auto aTable = table.load ();
+  auto keyHash = hashFunc (aKey);
+  auto aBucket = findBucket (*aTable, getBucketIndexForHash (keyHash, *aTable), keyHash);
+
+  return aBucket && aBucket->update (aKey, keyHash, aValue);
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+ValueT
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::fetch_add (const KeyT &aKey, ValueT delta)
+  requires (hasAtomicCounters)
+{
+  ValueT previous = ValueT ();
+  auto modify = [&previous, delta] (std::atomic_ref<ValueT> value) { previous = value.fetch_add (delta); };
+  while (!modifyValue (aKey, modify))
+    {
+      // First sight of the key; another thread may insert it first, then the addition is retried.
+      if (insert (aKey, delta).second)
+	{
+	  return ValueT ();
+	}
+    }
+  return previous;
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+ValueT
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::fetch_sub (const KeyT &aKey, ValueT delta)
+  requires (hasAtomicCounters)
+{
+  ValueT previous = ValueT ();
+  auto modify = [&previous, delta] (std::atomic_ref<ValueT> value) { previous = value.fetch_sub (delta); };
+  while (!modifyValue (aKey, modify))
+    {
+      if (insert (aKey, ValueT () - delta).second)
+	{
+	  return ValueT ();
+	}
+    }
+  return previous;
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+bool
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::compare_exchange (const KeyT &aKey, ValueT &expected,
+										  const ValueT &desired)
+  requires (is_inline_storable_v<KeyT, ValueT>)
+{
+  bool isExchanged = false;
+  auto exchange = [&isExchanged, &expected, &desired] (std::atomic_ref<ValueT> value) {
+    isExchanged = value.compare_exchange_strong (expected, desired);
+  };
+
+  while (!modifyValue (aKey, exchange))
+    {
+      // Compared like the atomic compares: by object representation.
+      const ValueT missingValue = ValueT ();
+      if (std::memcmp (&expected, &missingValue, sizeof (ValueT)) != 0)
+	{
+	  expected = missingValue;
+	  return false;
+	}
+      if (insert (aKey, desired).second)
+	{
+	  return true;
+	}
+    }
+  return isExchanged;
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+template <class ModifyT>
+bool
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::modifyValue (const KeyT &aKey, ModifyT &&modify)
+{
+  // No writers gate: a migration retires each bucket (see Bucket::retire) before it copies it, and a modification
+  // turned away by a retired bucket waits for the new table and runs there.
+  ReadEpoch::Guard epochGuard (readEpoch);
+  auto keyHash = hashFunc (aKey);
+  bool throughLockMaps = !getBucketLockMap ().empty () || !getValueLockMap ().empty ();
+  while (true)
+    {
+      auto aTable = table.load ();
+      auto aBucket = findBucket (*aTable, getBucketIndexForHash (keyHash, *aTable), keyHash);
+      if (!aBucket)
+	{
+	  return false;
+	}
+
+      auto isModified = aBucket->modifyValue (aKey, modify, throughLockMaps);
+      if (isModified)
+	{
+	  return *isModified;
+	}
+      lockWritersGate (); // passes once the migration has published the new table
+    }
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+template <class FuncT>
+std::invoke_result_t<FuncT &, locked_entries<KeyT, ValueT, HashFuncT, LockPolicyT> &>
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::atomically (std::initializer_list<KeyT> keys,
+									    FuncT &&func)
+{
+  ReadEpoch::Guard epochGuard (readEpoch);
+  auto gateLock = lockWritersGate ();
+
+  locked_entries_type entries (*this, *table.load (), keys);
+  return func (entries);
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+bool
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::swap_values (const KeyT &aKey, const KeyT &otherKey)
+{
+  return atomically ({ aKey, otherKey }, [&aKey, &otherKey] (locked_entries_type &entries) {
+    auto value = entries.find (aKey);
+    auto otherValue = entries.find (otherKey);
+    if (!value || !otherValue)
+      {
+	return false;
+      }
+
+    std::swap (*value, *otherValue);
+    return true;
+  });
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+template <class PredicateT>
+std::size_t
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::erase_if (PredicateT &&predicate, unsigned threadCount)
+{
+  ReadEpoch::Guard epochGuard (readEpoch);
+  auto gateLock = lockWritersGate ();
+  auto aTable = table.load ();
+
+  std::atomic<std::size_t> erasedValues = 0;
+  bool throughLockMaps = !getBucketLockMap ().empty () || !getValueLockMap ().empty ();
+  auto eraseInBucket = [this, &predicate, &erasedValues, throughLockMaps] (std::size_t bucketIndex, Bucket &aBucket) {
+    bool needsCompaction = false;
+    auto bucketErased = aBucket.eraseIf (predicate, erase_threshold, compactionMode, needsCompaction, throughLockMaps);
+    if (bucketErased > 0)
+      {
+	erasedValues += bucketErased;
+	erasedCount += bucketErased;
+      }
+    if (needsCompaction)
+      {
+	scheduleCompaction (int (bucketIndex));
+      }
+  };
+  forEachBucket (*aTable, threadCount, eraseInBucket);
+
+  if (double (size ()) < double (aTable->size ()) * shrinkWatermark)
+    {
+      shrinkRequested = true;
+    }
+  return erasedValues;
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+void
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::clear (unsigned threadCount)
+{
+  ReadEpoch::Guard epochGuard (readEpoch);
+  auto gateLock = lockWritersGate ();
+  auto aTable = table.load ();
+
+  bool throughLockMaps = !getBucketLockMap ().empty () || !getValueLockMap ().empty ();
+  forEachBucket (*aTable, threadCount,
+		 [this, throughLockMaps] (std::size_t, Bucket &aBucket) { erasedCount += aBucket.clear (throughLockMaps); });
+
+  if (double (size ()) < double (aTable->size ()) * shrinkWatermark)
+    {
+      shrinkRequested = true;
+    }
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+template <class VisitorT>
+void
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::for_each (VisitorT &&visitor, unsigned threadCount)
+{
+  ReadEpoch::Guard epochGuard (readEpoch);
+  auto gateLock = lockWritersGate ();
+  auto aTable = table.load ();
+
+  bool throughLockMaps = !getBucketLockMap ().empty () || !getValueLockMap ().empty ();
+  forEachBucket (*aTable, threadCount, [&visitor, throughLockMaps] (std::size_t, Bucket &aBucket) {
+    aBucket.visitEntries (visitor, throughLockMaps);
+  });
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+template <class VisitorT>
+void
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::cvisit_all (VisitorT &&visitor,
+									    unsigned threadCount) const
+{
+  ReadEpoch::Guard epochGuard (readEpoch);
+  auto aTable = table.load ();
+
+  bool throughLockMaps = !getBucketLockMap ().empty () || !getValueLockMap ().empty ();
+  forEachBucket (*aTable, threadCount, [&visitor, throughLockMaps] (std::size_t, const Bucket &aBucket) {
+    aBucket.cvisitEntries (visitor, throughLockMaps);
+  });
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+template <class BucketFuncT>
+void
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::forEachBucket (const BucketTable &aTable,
+									       unsigned threadCount,
+									       BucketFuncT &&bucketFn) const
+{
+  const std::size_t bucketsPerTask = 1024;
+
+  // Other threads would block on the buckets this thread holds through its iterators.
+  if (!getBucketLockMap ().empty () || !getValueLockMap ().empty ())
+    {
+      threadCount = 1;
+    }
+
+  auto processRange = [&aTable, &bucketFn] (std::size_t first, std::size_t last) {
+    for (auto i = first; i < last; ++i)
+      {
+	auto aBucket = aTable.find (i);
+	if (aBucket)
+	  {
+	    bucketFn (i, *aBucket);
+	  }
+      }
+  };
+
+  auto anExecutor = executor ? executor : &WorkStealingExecutor::getDefault ();
+  anExecutor->parallelFor (0, aTable.size (), threadCount, bucketsPerTask, processRange);
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+void
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::applyWrites (
+  std::vector<buffered_write<KeyT, ValueT>> &writes)
+{
+  ReadEpoch::Guard epochGuard (readEpoch);
+  auto gateLock = lockWritersGate ();
+  auto aTable = table.load ();
+
+  for (auto &write : writes)
+    {
+      write.keyHash = hashFunc (write.key);
+      write.bucketIndex = getBucketIndexForHash (write.keyHash, *aTable);
+    }
+  std::stable_sort (writes.begin (), writes.end (),
+		    [] (const auto &left, const auto &right) { return left.bucketIndex < right.bucketIndex; });
+
+  bool throughLockMaps = !getBucketLockMap ().empty () || !getValueLockMap ().empty ();
+  for (auto first = writes.begin (); first != writes.end ();)
+    {
+      auto last = std::find_if (first, writes.end (),
+				[first] (const auto &write) { return write.bucketIndex != first->bucketIndex; });
+
+      typename Bucket::CombinedBatch batch;
+      batch.first = &*first;
+      batch.last = batch.first + (last - first);
+      (*aTable)[first->bucketIndex].combineWrites (batch, erase_threshold, compactionMode, throughLockMaps);
+
+      valueCount += batch.insertedCount;
+      erasedCount += batch.erasedCount;
+      if (batch.needsCompaction)
+	{
+	  scheduleCompaction (first->bucketIndex);
+	}
+      first = last;
+    }
+
+  if (double (size ()) < double (aTable->size ()) * shrinkWatermark)
+    {
+      shrinkRequested = true;
+    }
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+template <class InputIt>
+std::size_t
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::appendValues (const KeyT &aKey, InputIt first,
+									      InputIt last)
+{
+  ReadEpoch::Guard epochGuard (readEpoch);
+  auto gateLock = lockWritersGate ();
+  auto aTable = table.load ();
+
+  auto keyHash = hashFunc (aKey);
+  auto appendedCount = (*aTable)[getBucketIndexForHash (keyHash, *aTable)].append (aKey, keyHash, first, last);
+  valueCount += appendedCount;
+  return appendedCount;
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+template <class VisitorT>
+std::size_t
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::cvisitAll (const KeyT &aKey, VisitorT &&visitor) const
+{
+  ReadEpoch::Guard epochGuard (readEpoch);
+  auto aTable = table.load ();
+  auto keyHash = hashFunc (aKey);
+  auto aBucket = findBucket (*aTable, getBucketIndexForHash (keyHash, *aTable), keyHash);
+  if (!aBucket)
+    {
+      return 0;
+    }
+
+  bool throughLockMaps = !getBucketLockMap ().empty () || !getValueLockMap ().empty ();
+  return aBucket->visitAll (aKey, keyHash, visitor, throughLockMaps);
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+std::size_t
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::eraseAll (const KeyT &aKey)
+{
+  ReadEpoch::Guard epochGuard (readEpoch);
+  auto gateLock = lockWritersGate ();
+  auto aTable = table.load ();
+  auto keyHash = hashFunc (aKey);
+  auto bucketIndex = getBucketIndexForHash (keyHash, *aTable);
+  auto aBucket = findBucket (*aTable, bucketIndex, keyHash);
+
+  bool needsCompaction = false;
+  std::size_t erasedValues =
+    aBucket ? aBucket->eraseAll (aKey, keyHash, erase_threshold, compactionMode, needsCompaction) : 0;
+  if (erasedValues > 0)
+    {
+      erasedCount += erasedValues;
+      if (needsCompaction)
+	{
+	  scheduleCompaction (bucketIndex);
+	}
+      if (double (size ()) < double (aTable->size ()) * shrinkWatermark)
+	{
+	  shrinkRequested = true;
+	}
+    }
+  return erasedValues;
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+AsyncTask<std::optional<ValueT>>
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::async_find (KeyT aKey, AsyncScheduler *scheduler) const
+{
+  // The epoch is held across the wait: the awaited mutex belongs to this table.
+  ReadEpoch::Guard epochGuard (readEpoch);
+  auto aTable = table.load ();
+  auto keyHash = hashFunc (aKey);
+  int bucketIndex = getBucketIndexForHash (keyHash, *aTable);
+  auto aBucket = findBucket (*aTable, bucketIndex, keyHash);
+  if (!aBucket)
+    {
+      co_return std::nullopt;
+    }
+  auto mutexAddress = &aBucket->bucketMutex;
+
+  while (true)
+    {
+      auto awaitedMutex = mutexAddress;
+      std::shared_ptr<const InternalValue> awaitedEntry; // keeps awaitedMutex alive across the wait
+      {
+	auto bucketLock = tryGetBucketLockFor (mutexAddress, LockType::READ, &aBucket->contention);
+	if (bucketLock)
+	  {
+	    // The value lock is only tried as well: with no budget to wait, a held one throws LockWouldBlock.
+	    auto noWait = LockWaitBudget::spins (0);
+	    WaitBudgetScope budgetScope (noWait);
+	    try
+	      {
+		auto it = aBucket->find (this, bucketIndex, aKey, keyHash, LockType::READ);
+		if (it == end ())
+		  {
+		    co_return std::nullopt;
+		  }
+		co_return it.load ();
+	      }
+	    catch (const LockWouldBlock &blocked)
+	      {
+		// Still under the bucket lock: the entry is shared before the lock goes, since an erase and a compaction
+		// could otherwise free its mutex while we wait for it. Without the entry, the bucket is awaited and the
+		// find retried.
+		awaitedEntry = aBucket->shareEntryWithValueMutex (blocked.mutexAddress);
+		if (awaitedEntry)
+		  {
+		    awaitedMutex = static_cast<Mutex *> (const_cast<void *> (blocked.mutexAddress));
+		  }
+	      }
+	  }
+      }
+      co_await MutexReleaseAwaiter (awaitedMutex, LockType::READ, scheduler);
+    }
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+AsyncTask<bool>
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::async_insert (std::pair<KeyT, ValueT> aKeyValuePair,
+									      AsyncScheduler *scheduler)
+{
+  ReadEpoch::Guard epochGuard (readEpoch);
+
+  while (true)
+    {
+      // The table can be replaced while we wait, so the bucket is looked up again under the gate on every attempt.
+      Mutex *awaitedMutex = nullptr; // the bucket's, or nullptr while the gate is closed
+      {
+	GateLock gateLock (writersGate, std::try_to_lock);
+	if (gateLock.owns_lock ())
+	  {
+	    auto aTable = table.load ();
+	    auto keyHash = hashFunc (aKeyValuePair.first);
+	    int bucketIndex = getBucketIndexForHash (keyHash, *aTable);
+	    auto &aBucket = (*aTable)[bucketIndex];
+	    awaitedMutex = &aBucket.bucketMutex;
+
+	    auto bucketLock = tryGetBucketLockFor (awaitedMutex, LockType::WRITE, &aBucket.contention);
+	    if (bucketLock)
+	      {
+		auto result = aBucket.insert (this, bucketIndex, aKeyValuePair, keyHash);
+		if (result.second)
+		  {
+		    ++valueCount;
+		  }
+		co_return result.second;
+	      }
+	  }
+      }
+      if (awaitedMutex)
+	{
+	  co_await MutexReleaseAwaiter (awaitedMutex, LockType::WRITE, scheduler);
+	}
+      else
+	{
+	  co_await MutexReleaseAwaiter (&writersGate, LockType::READ, scheduler);
+	}
+    }
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+AsyncTask<bool>
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::async_update (KeyT aKey, ValueT aValue,
+									      AsyncScheduler *scheduler)
+{
+  ReadEpoch::Guard epochGuard (readEpoch);
+
+  while (true)
+    {
+      Mutex *awaitedMutex = nullptr; // the bucket's, or nullptr while the gate is closed
+      {
+	GateLock gateLock (writersGate, std::try_to_lock);
+	if (gateLock.owns_lock ())
+	  {
+	    auto aTable = table.load ();
+	    auto keyHash = hashFunc (aKey);
+	    auto aBucket = findBucket (*aTable, getBucketIndexForHash (keyHash, *aTable), keyHash);
+	    if (!aBucket)
+	      {
+		co_return false;
+	      }
+	    awaitedMutex = &aBucket->bucketMutex;
+
+	    auto bucketLock = tryGetBucketLockFor (awaitedMutex, LockType::WRITE, &aBucket->contention);
+	    if (bucketLock)
+	      {
+		co_return aBucket->update (aKey, keyHash, aValue);
+	      }
+	  }
+      }
+      if (awaitedMutex)
+	{
+	  co_await MutexReleaseAwaiter (awaitedMutex, LockType::WRITE, scheduler);
+	}
+      else
+	{
+	  co_await MutexReleaseAwaiter (&writersGate, LockType::READ, scheduler);
+	}
+    }
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+std::optional<typename concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::iterator>
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::try_find (const KeyT &aKey, LockWaitBudget budget)
+{
+  ReadEpoch::Guard epochGuard (readEpoch);
+
+  WaitBudgetScope budgetScope (budget);
+  try
+    {
+      auto gateLock = lockWritersGate ();
+      auto aTable = table.load ();
+      auto keyHash = hashFunc (aKey);
+      int bucketIndex = getBucketIndexForHash (keyHash, *aTable);
+      auto aBucket = findBucket (*aTable, bucketIndex, keyHash);
+      if (!aBucket)
+	{
+	  return end ();
+	}
+
+      auto it = aBucket->find (this, bucketIndex, aKey, keyHash, LockType::WRITE);
+      pinToTable (it, aTable, std::move (epochGuard), std::move (gateLock));
+      return it;
+    }
+  catch (const LockWouldBlock &)
+    {
+      return std::nullopt;
+    }
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+std::optional<typename concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::iterator const>
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::try_find (const KeyT &aKey, LockWaitBudget budget) const
+{
+  ReadEpoch::Guard epochGuard (readEpoch);
+  auto aTable = table.load ();
+  auto keyHash = hashFunc (aKey);
+  int bucketIndex = getBucketIndexForHash (keyHash, *aTable);
+  auto aBucket = findBucket (*aTable, bucketIndex, keyHash);
+  if (!aBucket)
+    {
+      return end ();
+    }
+
+  WaitBudgetScope budgetScope (budget);
+  try
+    {
+      auto it = aBucket->find (this, bucketIndex, aKey, keyHash, LockType::READ);
+      pinToTable (it, aTable, std::move (epochGuard));
+      return it;
+    }
+  catch (const LockWouldBlock &)
+    {
+      return std::nullopt;
+    }
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+std::optional<std::pair<typename concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::iterator, bool>>
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::try_insert (
+  const std::pair<KeyT, ValueT> &aKeyValuePair, LockWaitBudget budget)
+{
+  ReadEpoch::Guard epochGuard (readEpoch);
+
+  WaitBudgetScope budgetScope (budget);
+  try
+    {
+      auto gateLock = lockWritersGate ();
+      auto aTable = table.load ();
+      auto keyHash = hashFunc (aKeyValuePair.first);
+      int bucketIndex = getBucketIndexForHash (keyHash, *aTable);
+
+      auto result = (*aTable)[bucketIndex].insert (this, bucketIndex, aKeyValuePair, keyHash);
+      if (result.second)
+	{
+	  ++valueCount;
+	}
+      pinToTable (result.first, aTable, std::move (epochGuard), std::move (gateLock));
+      return result;
+    }
+  catch (const LockWouldBlock &)
+    {
+      return std::nullopt;
+    }
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+std::optional<bool>
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::try_erase (const KeyT &aKey, LockWaitBudget budget)
+{
+  ReadEpoch::Guard epochGuard (readEpoch);
+
+  WaitBudgetScope budgetScope (budget);
+  GateLock gateLock;
+  BucketTable *aTable = nullptr;
+  int bucketIndex = -1;
+  int position = -1;
+  bool needsCompaction = false;
+  try
+    {
+      gateLock = lockWritersGate ();
+      aTable = table.load ();
+      auto keyHash = hashFunc (aKey);
+      bucketIndex = getBucketIndexForHash (keyHash, *aTable);
+      auto aBucket = findBucket (*aTable, bucketIndex, keyHash);
+      position = aBucket ? aBucket->erase (aKey, keyHash, erase_threshold, compactionMode, needsCompaction) : -1;
+    }
+  catch (const LockWouldBlock &)
+    {
+      return std::nullopt;
+    }
+
+  if (position == -1)
+    {
+      return false;
+    }
+
+  ++erasedCount;
+  if (double (size ()) < double (aTable->size ()) * shrinkWatermark)
+    {
+      shrinkRequested = true;
+    }
+  try
+    {
+      if (needsCompaction)
+	{
+	  scheduleCompaction (bucketIndex);
+	}
+    }
+  catch (const LockWouldBlock &)
+    {
+      // The element is erased; inline compaction is left to a later erase on this bucket.
+    }
+  return true;
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+std::optional<bool>
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::try_update (const KeyT &aKey, const ValueT &aValue,
+									    LockWaitBudget budget)
+{
+  ReadEpoch::Guard epochGuard (readEpoch);
+
+  WaitBudgetScope budgetScope (budget);
+  try
+    {
+      auto gateLock = lockWritersGate ();
+      auto aTable = table.load ();
+      auto keyHash = hashFunc (aKey);
+      auto aBucket = findBucket (*aTable, getBucketIndexForHash (keyHash, *aTable), keyHash);
+      return aBucket && aBucket->update (aKey, keyHash, aValue);
+    }
+  catch (const LockWouldBlock &)
+    {
+      return std::nullopt;
+    }
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
 std::size_t
-concurrent_unordered_map<KeyT, ValueT, HashFuncT>::getNextPopulatedBucketIndex (std::size_t anIndex) const
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::getBucketIndexForHash (std::size_t keyHash,
+										       const BucketTable &aTable) const
+{
+  return keyHash % aTable.size ();
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+typename concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::Bucket *
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::findBucket (const BucketTable &aTable,
+									    std::size_t bucketIndex,
+									    std::size_t keyHash) const
+{
+  auto aBucket = aTable.find (bucketIndex);
+  if (aBucket && isLookupFilterEnabled.load (std::memory_order_relaxed) && !aBucket->mayContain (keyHash))
+    {
+      return nullptr;
+    }
+  return aBucket;
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+void
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::pinToTable (iterator &it, const BucketTable *aTable,
+									    ReadEpoch::Guard &&epochGuard,
+									    GateLock &&writersPass) const
+{
+  // The iterator keeps the epoch so that the table it walks is not freed by a concurrent rehash / shrink, and a write
+  // iterator keeps its pass so that no migration copies its entry while it may still be written through it.
+  if (!it.isEnd)
+    {
+      it.table = aTable;
+      it.tableGuard = std::make_shared<typename iterator::TableGuard> (
+	typename iterator::TableGuard { std::move (epochGuard), std::move (writersPass) });
+    }
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+typename concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::GateLock
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::lockWritersGate ()
 {
-  for (auto i = anIndex + 1; i < buckets.size (); ++i)
+  auto budget = WaitBudgetScope::current ();
+  if (!budget)
     {
-      if (buckets[i].getSize () > 0)
+      return GateLock (writersGate);
+    }
+
+  GateLock gateLock (writersGate, std::try_to_lock);
+  while (!gateLock.owns_lock ())
+    {
+      if (!budget->consume ())
+	{
+	  throw LockWouldBlock (&writersGate);
+	}
+      cpuRelax ();
+      gateLock.try_lock ();
+    }
+  return gateLock;
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+void
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::migrateTo (std::size_t newBucketCount)
+{
+  std::unique_lock<std::mutex> migrationLock (migrationMutex);
+
+  BucketTable *oldTable = nullptr;
+  {
+    std::unique_lock<WritersGate> gateLock (writersGate);
+    oldTable = table.load ();
+    if (oldTable->size () == newBucketCount)
+      {
+	return;
+      }
+
+    // No writer is running, write iterators included (they hold a pass), and readers never change a bucket, so the
+    // old buckets are read without their locks.
+    auto newTable = new BucketTable (newBucketCount);
+    for (std::size_t i = 0; i < oldTable->size (); ++i)
+      {
+	auto oldBucket = oldTable->find (i);
+	if (!oldBucket)
+	  {
+	    continue;
+	  }
+	oldBucket->retire (); // fetch_add and friends modify values without the gate
+
+	for (auto &value : oldBucket->values)
+	  {
+	    if (!Bucket::entryOf (value)->isMarkedForDelete)
+	      {
+		auto keyHash = Bucket::getKeyHash (value); // string keys are not hashed again
+		auto &newBucket = (*newTable)[getBucketIndexForHash (keyHash, *newTable)];
+		newBucket.values.push_back (value);
+		newBucket.lookupFilter.add (keyHash);
+		++newBucket.currentSize;
+	      }
+	  }
+      }
+    table = newTable;
+
+    std::unique_lock<std::mutex> queueLock (compactionQueueMutex);
+    compactionQueue.clear (); // the new buckets hold no erased values
+  }
+  AsyncWaitQueue::notify (&writersGate);
+
+  // Readers and iterators that still walk the old table keep it alive until they leave their epoch.
+  readEpoch.synchronize ();
+  delete oldTable;
+
+#ifdef __GLIBC__
+  malloc_trim (0); // hand the freed buckets back to the OS instead of keeping them in the heap
+#endif
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+std::size_t
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::getNextPopulatedBucketIndex (std::size_t anIndex) const
+{
+  ReadEpoch::Guard epochGuard (readEpoch);
+  auto aTable = table.load ();
+
+  for (auto i = anIndex + 1; i < aTable->size (); ++i)
+    {
+      auto aBucket = aTable->find (i);
+      if (aBucket && aBucket->getSize () > 0)
 	{
 	  return i;
 	}
@@ -257,18 +1470,20 @@ concurrent_unordered_map<KeyT, ValueT, HashFuncT>::getNextPopulatedBucketIndex (
   return -1;
 }
 
-template <class KeyT, class ValueT, class HashFuncT>
-SharedVariantLock
-concurrent_unordered_map<KeyT, ValueT, HashFuncT>::aquireBucketLock (int bucketIndex) const
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+typename concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::SharedVariantLock
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::aquireBucketLock (const BucketTable *aTable,
+										  int bucketIndex) const
 {
-  return getBucketLockFor (&(*buckets[bucketIndex].bucketMutex), LockType::READ);
+  auto aBucket = aTable->find (bucketIndex);
+  return getBucketLockFor (&aBucket->bucketMutex, LockType::READ, &aBucket->contention);
 }
 
-template <class KeyT, class ValueT, class HashFuncT>
-SharedVariantLock
-concurrent_unordered_map<KeyT, ValueT, HashFuncT>::getValueLockFor (std::shared_mutex *mutexAddress, LockType lockType)
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+typename concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::SharedVariantLock
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::getValueLockFor (Mutex *mutexAddress, LockType lockType)
 {
-  static thread_local LockMap value_mutex_to_lock;
+  auto &value_mutex_to_lock = getValueLockMap ();
 
   auto it = value_mutex_to_lock.find (mutexAddress);
 
@@ -293,12 +1508,16 @@ concurrent_unordered_map<KeyT, ValueT, HashFuncT>::getValueLockFor (std::shared_
 	      return sharedVariantLock; // If we have Write lock, and Read lock is needed, we pass the existing Write
 					// lock
 	    }
+	  if (WaitBudgetScope::current ())
+	    {
+	      throw LockWouldBlock (mutexAddress); // upgrading drops the lock this thread's iterators rely on
+	    }
 	  *sharedVariantLock = VariantLock (); // This will release the lock and call the destructor
 	  lock_needs_to_change = true;
 	}
     }
 
-  auto lock = aquireLockFor (mutexAddress, lockType, value_mutex_to_lock);
+  auto lock = aquireLockFor (mutexAddress, lockType, value_mutex_to_lock, true); // async_find awaits value locks too
   // We change Read lock to Write lock for all iterators that reference the same variant
   if (lock_needs_to_change)
     {
@@ -307,11 +1526,13 @@ concurrent_unordered_map<KeyT, ValueT, HashFuncT>::getValueLockFor (std::shared_
   return lock;
 }
 
-template <class KeyT, class ValueT, class HashFuncT>
-SharedVariantLock
-concurrent_unordered_map<KeyT, ValueT, HashFuncT>::getBucketLockFor (std::shared_mutex *mutexAddress, LockType lockType)
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+typename concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::SharedVariantLock
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::getBucketLockFor (Mutex *mutexAddress,
+										  LockType lockType,
+										  BucketContention *contention)
 {
-  static thread_local LockMap bucket_mutex_to_lock;
+  auto &bucket_mutex_to_lock = getBucketLockMap ();
 
   SharedVariantLock sharedVariantLock;
   bool lock_needs_to_change = false;
@@ -330,12 +1551,16 @@ concurrent_unordered_map<KeyT, ValueT, HashFuncT>::getBucketLockFor (std::shared
 	    {
 	      return sharedVariantLock;
 	    }
+	  if (WaitBudgetScope::current ())
+	    {
+	      throw LockWouldBlock (mutexAddress); // upgrading drops the lock this thread's iterators rely on
+	    }
 	  *sharedVariantLock = VariantLock (); // This will release the lock and call the destructor
 	  lock_needs_to_change = true;
 	}
     }
 
-  auto lock = aquireLockFor (mutexAddress, lockType, bucket_mutex_to_lock);
+  auto lock = aquireLockFor (mutexAddress, lockType, bucket_mutex_to_lock, true, false, contention);
   // We change Read lock to Write lock for all iterators that reference the same variant
   if (lock_needs_to_change)
     {
@@ -344,10 +1569,45 @@ concurrent_unordered_map<KeyT, ValueT, HashFuncT>::getBucketLockFor (std::shared
   return lock;
 }
 
-template <class KeyT, class ValueT, class HashFuncT>
-SharedVariantLock
-concurrent_unordered_map<KeyT, ValueT, HashFuncT>::aquireLockFor (std::shared_mutex *mutexAddress, LockType lockType,
-								  LockMap &lockMap)
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+typename concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::SharedVariantLock
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::tryGetBucketLockFor (Mutex *mutexAddress,
+										     LockType lockType,
+										     BucketContention *contention)
+{
+  auto &bucket_mutex_to_lock = getBucketLockMap ();
+
+  // A thread that already holds this bucket only competes with itself; keep the usual reuse / upgrade rules.
+  if (bucket_mutex_to_lock.find (mutexAddress) != bucket_mutex_to_lock.end ())
+    {
+      return getBucketLockFor (mutexAddress, lockType, contention);
+    }
+
+  return aquireLockFor (mutexAddress, lockType, bucket_mutex_to_lock, true, true /*tryOnly*/, contention);
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+typename concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::LockMap &
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::getBucketLockMap ()
+{
+  static thread_local LockMap bucket_mutex_to_lock;
+  return bucket_mutex_to_lock;
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+typename concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::LockMap &
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::getValueLockMap ()
+{
+  static thread_local LockMap value_mutex_to_lock;
+  return value_mutex_to_lock;
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+typename concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::SharedVariantLock
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::aquireLockFor (Mutex *mutexAddress, LockType lockType,
+									       LockMap &lockMap, bool notifyWaiters,
+									       bool tryOnly,
+									       BucketContention *contention)
 {
 #ifdef ADD_PERFORMANCE_COUNTERS
   MutexAquireCounters counters;
@@ -356,26 +1616,88 @@ concurrent_unordered_map<KeyT, ValueT, HashFuncT>::aquireLockFor (std::shared_mu
   counters.threadID = std::this_thread::get_id ();
 #endif
 
+#ifdef ADD_LOCK_TRACING
+  auto traceBucketIndex = contention ? contention->bucketIndex : LockTrace::unknownBucket;
+  LockTrace::record (LockTrace::EventType::REQUEST, mutexAddress, traceBucketIndex, lockType);
+#endif
+
+  auto releaseLock = [&lockMap, mutexAddress, notifyWaiters, lockType, contention] (auto *p) {
+    lockMap.erase (mutexAddress);
+    delete p;
+#ifdef ADD_LOCK_TRACING
+    LockTrace::record (LockTrace::EventType::RELEASE, mutexAddress,
+		       contention ? contention->bucketIndex : LockTrace::unknownBucket, lockType);
+#endif
+    if (notifyWaiters)
+      {
+	AsyncWaitQueue::notify (mutexAddress); // wake async_ operations suspended on this mutex
+      }
+  };
+
+  // Inside a try_ operation we spin on try_lock until its budget is spent instead of blocking.
+  auto budget = WaitBudgetScope::current ();
+  bool isBounded = tryOnly || budget != nullptr;
+  auto ownsWithinBudget = [tryOnly, budget] (auto *aLock) {
+    while (!aLock->owns_lock ())
+      {
+	if (tryOnly || !budget->consume ())
+	  {
+	    return false;
+	  }
+	cpuRelax ();
+	aLock->try_lock ();
+      }
+    return true;
+  };
+
   SharedVariantLock lock;
   if (lockType == LockType::READ)
     {
-      auto sharedReadLock = SharedReadLock (new ReadLock (*mutexAddress), [&lockMap, mutexAddress] (auto *p) {
-	lockMap.erase (mutexAddress);
-	delete p;
-      });
+      auto readLock = isBounded || contention ? new ReadLock (*mutexAddress, std::try_to_lock)
+					       : new ReadLock (*mutexAddress);
+      if (!isBounded && !readLock->owns_lock ())
+	{
+	  contention->lockContended (*readLock);
+	}
+      if (!ownsWithinBudget (readLock))
+	{
+	  delete readLock;
+	  if (tryOnly)
+	    {
+	      return nullptr;
+	    }
+	  throw LockWouldBlock (mutexAddress);
+	}
+      auto sharedReadLock = SharedReadLock (readLock, releaseLock);
       lock = std::make_shared<VariantLock> (sharedReadLock);
     }
   else
     {
-      auto sharedWriteLock = SharedWriteLock (new WriteLock (*mutexAddress), [&lockMap, mutexAddress] (auto *p) {
-	lockMap.erase (mutexAddress);
-	delete p;
-      });
+      auto writeLock = isBounded || contention ? new WriteLock (*mutexAddress, std::try_to_lock)
+						: new WriteLock (*mutexAddress);
+      if (!isBounded && !writeLock->owns_lock ())
+	{
+	  contention->lockContended (*writeLock);
+	}
+      if (!ownsWithinBudget (writeLock))
+	{
+	  delete writeLock;
+	  if (tryOnly)
+	    {
+	      return nullptr;
+	    }
+	  throw LockWouldBlock (mutexAddress);
+	}
+      auto sharedWriteLock = SharedWriteLock (writeLock, releaseLock);
       lock = std::make_shared<VariantLock> (sharedWriteLock);
     }
   auto resultInsert = lockMap.insert (std::make_pair (mutexAddress, std::make_tuple (lock, lockType)));
   assert (resultInsert.second);
 
+#ifdef ADD_LOCK_TRACING
+  LockTrace::record (LockTrace::EventType::ACQUIRE, mutexAddress, traceBucketIndex, lockType);
+#endif
+
 #ifdef ADD_PERFORMANCE_COUNTERS
   counters.endTimeAquire = std::chrono::steady_clock::now ();
   GlobalCounter::addMutexAquireCounters (counters);
@@ -384,31 +1706,38 @@ concurrent_unordered_map<KeyT, ValueT, HashFuncT>::aquireLockFor (std::shared_mu
   return lock;
 }
 
-template <class KeyT, class ValueT, class HashFuncT>
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
 KeyT
-concurrent_unordered_map<KeyT, ValueT, HashFuncT>::getFirstKey () const
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::getFirstKey () const
 {
-  for (auto i = 0; i < buckets.size (); ++i)
+  ReadEpoch::Guard epochGuard (readEpoch);
+  auto aTable = table.load ();
+
+  for (auto i = 0; i < aTable->size (); ++i)
     {
-      if (buckets[i].getSize () > 0)
+      auto aBucket = aTable->find (i);
+      if (aBucket && aBucket->getSize () > 0)
 	{
-	  return buckets[i].getFirstKey ();
+	  return aBucket->getFirstKey ();
 	}
     }
 
   return -1;
 }
 
-template <class KeyT, class ValueT, class HashFuncT>
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
 void
-concurrent_unordered_map<KeyT, ValueT, HashFuncT>::advanceIterator (iterator &it) const
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::advanceIterator (iterator &it) const
 {
+  // Iterators keep walking the table they were created on, even if it has been replaced since.
+  auto aTable = it.table;
   int nextBucketIndex = it.bucketIndex;
 
   bool found = false;
   do
     {
-      if (buckets[nextBucketIndex].advanceIterator (it, nextBucketIndex))
+      auto aBucket = aTable->find (nextBucketIndex);
+      if (aBucket && aBucket->advanceIterator (it, nextBucketIndex))
 	{
 	  found = true;
 	}
@@ -417,7 +1746,7 @@ concurrent_unordered_map<KeyT, ValueT, HashFuncT>::advanceIterator (iterator &it
 	  ++nextBucketIndex;
 	}
     }
-  while (!found && nextBucketIndex < int (buckets.size ()));
+  while (!found && nextBucketIndex < int (aTable->size ()));
 
   if (!found)
     {
@@ -425,25 +1754,269 @@ concurrent_unordered_map<KeyT, ValueT, HashFuncT>::advanceIterator (iterator &it
     }
 }
 
-template <class KeyT, class ValueT, class HashFuncT>
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
 void
-concurrent_unordered_map<KeyT, ValueT, HashFuncT>::lockResource (std::size_t &bucketIndex, int &valueIndex) const
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::lockResource (std::size_t &bucketIndex,
+									      int &valueIndex) const
 {
-  buckets[bucketIndex].values[valueIndex].lock ();
+  ReadEpoch::Guard epochGuard (readEpoch);
+  table.load ()->find (bucketIndex)->values[valueIndex].lock ();
 }
 
-template <class KeyT, class ValueT, class HashFuncT>
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
 void
-concurrent_unordered_map<KeyT, ValueT, HashFuncT>::unlockResource (std::size_t &bucketIndex, int &valueIndex) const
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::unlockResource (std::size_t &bucketIndex,
+										int &valueIndex) const
 {
-  buckets[bucketIndex].values[valueIndex].unlock ();
+  ReadEpoch::Guard epochGuard (readEpoch);
+  table.load ()->find (bucketIndex)->values[valueIndex].unlock ();
 }
 
-template <class KeyT, class ValueT, class HashFuncT>
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
 void
-concurrent_unordered_map<KeyT, ValueT, HashFuncT>::rehash ()
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::rehash ()
 {
-  // TODO: Implement
+  migrateTo (getNextPrimeNumber (bucket_count ()));
 }
 
-#endif
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+MapStatistics
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::get_statistics (std::size_t topCount) const
+{
+  MapStatistics statistics {};
+  statistics.chainLengthHistogram.assign (MapStatistics::chainLengthBins, 0);
+
+  ReadEpoch::Guard epochGuard (readEpoch);
+  auto aTable = table.load ();
+  statistics.size = size ();
+  statistics.bucketCount = aTable->size ();
+  statistics.loadFactor = double (statistics.size) / double (statistics.bucketCount);
+
+  // Without iterators on this thread the bucket lock is a plain stack lock, so the scan does not allocate.
+  bool holdsBucketLocks = !getBucketLockMap ().empty ();
+  std::vector<ContendedBucket> contendedBuckets;
+  for (std::size_t i = 0; i < aTable->size (); ++i)
+    {
+      auto aBucket = aTable->find (i);
+      if (!aBucket)
+	{
+	  ++statistics.chainLengthHistogram[0];
+	  continue;
+	}
+      ++statistics.allocatedBucketCount;
+
+      std::size_t chainLength = 0;
+      std::size_t liveCount = 0;
+      if (holdsBucketLocks)
+	{
+	  auto bucketLock = getBucketLockFor (&aBucket->bucketMutex, LockType::READ, &aBucket->contention);
+	  chainLength = aBucket->values.size ();
+	  liveCount = aBucket->currentSize;
+	}
+      else
+	{
+	  typename Bucket::StackReadLock bucketLock (aBucket->bucketMutex);
+	  chainLength = aBucket->values.size ();
+	  liveCount = aBucket->currentSize;
+	}
+
+      statistics.storedValues += chainLength;
+      statistics.tombstones += chainLength - liveCount;
+      statistics.maxChainLength = std::max (statistics.maxChainLength, chainLength);
+      ++statistics.chainLengthHistogram[std::min (chainLength, MapStatistics::chainLengthBins - 1)];
+
+      auto waitCount = aBucket->contention.waitCount.load (std::memory_order_relaxed);
+      if (waitCount > 0)
+	{
+	  auto waitNanoseconds = aBucket->contention.waitNanoseconds.load (std::memory_order_relaxed);
+	  contendedBuckets.push_back (ContendedBucket { i, waitCount, waitNanoseconds / 1000 });
+	}
+    }
+
+  statistics.tombstoneRatio
+    = statistics.storedValues ? double (statistics.tombstones) / double (statistics.storedValues) : 0.0;
+
+  statistics.sampledLookups = probeSampler.getSampleCount ();
+  statistics.averageProbes
+    = statistics.sampledLookups ? double (probeSampler.getProbeCount ()) / double (statistics.sampledLookups) : 0.0;
+  statistics.maxProbes = probeSampler.getMaxProbes ();
+
+  auto topEnd = contendedBuckets.begin () + std::min (topCount, contendedBuckets.size ());
+  std::partial_sort (contendedBuckets.begin (), topEnd, contendedBuckets.end (),
+		     [] (const ContendedBucket &a, const ContendedBucket &b) {
+		       return a.waitMicroseconds != b.waitMicroseconds ? a.waitMicroseconds > b.waitMicroseconds
+								       : a.waitCount > b.waitCount;
+		     });
+  statistics.mostContendedBuckets.assign (contendedBuckets.begin (), topEnd);
+
+  return statistics;
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+void
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::reserve (std::size_t count)
+{
+  auto newBucketCount = getNextPrimeNumber (count);
+  if (newBucketCount > bucket_count ())
+    {
+      migrateTo (newBucketCount);
+    }
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+bool
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::shrink_to_fit ()
+{
+  auto newBucketCount = getNextPrimeNumber (size ());
+  if (newBucketCount >= bucket_count ())
+    {
+      return false;
+    }
+
+  migrateTo (newBucketCount);
+  return true;
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+void
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::set_shrink_watermark (double loadFactor)
+{
+  shrinkWatermark = loadFactor;
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+void
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::set_lookup_filter (bool enabled)
+{
+  isLookupFilterEnabled = enabled;
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+void
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::scheduleCompaction (int bucketIndex)
+{
+  if (compactionMode == CompactionMode::INLINE)
+    {
+      // Compacting a bucket this thread holds through its iterators would move the entries they point to; it is left
+      // to the next erase in the bucket, which requests the compaction again.
+      auto aBucket = table.load ()->find (bucketIndex);
+      if (getBucketLockMap ().find (&aBucket->bucketMutex) == getBucketLockMap ().end ())
+	{
+	  aBucket->eraseUnavailableValues ();
+	}
+      return;
+    }
+
+  std::unique_lock<std::mutex> lock (compactionQueueMutex);
+  compactionQueue.push_back (bucketIndex);
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+void
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::set_compaction_mode (CompactionMode mode)
+{
+  compactionMode = mode;
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+std::size_t
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::compact (std::chrono::microseconds timeSlice)
+{
+  std::size_t compactedCount = 0;
+  {
+    // Bucket locks are taken under the slice's deadline, so a bucket pinned by an iterator cannot stall the sweep.
+    LockWaitBudget budget (timeSlice);
+    WaitBudgetScope budgetScope (budget);
+    auto deadline = std::chrono::steady_clock::now () + timeSlice;
+
+    while (std::chrono::steady_clock::now () < deadline)
+      {
+	// Queued indexes refer to the current table; the gate keeps it from being replaced while one is compacted.
+	GateLock gateLock;
+	try
+	  {
+	    gateLock = lockWritersGate ();
+	  }
+	catch (const LockWouldBlock &)
+	  {
+	    break;
+	  }
+
+	int bucketIndex = -1;
+	{
+	  std::unique_lock<std::mutex> lock (compactionQueueMutex);
+	  if (compactionQueue.empty ())
+	    {
+	      break;
+	    }
+	  bucketIndex = compactionQueue.front ();
+	  compactionQueue.pop_front ();
+	}
+
+	try
+	  {
+	    if (table.load ()->find (bucketIndex)->eraseUnavailableValues ())
+	      {
+		++compactedCount;
+	      }
+	  }
+	catch (const LockWouldBlock &)
+	  {
+	    std::unique_lock<std::mutex> lock (compactionQueueMutex);
+	    compactionQueue.push_back (bucketIndex);
+	    break;
+	  }
+      }
+  }
+
+  if (shrinkRequested.exchange (false))
+    {
+      shrink_to_fit ();
+    }
+
+  return compactedCount;
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+void
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::start_maintenance (std::chrono::milliseconds interval,
+										   std::chrono::microseconds timeSlice)
+{
+  std::unique_lock<std::mutex> lock (maintenanceMutex);
+  if (isMaintenanceRunning)
+    {
+      return;
+    }
+
+  compactionMode = CompactionMode::DEFERRED;
+  isMaintenanceRunning = true;
+  maintenanceThread = std::thread ([this, interval, timeSlice] () {
+    std::unique_lock<std::mutex> lock (maintenanceMutex);
+    while (isMaintenanceRunning)
+      {
+	lock.unlock ();
+	compact (timeSlice);
+	lock.lock ();
+	maintenanceCondition.wait_for (lock, interval, [this] () { return !isMaintenanceRunning; });
+      }
+  });
+}
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+void
+concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::stop_maintenance ()
+{
+  {
+    std::unique_lock<std::mutex> lock (maintenanceMutex);
+    if (!isMaintenanceRunning)
+      {
+	return;
+      }
+    isMaintenanceRunning = false;
+  }
+
+  maintenanceCondition.notify_all ();
+  maintenanceThread.join ();
+}
+
+#endif
\ No newline at end of file
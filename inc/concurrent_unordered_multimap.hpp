@@ -0,0 +1,209 @@
+#ifndef _CONCURRENT_UNORDERED_MULTIMAP_HPP_
+#define _CONCURRENT_UNORDERED_MULTIMAP_HPP_
+
+#include "concurrent_unordered_map.hpp"
+#include "key_range.hpp"
+
+/// A concurrent multimap on the bucket engine of concurrent_unordered_map. Every value is its own element in the
+/// key's bucket, so appending to a key never copies the values already stored under it. The values of a key are read
+/// in place, with cvisit or through equal_range, never copied out.
+template <class KeyT, class ValueT, class HashFuncT = default_hash<KeyT>, class LockPolicyT = shared_mutex_policy>
+class concurrent_unordered_multimap
+{
+  using Map = concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>;
+
+public:
+  /// Forward iterator over all key-value pairs; a key with several values is seen once per value.
+  using iterator = typename Map::iterator;
+
+  /// The values of one key, read in place under the bucket read lock (see key_range).
+  using range_type = key_range<KeyT, ValueT, HashFuncT, LockPolicyT>;
+
+public:
+  /// <summary>Constructor. Buckets are allocated in chunks on first insert, so an unused multimap is cheap.</summary>
+  /// <param name="bucketCount">How many buckets to start with</param>
+  /// <returns></returns>
+  explicit concurrent_unordered_multimap (std::size_t bucketCount = 500009, float erase_threshold_value = 0.7)
+    : map (bucketCount, erase_threshold_value)
+  {
+  }
+
+  /// <summary>Gets the number of values in the multimap (all keys)</summary>
+  /// <param></param>
+  /// <returns></returns>
+  std::size_t
+  size () const
+  {
+    return map.size ();
+  }
+
+  /// <summary></summary>
+  /// <param></param>
+  /// <returns>Begin Iterator</returns>
+  iterator
+  begin () const
+  {
+    return map.begin ();
+  }
+
+  /// <summary></summary>
+  /// <param></param>
+  /// <returns>End Iterator</returns>
+  iterator
+  end () const
+  {
+    return map.end ();
+  }
+
+  /// <summary>Adds a value under the key, next to the values it already has.</summary>
+  /// <param name="aKey">The key</param>
+  /// <param name="aValue">The value</param>
+  /// <returns></returns>
+  void
+  append (const KeyT &aKey, const ValueT &aValue)
+  {
+    map.appendValues (aKey, &aValue, &aValue + 1);
+  }
+
+  /// <summary>Adds a range of values under the key, taking the bucket lock once.</summary>
+  /// <param name="aKey">The key</param>
+  /// <param name="first">Begin of the values</param>
+  /// <param name="last">End of the values</param>
+  /// <returns>The number of values added.</returns>
+  template <class InputIt>
+  std::size_t
+  append (const KeyT &aKey, InputIt first, InputIt last)
+  {
+    return map.appendValues (aKey, first, last);
+  }
+
+  /// <summary>Runs a callback on every value of the key while holding the bucket read lock once. Does not allocate
+  /// and does not create an iterator.</summary>
+  /// <param name="aKey">The key</param>
+  /// <param name="visitor">Called as visitor (const ValueT &amp;) in insertion order; must not call back into the
+  /// multimap</param>
+  /// <returns>The number of values visited.</returns>
+  template <class VisitorT>
+  std::size_t
+  cvisit (const KeyT &aKey, VisitorT &&visitor) const
+  {
+    return map.cvisitAll (aKey, visitor);
+  }
+
+  /// <summary>Gets the values of the key, in place: the bucket read lock is taken once and held until the range is
+  /// destroyed. Nothing is copied or allocated.</summary>
+  /// <param name="aKey">The key</param>
+  /// <returns>A range over the key's key-value pairs in insertion order; empty if the key is not found.</returns>
+  range_type
+  equal_range (const KeyT &aKey) const
+  {
+    ReadEpoch::Guard epochGuard (map.readEpoch);
+    auto aTable = map.table.load ();
+    auto keyHash = map.hashFunc (aKey);
+    auto aBucket = map.findBucket (*aTable, map.getBucketIndexForHash (keyHash, *aTable), keyHash);
+    return range_type (std::move (epochGuard), aBucket, aKey, keyHash);
+  }
+
+  /// <summary>Gets the number of values of the key</summary>
+  /// <param name="aKey">The key</param>
+  /// <returns></returns>
+  std::size_t
+  count (const KeyT &aKey) const
+  {
+    return cvisit (aKey, [] (const ValueT &) {});
+  }
+
+  /// <summary>Checks whether the multimap holds at least one value for the key.</summary>
+  /// <param name="aKey">The key</param>
+  /// <returns></returns>
+  bool
+  contains (const KeyT &aKey) const
+  {
+    return map.contains (aKey);
+  }
+
+  /// <summary>Erases every value of the key. Invalidates any Iterator to them.</summary>
+  /// <param name="aKey">The key</param>
+  /// <returns>The number of values erased.</returns>
+  std::size_t
+  erase (const KeyT &aKey)
+  {
+    return map.eraseAll (aKey);
+  }
+
+  /// <summary>Same as concurrent_unordered_map::set_compaction_mode.</summary>
+  void
+  set_compaction_mode (CompactionMode mode)
+  {
+    map.set_compaction_mode (mode);
+  }
+
+  /// <summary>Same as concurrent_unordered_map::compact.</summary>
+  std::size_t
+  compact (std::chrono::microseconds timeSlice)
+  {
+    return map.compact (timeSlice);
+  }
+
+  /// <summary>Same as concurrent_unordered_map::start_maintenance.</summary>
+  void
+  start_maintenance (std::chrono::milliseconds interval = std::chrono::milliseconds (10),
+		     std::chrono::microseconds timeSlice = std::chrono::microseconds (500))
+  {
+    map.start_maintenance (interval, timeSlice);
+  }
+
+  /// <summary>Same as concurrent_unordered_map::stop_maintenance.</summary>
+  void
+  stop_maintenance ()
+  {
+    map.stop_maintenance ();
+  }
+
+  /// <summary>Gets the number of buckets</summary>
+  std::size_t
+  bucket_count () const
+  {
+    return map.bucket_count ();
+  }
+
+  /// <summary>Same as concurrent_unordered_map::reserve; count is the expected number of values.</summary>
+  void
+  reserve (std::size_t count)
+  {
+    map.reserve (count);
+  }
+
+  /// <summary>Same as concurrent_unordered_map::rehash.</summary>
+  void
+  rehash ()
+  {
+    map.rehash ();
+  }
+
+  /// <summary>Same as concurrent_unordered_map::shrink_to_fit.</summary>
+  bool
+  shrink_to_fit ()
+  {
+    return map.shrink_to_fit ();
+  }
+
+  /// <summary>Same as concurrent_unordered_map::set_shrink_watermark.</summary>
+  void
+  set_shrink_watermark (double loadFactor)
+  {
+    map.set_shrink_watermark (loadFactor);
+  }
+
+  /// <summary>Same as concurrent_unordered_map::get_statistics; chains count every value of a key.</summary>
+  MapStatistics
+  get_statistics (std::size_t topCount = 10) const
+  {
+    return map.get_statistics (topCount);
+  }
+
+private:
+  Map map;
+};
+
+#endif
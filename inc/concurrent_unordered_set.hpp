@@ -0,0 +1,198 @@
+#ifndef _CONCURRENT_UNORDERED_SET_HPP_
+#define _CONCURRENT_UNORDERED_SET_HPP_
+
+#include "concurrent_unordered_map.hpp"
+
+/// A concurrent set on the bucket engine of concurrent_unordered_map. Elements store only their key (set_entry, no
+/// padded pair): the value type is the empty set_value_tag and elements have no value mutex, their erase flag being
+/// guarded by the bucket lock.
+template <class KeyT, class HashFuncT = default_hash<KeyT>, class LockPolicyT = shared_mutex_policy>
+class concurrent_unordered_set
+{
+  using Map = concurrent_unordered_map<KeyT, set_value_tag, HashFuncT, LockPolicyT>;
+
+public:
+  /// Read-only forward iterator over the keys. Holds the bucket lock like a map iterator.
+  class iterator
+  {
+  public:
+    const KeyT &
+    operator* () const
+    {
+      return mapIterator->first;
+    }
+
+    const KeyT *
+    operator-> () const
+    {
+      return &mapIterator->first;
+    }
+
+    iterator &
+    operator++ ()
+    {
+      ++mapIterator;
+      return *this;
+    }
+
+    bool
+    operator== (const iterator &other) const
+    {
+      return mapIterator == other.mapIterator;
+    }
+
+    bool
+    operator!= (const iterator &other) const
+    {
+      return mapIterator != other.mapIterator;
+    }
+
+  private:
+    explicit iterator (typename Map::iterator aMapIterator) : mapIterator (aMapIterator)
+    {
+    }
+
+    typename Map::iterator mapIterator;
+
+    friend concurrent_unordered_set;
+  };
+
+public:
+  /// <summary>Constructor. Buckets are allocated in chunks on first insert, so an unused set is cheap.</summary>
+  /// <param name="bucketCount">How many buckets to start with</param>
+  /// <returns></returns>
+  explicit concurrent_unordered_set (std::size_t bucketCount = 500009, float erase_threshold_value = 0.7)
+    : map (bucketCount, erase_threshold_value)
+  {
+  }
+
+  /// <summary>Gets the number of keys in the set</summary>
+  /// <param></param>
+  /// <returns></returns>
+  std::size_t
+  size () const
+  {
+    return map.size ();
+  }
+
+  /// <summary></summary>
+  /// <param></param>
+  /// <returns>Begin Iterator</returns>
+  iterator
+  begin () const
+  {
+    return iterator (map.begin ());
+  }
+
+  /// <summary></summary>
+  /// <param></param>
+  /// <returns>End Iterator</returns>
+  iterator
+  end () const
+  {
+    return iterator (map.end ());
+  }
+
+  /// <summary>Inserts a key into the set</summary>
+  /// <param name="aKey">The key</param>
+  /// <returns>True if the key was inserted, false if it was already present.</returns>
+  bool
+  insert (const KeyT &aKey)
+  {
+    return map.insert (aKey, set_value_tag ()).second;
+  }
+
+  /// <summary>Checks whether the set holds the key. Does not allocate and does not create an iterator.</summary>
+  /// <param name="aKey">The key</param>
+  /// <returns></returns>
+  bool
+  contains (const KeyT &aKey) const
+  {
+    return map.contains (aKey);
+  }
+
+  /// <summary>Erases the key. Invalidates any Iterator to it.</summary>
+  /// <param name="aKey">The key</param>
+  /// <returns>True if the key was present in the set.</returns>
+  bool
+  erase (const KeyT &aKey)
+  {
+    return map.erase (aKey);
+  }
+
+  /// <summary>Same as concurrent_unordered_map::set_compaction_mode.</summary>
+  void
+  set_compaction_mode (CompactionMode mode)
+  {
+    map.set_compaction_mode (mode);
+  }
+
+  /// <summary>Same as concurrent_unordered_map::compact.</summary>
+  std::size_t
+  compact (std::chrono::microseconds timeSlice)
+  {
+    return map.compact (timeSlice);
+  }
+
+  /// <summary>Same as concurrent_unordered_map::start_maintenance.</summary>
+  void
+  start_maintenance (std::chrono::milliseconds interval = std::chrono::milliseconds (10),
+		     std::chrono::microseconds timeSlice = std::chrono::microseconds (500))
+  {
+    map.start_maintenance (interval, timeSlice);
+  }
+
+  /// <summary>Same as concurrent_unordered_map::stop_maintenance.</summary>
+  void
+  stop_maintenance ()
+  {
+    map.stop_maintenance ();
+  }
+
+  /// <summary>Gets the number of buckets</summary>
+  std::size_t
+  bucket_count () const
+  {
+    return map.bucket_count ();
+  }
+
+  /// <summary>Same as concurrent_unordered_map::reserve.</summary>
+  void
+  reserve (std::size_t count)
+  {
+    map.reserve (count);
+  }
+
+  /// <summary>Same as concurrent_unordered_map::rehash.</summary>
+  void
+  rehash ()
+  {
+    map.rehash ();
+  }
+
+  /// <summary>Same as concurrent_unordered_map::shrink_to_fit.</summary>
+  bool
+  shrink_to_fit ()
+  {
+    return map.shrink_to_fit ();
+  }
+
+  /// <summary>Same as concurrent_unordered_map::set_shrink_watermark.</summary>
+  void
+  set_shrink_watermark (double loadFactor)
+  {
+    map.set_shrink_watermark (loadFactor);
+  }
+
+  /// <summary>Same as concurrent_unordered_map::get_statistics.</summary>
+  MapStatistics
+  get_statistics (std::size_t topCount = 10) const
+  {
+    return map.get_statistics (topCount);
+  }
+
+private:
+  Map map;
+};
+
+#endif
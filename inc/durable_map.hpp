@@ -0,0 +1,245 @@
+#ifndef _DURABLE_MAP_HPP_
+#define _DURABLE_MAP_HPP_
+
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "concurrent_unordered_map.hpp"
+#include "write_ahead_log.hpp"
+
+/// Turns keys and values into the bytes of log records and back. Trivially copyable types are stored as their object
+/// representation, strings as their characters; specialize it for other types.
+template <class T> struct log_codec
+{
+  static_assert (std::is_trivially_copyable_v<T>, "log_codec must be specialized for this type");
+
+  static std::string_view
+  encode (const T &aValue)
+  {
+    return std::string_view (reinterpret_cast<const char *> (&aValue), sizeof (T));
+  }
+
+  static T
+  decode (std::string_view bytes)
+  {
+    if (bytes.size () != sizeof (T))
+      {
+	throw std::runtime_error ("log_codec: the record does not hold a value of this type");
+      }
+    T aValue;
+    std::memcpy (&aValue, bytes.data (), sizeof (T));
+    return aValue;
+  }
+};
+
+template <class CharT, class TraitsT, class AllocatorT> struct log_codec<std::basic_string<CharT, TraitsT, AllocatorT>>
+{
+  static std::string_view
+  encode (const std::basic_string<CharT, TraitsT, AllocatorT> &aValue)
+  {
+    return std::string_view (reinterpret_cast<const char *> (aValue.data ()), aValue.size () * sizeof (CharT));
+  }
+
+  static std::basic_string<CharT, TraitsT, AllocatorT>
+  decode (std::string_view bytes)
+  {
+    std::basic_string<CharT, TraitsT, AllocatorT> aValue (bytes.size () / sizeof (CharT), CharT ());
+    std::memcpy (aValue.data (), bytes.data (), aValue.size () * sizeof (CharT));
+    return aValue;
+  }
+};
+
+/// A concurrent_unordered_map whose changes survive a restart. insert, update and erase append a record to a
+/// WriteAheadLog while they hold the bucket lock, which only copies the record into a per-thread buffer; with
+/// Durability::PER_OPERATION they then wait for the group commit after the lock is released. checkpoint () writes a
+/// snapshot, so that recovery replays only the log written since. There are no iterators: every change goes through
+/// the logged operations.
+template <class KeyT, class ValueT, class HashFuncT = default_hash<KeyT>, class LockPolicyT = shared_mutex_policy>
+class durable_map
+{
+  using Map = concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>;
+  using RecordType = WriteAheadLog::RecordType;
+
+public:
+  /// <summary>Constructor. Recovers the map stored under basePath: loads basePath.snapshot, if there is one, and
+  /// replays the records logged since (basePath.log.old and basePath.log) on top; then logs to basePath.log.</summary>
+  /// <param name="basePath">Path of the map's files, without extension</param>
+  /// <param name="durability">When a change is on disk</param>
+  /// <param name="bucketCount">How many buckets to start with</param>
+  /// <returns></returns>
+  explicit durable_map (const std::string &basePath, Durability durability = Durability::PER_BATCH,
+			std::size_t bucketCount = 500009)
+    : map (bucketCount), snapshotPath (basePath + ".snapshot"),
+      log (basePath + ".log", durability, recover (basePath + ".log"))
+  {
+  }
+
+  /// <summary>Gets the number of elements in the map</summary>
+  /// <param></param>
+  /// <returns></returns>
+  std::size_t
+  size () const
+  {
+    return map.size ();
+  }
+
+  /// <summary>Inserts a key and a value, unless the key is already in the map, and logs it.</summary>
+  /// <param name="aKey">The key</param>
+  /// <param name="aValue">The value</param>
+  /// <returns>True if the pair was inserted.</returns>
+  bool
+  insert (const KeyT &aKey, const ValueT &aValue)
+  {
+    return change (aKey, [this, &aKey, &aValue] (auto &entries) {
+      if (!entries.insert (aKey, aValue))
+	{
+	  return false;
+	}
+      log.append (RecordType::PUT, log_codec<KeyT>::encode (aKey), log_codec<ValueT>::encode (aValue));
+      return true;
+    });
+  }
+
+  /// <summary>Replaces the value of an element and logs it.</summary>
+  /// <param name="aKey">The key</param>
+  /// <param name="aValue">The new value</param>
+  /// <returns>True if the key was present in the map.</returns>
+  bool
+  update (const KeyT &aKey, const ValueT &aValue)
+  {
+    return change (aKey, [this, &aKey, &aValue] (auto &entries) {
+      auto value = entries.find (aKey);
+      if (!value)
+	{
+	  return false;
+	}
+      *value = aValue;
+      log.append (RecordType::PUT, log_codec<KeyT>::encode (aKey), log_codec<ValueT>::encode (aValue));
+      return true;
+    });
+  }
+
+  /// <summary>Erases an element and logs it.</summary>
+  /// <param name="aKey">The key</param>
+  /// <returns>True if the key was present in the map.</returns>
+  bool
+  erase (const KeyT &aKey)
+  {
+    return change (aKey, [this, &aKey] (auto &entries) {
+      if (!entries.erase (aKey))
+	{
+	  return false;
+	}
+      log.append (RecordType::ERASE, log_codec<KeyT>::encode (aKey));
+      return true;
+    });
+  }
+
+  /// <summary>Copies the value of an element.</summary>
+  /// <param name="aKey">The key</param>
+  /// <returns>The value, or std::nullopt if the key is not found.</returns>
+  std::optional<ValueT>
+  get (const KeyT &aKey) const
+  {
+    return map.get (aKey);
+  }
+
+  /// <summary>Checks whether the map holds an element with the key.</summary>
+  /// <param name="aKey">The key</param>
+  /// <returns></returns>
+  bool
+  contains (const KeyT &aKey) const
+  {
+    return map.contains (aKey);
+  }
+
+  /// <summary>Runs a callback on the value of an element under its locks (see concurrent_unordered_map::cvisit).
+  /// </summary>
+  /// <param name="aKey">The key</param>
+  /// <param name="visitor">Called as visitor (const ValueT &amp;); must not call back into the map</param>
+  /// <returns>True if the key was found (and the visitor called).</returns>
+  template <class VisitorT>
+  bool
+  cvisit (const KeyT &aKey, VisitorT &&visitor) const
+  {
+    return map.cvisit (aKey, std::forward<VisitorT> (visitor));
+  }
+
+  /// <summary>Writes and fsyncs every change made so far, whatever the durability.</summary>
+  /// <param></param>
+  /// <returns></returns>
+  void
+  sync ()
+  {
+    log.commit ();
+  }
+
+  /// <summary>Writes a snapshot of the map and starts a new log file, so that recovery no longer reads the records
+  /// logged before the previous checkpoint. Changes may go on meanwhile: the snapshot may or may not hold a change
+  /// made during the call, and the log replayed on top of it brings every key to its latest logged state.</summary>
+  /// <param></param>
+  /// <returns></returns>
+  void
+  checkpoint ()
+  {
+    std::unique_lock<std::mutex> lock (checkpointMutex);
+    // Every change logged with a smaller sequence was applied before its bucket lock was released, so the walk below
+    // sees it.
+    WriteAheadLog::SnapshotWriter snapshot (snapshotPath, log.getNextSequence ());
+    map.cvisit_all (
+      [&snapshot] (const KeyT &aKey, const ValueT &aValue) {
+	snapshot.add (log_codec<KeyT>::encode (aKey), log_codec<ValueT>::encode (aValue));
+      },
+      1);
+    snapshot.commit ();
+    log.rotate ();
+  }
+
+private:
+  // Logging under the bucket lock keeps the records of a key in the order the changes were applied; waiting for the
+  // commit happens once the lock is released.
+  template <class FuncT>
+  bool
+  change (const KeyT &aKey, FuncT &&func)
+  {
+    bool isChanged = map.atomically ({ aKey }, std::forward<FuncT> (func));
+    if (isChanged)
+      {
+	log.waitForCommit ();
+      }
+    return isChanged;
+  }
+
+  // Runs before the log is opened: the map is already constructed, the log member not yet.
+  uint64_t
+  recover (const std::string &logPath)
+  {
+    auto apply = [this] (RecordType type, std::string_view keyBytes, std::string_view valueBytes) {
+      auto aKey = log_codec<KeyT>::decode (keyBytes);
+      if (type == RecordType::ERASE)
+	{
+	  map.erase (aKey);
+	  return;
+	}
+      auto aValue = log_codec<ValueT>::decode (valueBytes);
+      if (!map.update (aKey, aValue))
+	{
+	  map.insert (aKey, aValue);
+	}
+    };
+    auto snapshotSequence = WriteAheadLog::readSnapshot (snapshotPath, apply);
+    return WriteAheadLog::replay (logPath, snapshotSequence, apply);
+  }
+
+  Map map;
+  std::string snapshotPath;
+  std::mutex checkpointMutex;
+  WriteAheadLog log;
+};
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef _FAST_HASH_HPP_
+#define _FAST_HASH_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+/// 64-bit hash of a byte range, wyhash-style for short inputs and with an XXH3-style four-lane accumulation above
+/// longInputLength bytes. The accumulation runs on AVX2 when the CPU has it (checked once at run time) and on a
+/// scalar loop otherwise; both compute the same hash.
+class ByteHash
+{
+public:
+  static constexpr std::size_t longInputLength = 128;
+
+  ByteHash () = delete;
+
+  static uint64_t
+  hash (const void *data, std::size_t length, uint64_t seed = 0)
+  {
+    auto bytes = static_cast<const unsigned char *> (data);
+    auto state = seed ^ secret[0];
+    uint64_t first = 0;
+    uint64_t second = 0;
+
+    if (length <= 16)
+      {
+	if (length >= 4)
+	  {
+	    auto middle = (length >> 3) << 2; // 0 or 4: the two halves overlap for 4 to 7 bytes
+	    first = (read32 (bytes) << 32) | read32 (bytes + middle);
+	    second = (read32 (bytes + length - 4) << 32) | read32 (bytes + length - 4 - middle);
+	  }
+	else if (length > 0)
+	  {
+	    first = (uint64_t (bytes[0]) << 16) | (uint64_t (bytes[length >> 1]) << 8) | bytes[length - 1];
+	  }
+      }
+    else
+      {
+	auto remaining = length;
+	if (length > longInputLength)
+	  {
+	    state = hashLong (bytes, length, state);
+	    bytes += length - 16;
+	    remaining = 16;
+	  }
+	for (; remaining > 16; remaining -= 16, bytes += 16)
+	  {
+	    state = multiplyFold (read64 (bytes) ^ secret[1], read64 (bytes + 8) ^ state);
+	  }
+	// The last 16 bytes, overlapping the loop's when the length is not a multiple of 16.
+	first = read64 (bytes + remaining - 16);
+	second = read64 (bytes + remaining - 8);
+      }
+
+    return multiplyFold (secret[1] ^ length, multiplyFold (first ^ secret[1], second ^ state));
+  }
+
+  /// Whether inputs longer than longInputLength are hashed with AVX2.
+  static bool usesAvx2 ();
+
+  /// The 64 x 64 -> 128 bit product of a and b, its two halves xor-ed.
+  static uint64_t
+  multiplyFold (uint64_t a, uint64_t b)
+  {
+#ifdef __SIZEOF_INT128__
+    auto product = __uint128_t (a) * b;
+    return uint64_t (product) ^ uint64_t (product >> 64);
+#else
+    auto aHigh = a >> 32, aLow = a & 0xffffffffu, bHigh = b >> 32, bLow = b & 0xffffffffu;
+    auto high = aHigh * bHigh, middle0 = aHigh * bLow, middle1 = aLow * bHigh, low = aLow * bLow;
+    auto carry = ((low >> 32) + (middle0 & 0xffffffffu) + (middle1 & 0xffffffffu)) >> 32;
+    return (low + (middle0 << 32) + (middle1 << 32)) ^ (high + (middle0 >> 32) + (middle1 >> 32) + carry);
+#endif
+  }
+
+  static constexpr uint64_t secret[8]
+    = { 0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull,
+	0x1d8e4e27c47d124full, 0xbe4ba423396cfeb8ull, 0x1cad21f72c81017cull, 0xdb979083e96dd4deull };
+
+private:
+  static uint64_t hashLong (const unsigned char *bytes, std::size_t length, uint64_t state);
+
+  static uint64_t
+  read64 (const unsigned char *bytes)
+  {
+    uint64_t value;
+    std::memcpy (&value, bytes, sizeof (value));
+    return value;
+  }
+
+  static uint64_t
+  read32 (const unsigned char *bytes)
+  {
+    uint32_t value;
+    std::memcpy (&value, bytes, sizeof (value));
+    return value;
+  }
+};
+
+/// Hash functions for concurrent_unordered_map that spread every key bit over the whole hash. std::hash of an
+/// integer is the identity in libstdc++, so strided keys fill every stride-th bucket of a table whose size shares a
+/// factor with the stride; fast_hash mixes them first. Strings are hashed with ByteHash. Other keys use std::hash.
+template <class KeyT> struct fast_hash : std::hash<KeyT>
+{
+};
+
+template <class KeyT>
+  requires (std::is_integral_v<KeyT>)
+struct fast_hash<KeyT>
+{
+  std::size_t
+  operator() (KeyT aKey) const
+  {
+    // The splitmix64 finalizer: a bijection in which every input bit flips about half of the output bits.
+    auto bits = uint64_t (aKey);
+    bits = (bits ^ (bits >> 30)) * 0xbf58476d1ce4e5b9ull;
+    bits = (bits ^ (bits >> 27)) * 0x94d049bb133111ebull;
+    return std::size_t (bits ^ (bits >> 31));
+  }
+};
+
+template <class CharT, class TraitsT> struct fast_hash<std::basic_string_view<CharT, TraitsT>>
+{
+  std::size_t
+  operator() (std::basic_string_view<CharT, TraitsT> aKey) const
+  {
+    return std::size_t (ByteHash::hash (aKey.data (), aKey.size () * sizeof (CharT)));
+  }
+};
+
+template <class CharT, class TraitsT, class AllocatorT>
+struct fast_hash<std::basic_string<CharT, TraitsT, AllocatorT>> : fast_hash<std::basic_string_view<CharT, TraitsT>>
+{
+};
+
+/// The HashFuncT the containers use when none is given: fast_hash in builds with USE_FAST_HASH, std::hash otherwise.
+#ifdef USE_FAST_HASH
+template <class KeyT> using default_hash = fast_hash<KeyT>;
+#else
+template <class KeyT> using default_hash = std::hash<KeyT>;
+#endif
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef _HARDWARE_COUNTERS_HPP_
+#define _HARDWARE_COUNTERS_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum class HardwareEvent
+{
+  CYCLES,
+  INSTRUCTIONS,
+  L1D_MISSES,
+  LLC_MISSES,
+  DTLB_MISSES,
+  BRANCH_MISSES
+};
+
+constexpr std::size_t hardwareEventCount = 6;
+
+/// Counts read from one HardwareCounterGroup. Events the kernel refused to count are marked unavailable.
+struct HardwareCounterValues
+{
+  std::array<uint64_t, hardwareEventCount> counts {};
+  std::array<bool, hardwareEventCount> available {};
+
+  bool isAvailable () const;
+
+  uint64_t
+  get (HardwareEvent anEvent) const
+  {
+    return counts[std::size_t (anEvent)];
+  }
+
+  HardwareCounterValues &operator+= (const HardwareCounterValues &other);
+
+  /// One line of counts; with operationCount > 0 every count is also given per operation.
+  std::string toText (uint64_t operationCount = 0) const;
+};
+
+/// A perf_event_open group counting the user-space events of the calling thread. Every event that can be opened
+/// joins the group, so all of them are scheduled on the PMU together. If none can be opened (no PMU access in a
+/// container, perf_event_paranoid, a non-Linux build) the group does nothing and stop () returns unavailable values.
+class HardwareCounterGroup
+{
+public:
+  HardwareCounterGroup ();
+  ~HardwareCounterGroup ();
+
+  HardwareCounterGroup (const HardwareCounterGroup &) = delete;
+  HardwareCounterGroup &operator= (const HardwareCounterGroup &) = delete;
+
+  bool
+  isAvailable () const
+  {
+    return leaderFd != -1;
+  }
+
+  void start ();
+
+  /// Stops counting and returns the counts, scaled up if the kernel had to multiplex the group.
+  HardwareCounterValues stop ();
+
+  /// Why the first event failed to open, or an empty string if every event opened.
+  static std::string getUnavailableReason ();
+
+private:
+  int leaderFd = -1;
+  std::array<int, hardwareEventCount> eventFds;
+};
+
+/// Per-thread counts of one benchmark phase.
+class PhaseCounters
+{
+public:
+  void add (int threadIndex, const HardwareCounterValues &someValues);
+
+  /// Per-thread lines followed by the total, titled "<title> Counters".
+  std::string toText (const std::string &title, uint64_t operationCount) const;
+
+private:
+  mutable std::mutex valuesMutex;
+  std::vector<std::pair<int, HardwareCounterValues>> threadValues;
+};
+
+#endif
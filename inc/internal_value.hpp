@@ -1,35 +1,61 @@
 #ifndef _INTERNAL_VALUE_HPP_
 #define _INTERNAL_VALUE_HPP_
 
+#include <memory>
 #include <optional>
-#include <shared_mutex>
+#include <type_traits>
 #include <variant>
 
+#include "async_wait_queue.hpp"
 #include "unordered_map_utils.hpp"
 
-template <class KeyT, class ValueT, class HashFuncT> class concurrent_unordered_map;
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT> class concurrent_unordered_map;
 
-template <class KeyT, class ValueT, class HashFuncT>
-class internal_value : public std::enable_shared_from_this<internal_value<KeyT, ValueT, HashFuncT>>
+/// An entry of a bucket. Inline entries (is_inline_storable_v) are held by value in the bucket instead of through a
+/// shared_ptr, so they do not derive from enable_shared_from_this.
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT>
+class internal_value
+  : public std::conditional_t<is_inline_storable_v<KeyT, ValueT>, std::monostate,
+			      std::enable_shared_from_this<internal_value<KeyT, ValueT, HashFuncT, LockPolicyT>>>
 {
 public:
-  using Map = concurrent_unordered_map<KeyT, ValueT, HashFuncT>;
-  using Iterator = typename concurrent_unordered_map<KeyT, ValueT, HashFuncT>::iterator;
+  using Map = concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>;
+  using Iterator = typename concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>::iterator;
+  using Mutex = typename LockPolicyT::mutex_type;
+  using SharedVariantLock = typename lock_types<Mutex>::SharedVariantLock;
+  using StackReadLock = NotifyingLock<std::shared_lock<Mutex>>;
+  using StackWriteLock = NotifyingLock<std::unique_lock<Mutex>>;
+
+  using Entry = entry_type_t<KeyT, ValueT>;
+
+  static constexpr bool isInline = is_inline_storable_v<KeyT, ValueT>;
+  static constexpr bool isSetElement = std::is_same_v<ValueT, set_value_tag>;
+
+  // Set elements and inline entries have nothing that can change after insert except the erase flag and, for inline
+  // entries, the atomically accessed value; the erase flag is only read and written under the bucket lock, so they
+  // skip the value mutex.
+  static constexpr bool hasValueMutex = !isSetElement && !isInline;
 
   internal_value (const KeyT &aKey, const ValueT &aValue) : isMarkedForDelete (false), keyValue (aKey, aValue)
   {
-    valueMutex = std::make_unique<std::shared_mutex> ();
+    if constexpr (hasValueMutex)
+      {
+	valueMutex = std::make_unique<Mutex> ();
+      }
   }
 
   internal_value (const std::pair<KeyT, ValueT> &aKeyValuePair) : isMarkedForDelete (false), keyValue (aKeyValuePair)
   {
-    valueMutex = std::make_unique<std::shared_mutex> ();
+    if constexpr (hasValueMutex)
+      {
+	valueMutex = std::make_unique<Mutex> ();
+      }
   }
 
   bool
   compareKey (const KeyT &aKey) const
   {
-    auto valueLock = Map::getValueLockFor (&(*valueMutex), LockType::READ);
+    auto valueLock = lockValue (LockType::READ);
     if (!isMarkedForDelete)
       {
 	return keyValue.first == aKey;
@@ -40,35 +66,79 @@ public:
   std::pair<KeyT, ValueT>
   getKeyValuePair () const
   {
-    auto valueLock = Map::getValueLockFor (&(*valueMutex), LockType::READ);
-    return keyValue;
+    auto valueLock = lockValue (LockType::READ);
+    return std::make_pair (keyValue.first, loadValue ());
   }
 
   void
   erase ()
   {
-    auto valueLock = Map::getValueLockFor (&(*valueMutex), LockType::WRITE);
+    auto valueLock = lockValue (LockType::WRITE);
+    isMarkedForDelete = true;
+  }
+
+  /// Same as erase for a caller holding the bucket write lock, which already keeps every reader of the flag out.
+  void
+  eraseLocked ()
+  {
     isMarkedForDelete = true;
   }
 
   bool
   isAvailable () const
   {
-    auto valueLock = Map::getValueLockFor (&(*valueMutex), LockType::READ);
+    auto valueLock = lockValue (LockType::READ);
     return !isMarkedForDelete;
   }
 
   void
   setAvailable ()
   {
-    std::unique_lock<std::shared_mutex> lock (*valueMutex);
+    StackWriteLock valueLock;
+    if constexpr (hasValueMutex)
+      {
+	valueLock = StackWriteLock (*valueMutex);
+      }
     isMarkedForDelete = false;
   }
 
+  /// Runs the visitor on the value if it holds the key, under a stack-scoped read lock (no lock map entry).
+  template <class VisitorT>
+  bool
+  visitIfKey (const KeyT &aKey, VisitorT &visitor) const
+  {
+    // The key never changes after construction, so only a match pays for the value lock.
+    if (!(keyValue.first == aKey))
+      {
+	return false;
+      }
+
+    StackReadLock valueLock;
+    if constexpr (hasValueMutex)
+      {
+	valueLock = StackReadLock (*valueMutex);
+      }
+    if (isMarkedForDelete)
+      {
+	return false;
+      }
+
+    if constexpr (isInline)
+      {
+	const auto value = loadValue ();
+	visitor (value);
+      }
+    else
+      {
+	visitor (keyValue.second);
+      }
+    return true;
+  }
+
   std::optional<KeyT>
   getKey () const
   {
-    auto valueLock = Map::getValueLockFor (&(*valueMutex), LockType::READ);
+    auto valueLock = lockValue (LockType::READ);
     if (!isMarkedForDelete)
       {
 	return keyValue.first;
@@ -80,21 +150,142 @@ public:
   getIterator (Map const *const aMap, int bucketIndex, int valueIndex, SharedVariantLock bucketLock,
 	       LockType lockType) const
   {
-    auto valueLock = Map::getValueLockFor (&(*valueMutex), lockType);
-    auto self = this->shared_from_this ();
-    return Iterator (self, aMap, bucketIndex, valueIndex, bucketLock, valueLock);
+    auto valueLock = lockValue (lockType);
+    return Iterator (getSelf (), aMap, bucketIndex, valueIndex, bucketLock, valueLock);
+  }
+
+  /// Runs visitor (key, value) unless the entry is erased, under a read lock: stack-scoped, or through the lock maps
+  /// for a thread that may already hold it (iterators).
+  template <class VisitorT>
+  bool
+  cvisitEntry (VisitorT &visitor, bool throughLockMaps) const
+  {
+    StackReadLock valueLock;
+    SharedVariantLock sharedValueLock;
+    if constexpr (hasValueMutex)
+      {
+	if (throughLockMaps)
+	  {
+	    sharedValueLock = lockValue (LockType::READ);
+	  }
+	else
+	  {
+	    valueLock = StackReadLock (*valueMutex);
+	  }
+      }
+    if (isMarkedForDelete)
+      {
+	return false;
+      }
+
+    if constexpr (isInline)
+      {
+	const auto value = loadValue ();
+	visitor (keyValue.first, value);
+      }
+    else
+      {
+	visitor (keyValue.first, keyValue.second);
+      }
+    return true;
+  }
+
+  /// Same as cvisitEntry with a mutable value, under a write lock. The caller holds the bucket write lock.
+  template <class VisitorT>
+  bool
+  visitEntry (VisitorT &visitor, bool throughLockMaps)
+  {
+    StackWriteLock valueLock;
+    SharedVariantLock sharedValueLock;
+    if constexpr (hasValueMutex)
+      {
+	if (throughLockMaps)
+	  {
+	    sharedValueLock = lockValue (LockType::WRITE);
+	  }
+	else
+	  {
+	    valueLock = StackWriteLock (*valueMutex);
+	  }
+      }
+    if (isMarkedForDelete)
+      {
+	return false;
+      }
+    visitor (std::as_const (keyValue.first), keyValue.second);
+    return true;
+  }
+
+  /// Runs modify (std::atomic_ref<ValueT>) on the value if it holds the key. Inline entries only; the caller holds
+  /// the bucket lock, which keeps the erase flag stable.
+  template <class ModifyT>
+  bool
+  modifyIfKey (const KeyT &aKey, ModifyT &modify)
+  {
+    static_assert (isInline, "only inline values are modified atomically");
+    if (isMarkedForDelete || !(keyValue.first == aKey))
+      {
+	return false;
+      }
+    modify (std::atomic_ref<ValueT> (keyValue.second));
+    return true;
+  }
+
+  /// Whether aMutexAddress is this entry's value mutex (the address a LockWouldBlock reports).
+  bool
+  hasValueMutexAt (const void *aMutexAddress) const
+  {
+    if constexpr (hasValueMutex)
+      {
+	return valueMutex.get () == aMutexAddress;
+      }
+    else
+      {
+	return false;
+      }
+  }
+
+  /// The key, which never changes after construction; for a caller holding the bucket write lock like
+  /// getValueLocked.
+  const KeyT &
+  getKeyLocked () const
+  {
+    return keyValue.first;
+  }
+
+  /// The entry's key and value if it is live and holds the key, otherwise nullptr. The caller holds the bucket lock and
+  /// the entry's value is never updated in place (multimap values), so the value lock is skipped.
+  const Entry *
+  getEntryLocked (const KeyT &aKey) const
+  {
+    if (isMarkedForDelete || !(keyValue.first == aKey))
+      {
+	return nullptr;
+      }
+    return &keyValue;
+  }
+
+  /// The value of the entry if it is live and holds the key, otherwise nullptr. The caller holds the bucket write
+  /// lock, which keeps every other thread off the entry, so the value lock is skipped.
+  ValueT *
+  getValueLocked (const KeyT &aKey)
+  {
+    if (isMarkedForDelete || !(keyValue.first == aKey))
+      {
+	return nullptr;
+      }
+    return &keyValue.second;
   }
 
   Iterator
   getIteratorForKey (Map const *const aMap, KeyT key, int bucketIndex, int valueIndex, SharedVariantLock bucketLock,
 		     LockType lockType) const
   {
-    auto valueLock = Map::getValueLockFor (&(*valueMutex), lockType);
+    auto valueLock = lockValue (lockType);
 
     if (!isMarkedForDelete && keyValue.first == key)
       {
-	auto self = this->shared_from_this ();
-	return Iterator (self, aMap, bucketIndex, valueIndex, bucketLock, valueLock);
+	return Iterator (getSelf (), aMap, bucketIndex, valueIndex, bucketLock, valueLock);
       }
     return aMap->end ();
   }
@@ -102,9 +293,9 @@ public:
   void
   updateIterator (Iterator &it, int bucketIndex, int valueIndex, SharedVariantLock bucketLock) const
   {
-    auto valueLock = Map::getValueLockFor (&(*valueMutex), LockType::READ);
+    auto valueLock = lockValue (LockType::READ);
 
-    it.internalValue = this->shared_from_this ();
+    it.internalValue = getSelf ();
     it.key = keyValue.first;
     it.bucketIndex = bucketIndex;
     it.valueIndex = valueIndex;
@@ -115,15 +306,70 @@ public:
   void
   updateValue (const ValueT &newValue)
   {
-    auto valueLock = Map::getValueLockFor (&(*valueMutex), LockType::WRITE);
+    auto valueLock = lockValue (LockType::WRITE);
     isMarkedForDelete = false;
-    keyValue.second = newValue;
+    if constexpr (isSetElement)
+      {
+	// The empty value shares its address with the key: an atomic store would write over the key.
+      }
+    else if constexpr (isInline)
+      {
+	std::atomic_ref<ValueT> (keyValue.second).store (newValue, std::memory_order_relaxed);
+      }
+    else
+      {
+	keyValue.second = newValue;
+      }
   }
 
 private:
-  std::unique_ptr<std::shared_mutex> valueMutex;
+  std::shared_ptr<const internal_value>
+  getSelf () const
+  {
+    if constexpr (isInline)
+      {
+	// Not owning: the bucket keeps its inline entries in place while the iterator pins it (bucket::pin).
+	return std::shared_ptr<const internal_value> (std::shared_ptr<const internal_value> (), this);
+      }
+    else
+      {
+	return this->shared_from_this ();
+      }
+  }
+
+  ValueT
+  loadValue () const
+  {
+    if constexpr (isSetElement)
+      {
+	return ValueT ();
+      }
+    else if constexpr (isInline)
+      {
+	return std::atomic_ref<ValueT> (const_cast<ValueT &> (keyValue.second)).load (std::memory_order_relaxed);
+      }
+    else
+      {
+	return keyValue.second;
+      }
+  }
+
+  SharedVariantLock
+  lockValue (LockType lockType) const
+  {
+    if constexpr (hasValueMutex)
+      {
+	return Map::getValueLockFor (&(*valueMutex), lockType);
+      }
+    else
+      {
+	return nullptr;
+      }
+  }
+
+  [[no_unique_address]] std::conditional_t<hasValueMutex, std::unique_ptr<Mutex>, std::monostate> valueMutex;
   bool isMarkedForDelete;
-  std::pair<KeyT, ValueT> keyValue;
+  Entry keyValue;
 
   friend Map;
   friend Iterator;
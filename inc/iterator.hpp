@@ -1,20 +1,67 @@
 #ifndef _FORWARD_ITERATOR_HPP_
 #define _FORWARD_ITERATOR_HPP_
 
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <utility>
 #include <variant>
 
+#include "bucket_table.hpp"
 #include "internal_value.hpp"
+#include "read_epoch.hpp"
 #include "unordered_map_utils.hpp"
+#include "writers_gate.hpp"
 
-template <class KeyT, class ValueT, class HashFuncT> class concurrent_unordered_map;
-template <class KeyT, class ValueT, class HashFuncT> class bucket;
-template <class KeyT, class ValueT, class HashFuncT> class internal_value;
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT> class concurrent_unordered_map;
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT> class bucket;
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT> class internal_value;
 
-template <class KeyT, class ValueT, class HashFuncT> class Iterator
+/// Counts an iterator in its bucket's pin count for as long as it exists; a bucket with pinned iterators does not move
+/// its inline entries (see bucket::isPinned).
+class BucketPin
 {
 public:
-  using Map = concurrent_unordered_map<KeyT, ValueT, HashFuncT>;
-  using InternalValue = internal_value<KeyT, ValueT, HashFuncT>;
+  BucketPin () = default;
+
+  explicit BucketPin (std::atomic<uint32_t> *aPinCount) : pinCount (aPinCount)
+  {
+    if (pinCount)
+      {
+	pinCount->fetch_add (1, std::memory_order_relaxed);
+      }
+  }
+
+  BucketPin (const BucketPin &other) : BucketPin (other.pinCount)
+  {
+  }
+
+  BucketPin &
+  operator= (BucketPin other)
+  {
+    std::swap (pinCount, other.pinCount);
+    return *this;
+  }
+
+  ~BucketPin ()
+  {
+    if (pinCount)
+      {
+	pinCount->fetch_sub (1, std::memory_order_release); // the entry is no longer read once the count drops
+      }
+  }
+
+private:
+  std::atomic<uint32_t> *pinCount = nullptr;
+};
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT> class Iterator
+{
+public:
+  using Map = concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>;
+  using InternalValue = internal_value<KeyT, ValueT, HashFuncT, LockPolicyT>;
+  using SharedVariantLock = typename lock_types<typename LockPolicyT::mutex_type>::SharedVariantLock;
 
   Iterator (std::shared_ptr<const InternalValue> value, Map const *const aMap, int aBucketIndex, int aValueIndex,
 	    SharedVariantLock aBucketLock, SharedVariantLock aValueLock)
@@ -40,6 +87,9 @@ public:
     valueIndex = other.valueIndex;
     bucketLock = other.bucketLock;
     valueLock = other.valueLock;
+    table = other.table;
+    tableGuard = other.tableGuard;
+    bucketPin = other.bucketPin;
     isEnd = other.isEnd;
   }
 
@@ -60,26 +110,37 @@ public:
     key = other.key;
     bucketIndex = other.bucketIndex;
     valueIndex = other.valueIndex;
+    bucketLock = other.bucketLock;
     valueLock = other.valueLock;
+    table = other.table;
+    tableGuard = other.tableGuard;
+    bucketPin = other.bucketPin;
     isEnd = other.isEnd;
 
     return *this;
   }
 
-  std::pair<KeyT, ValueT> &
+  typename InternalValue::Entry &
   operator* () const
   {
-    std::pair<KeyT, ValueT> *keyValueP = const_cast<std::pair<KeyT, ValueT> *> (&(internalValue->keyValue));
+    auto keyValueP = const_cast<typename InternalValue::Entry *> (&(internalValue->keyValue));
     return *keyValueP;
   }
 
-  std::pair<KeyT, ValueT> *
+  typename InternalValue::Entry *
   operator-> () const
   {
-    std::pair<KeyT, ValueT> *keyValueP = const_cast<std::pair<KeyT, ValueT> *> (&(internalValue->keyValue));
+    auto keyValueP = const_cast<typename InternalValue::Entry *> (&(internalValue->keyValue));
     return keyValueP;
   }
 
+  /// The value, read atomically: an inline value may be changed by fetch_add while a read iterator points to it.
+  ValueT
+  load () const
+  {
+    return internalValue->loadValue ();
+  }
+
   bool
   operator== (const Iterator &other) const
   {
@@ -111,7 +172,7 @@ public:
 
     if (!hasBucketLock)
       {
-	bucketLock = map->aquireBucketLock (bucketIndex);
+	bucketLock = map->aquireBucketLock (table, bucketIndex);
       }
 
     if (!isEnd)
@@ -137,7 +198,8 @@ private:
   }
 
 private:
-  using Bucket = bucket<KeyT, ValueT, HashFuncT>;
+  using Bucket = bucket<KeyT, ValueT, HashFuncT, LockPolicyT>;
+  using BucketTable = bucket_table<Bucket>;
 
   KeyT key;
   const Map *map;
@@ -149,6 +211,19 @@ private:
   SharedVariantLock bucketLock;
   SharedVariantLock valueLock;
 
+  // The bucket table this iterator walks; the epoch guard keeps it alive after a rehash / shrink replaced it. A write
+  // iterator also holds a pass of the writers gate, so a migration waits for it instead of copying the entry it writes.
+  struct TableGuard
+  {
+    ReadEpoch::Guard epochGuard;
+    std::shared_lock<WritersGate> writersPass;
+  };
+
+  const BucketTable *table = nullptr;
+  std::shared_ptr<TableGuard> tableGuard;
+
+  BucketPin bucketPin; // only for inline entries
+
   bool isEnd;
 
   friend Map;
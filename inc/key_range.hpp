@@ -0,0 +1,114 @@
+#ifndef _KEY_RANGE_HPP_
+#define _KEY_RANGE_HPP_
+
+#include <optional>
+#include <utility>
+
+#include "bucket.hpp"
+#include "read_epoch.hpp"
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT> class concurrent_unordered_multimap;
+
+/// The values of one key of a concurrent_unordered_multimap, read in place: the key's bucket stays read-locked from
+/// equal_range until the range is destroyed, so its entries neither change nor move meanwhile, and nothing is copied.
+/// Like an iterator, a range must not outlive its multimap, and the thread holding it must not change the multimap.
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT> class key_range
+{
+  using Bucket = bucket<KeyT, ValueT, HashFuncT, LockPolicyT>;
+  using BucketLock = typename Bucket::template ScopedBucketLock<LockType::READ>;
+  using Entry = typename Bucket::InternalValue::Entry;
+
+public:
+  /// Forward iterator over the live entries of the key, in insertion order.
+  class iterator
+  {
+  public:
+    const Entry &
+    operator* () const
+    {
+      return *entry;
+    }
+
+    const Entry *
+    operator-> () const
+    {
+      return entry;
+    }
+
+    iterator &
+    operator++ ()
+    {
+      ++index;
+      entry = range->keyBucket->findNextLocked (range->key, range->keyHash, index);
+      return *this;
+    }
+
+    bool
+    operator== (const iterator &other) const
+    {
+      return entry == other.entry;
+    }
+
+    bool
+    operator!= (const iterator &other) const
+    {
+      return entry != other.entry;
+    }
+
+  private:
+    iterator (const key_range *aRange, int anIndex, const Entry *anEntry)
+      : range (aRange), index (anIndex), entry (anEntry)
+    {
+    }
+
+    const key_range *range;
+    int index;
+    const Entry *entry; // nullptr at the end
+    friend key_range;
+  };
+
+  key_range (const key_range &) = delete;
+  key_range &operator= (const key_range &) = delete;
+
+  iterator
+  begin () const
+  {
+    int index = 0;
+    return iterator (this, index, keyBucket ? keyBucket->findNextLocked (key, keyHash, index) : nullptr);
+  }
+
+  iterator
+  end () const
+  {
+    return iterator (this, -1, nullptr);
+  }
+
+  /// True if the key has no values.
+  bool
+  empty () const
+  {
+    return begin () == end ();
+  }
+
+private:
+  // The epoch keeps the table of aBucket, which is nullptr if the key has no bucket, until the range is destroyed. The
+  // bucket lock is taken through the lock maps, so that iterators of the same thread can share it.
+  key_range (ReadEpoch::Guard &&anEpochGuard, const Bucket *aBucket, const KeyT &aKey, std::size_t aKeyHash)
+    : epochGuard (std::move (anEpochGuard)), keyBucket (aBucket), key (aKey), keyHash (aKeyHash)
+  {
+    if (keyBucket)
+      {
+	bucketLock.emplace (*keyBucket, true);
+      }
+  }
+
+  ReadEpoch::Guard epochGuard;
+  const Bucket *keyBucket;
+  KeyT key;
+  std::size_t keyHash;
+  std::optional<BucketLock> bucketLock;
+
+  friend concurrent_unordered_multimap<KeyT, ValueT, HashFuncT, LockPolicyT>;
+};
+
+#endif
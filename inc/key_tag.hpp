@@ -0,0 +1,48 @@
+#ifndef _KEY_TAG_HPP_
+#define _KEY_TAG_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+/// Summary of a key kept next to the entry pointer in its bucket, so that a lookup rejects most entries with another
+/// key without loading the entry or the key's characters. Empty for keys that are cheap to compare: they are
+/// compared directly.
+template <class KeyT> struct key_tag
+{
+  key_tag () = default;
+
+  key_tag (const KeyT &, std::size_t)
+  {
+  }
+
+  bool
+  operator== (const key_tag &) const
+  {
+    return true;
+  }
+};
+
+/// String keys: the full hash (also reused by rehash), the length and the first bytes of the key. Equal keys always
+/// have equal tags. The tag only copies these few bytes: the key itself stays in its entry, with its own allocation
+/// when it is too long for the small string buffer, so tags save cache misses on a lookup, not memory or allocations.
+template <class CharT, class TraitsT, class AllocatorT> struct key_tag<std::basic_string<CharT, TraitsT, AllocatorT>>
+{
+  key_tag () = default;
+
+  key_tag (const std::basic_string<CharT, TraitsT, AllocatorT> &aKey, std::size_t aKeyHash)
+    : keyHash (aKeyHash), length (uint32_t (aKey.size ()))
+  {
+    std::memcpy (&prefix, aKey.data (), std::min (sizeof (prefix), aKey.size () * sizeof (CharT)));
+  }
+
+  bool operator== (const key_tag &other) const = default;
+
+  std::size_t keyHash = 0;
+  uint32_t length = 0;
+  uint32_t prefix = 0; // zero padded
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef _LATENCY_HISTOGRAM_HPP_
+#define _LATENCY_HISTOGRAM_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Log-linear histogram of latencies in nanoseconds (HdrHistogram layout): every power of two is split into 32
+/// sub-buckets, so a reported percentile is within ~3% of the recorded value. The maximum is exact.
+class LatencyHistogram
+{
+public:
+  LatencyHistogram ();
+
+  void record (uint64_t nanoseconds);
+
+  LatencyHistogram &operator+= (const LatencyHistogram &other);
+
+  uint64_t
+  getCount () const
+  {
+    return count;
+  }
+
+  uint64_t
+  getMax () const
+  {
+    return maxValue;
+  }
+
+  /// The smallest recorded value that at least percentile % of the values do not exceed (percentile in [0, 100]).
+  uint64_t getPercentile (double percentile) const;
+
+  /// p50, p90, p99, p999 and max in microseconds.
+  std::string toText () const;
+
+private:
+  static constexpr unsigned subBucketBits = 5;
+
+  static std::size_t getIndex (uint64_t value);
+  static uint64_t getHighestEquivalentValue (std::size_t index);
+
+  std::vector<uint64_t> counts;
+  uint64_t count = 0;
+  uint64_t maxValue = 0;
+};
+
+#endif
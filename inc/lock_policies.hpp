@@ -0,0 +1,337 @@
+#ifndef _LOCK_POLICIES_HPP_
+#define _LOCK_POLICIES_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <shared_mutex>
+
+#include "unordered_map_utils.hpp"
+
+/// Compact reader-writer lock: one 32-bit word, spins briefly and then parks on the word (futex on Linux).
+class spin_rw_mutex
+{
+public:
+  spin_rw_mutex () = default;
+  spin_rw_mutex (const spin_rw_mutex &) = delete;
+  spin_rw_mutex &operator= (const spin_rw_mutex &) = delete;
+
+  bool
+  try_lock ()
+  {
+    uint32_t current = state.load (std::memory_order_relaxed);
+    return (current & ~waitingBit) == 0
+	   && state.compare_exchange_strong (current, current | writerBit, std::memory_order_acquire);
+  }
+
+  void
+  lock ()
+  {
+    for (int i = 0; i < spinCount; ++i)
+      {
+	if (try_lock ())
+	  {
+	    return;
+	  }
+	cpuRelax ();
+      }
+
+    while (true)
+      {
+	uint32_t current = state.load (std::memory_order_relaxed);
+	if ((current & ~waitingBit) == 0)
+	  {
+	    if (state.compare_exchange_weak (current, current | writerBit, std::memory_order_acquire))
+	      {
+		return;
+	      }
+	    continue;
+	  }
+	park (current);
+      }
+  }
+
+  void
+  unlock ()
+  {
+    auto previous = state.fetch_and (~(writerBit | waitingBit), std::memory_order_release);
+    if (previous & waitingBit)
+      {
+	state.notify_all ();
+      }
+  }
+
+  bool
+  try_lock_shared ()
+  {
+    uint32_t current = state.load (std::memory_order_relaxed);
+    while (!(current & writerBit))
+      {
+	if (state.compare_exchange_weak (current, current + 1, std::memory_order_acquire))
+	  {
+	    return true;
+	  }
+      }
+    return false;
+  }
+
+  void
+  lock_shared ()
+  {
+    for (int i = 0; i < spinCount; ++i)
+      {
+	if (try_lock_shared ())
+	  {
+	    return;
+	  }
+	cpuRelax ();
+      }
+
+    while (true)
+      {
+	uint32_t current = state.load (std::memory_order_relaxed);
+	if (!(current & writerBit))
+	  {
+	    if (state.compare_exchange_weak (current, current + 1, std::memory_order_acquire))
+	      {
+		return;
+	      }
+	    continue;
+	  }
+	park (current);
+      }
+  }
+
+  void
+  unlock_shared ()
+  {
+    auto previous = state.fetch_sub (1, std::memory_order_release);
+    if ((previous & readerMask) == 1 && (previous & waitingBit))
+      {
+	state.fetch_and (~waitingBit, std::memory_order_relaxed);
+	state.notify_all ();
+      }
+  }
+
+private:
+  void
+  park (uint32_t current)
+  {
+    if (!(current & waitingBit))
+      {
+	if (!state.compare_exchange_weak (current, current | waitingBit, std::memory_order_relaxed))
+	  {
+	    return;
+	  }
+	current |= waitingBit;
+      }
+    state.wait (current, std::memory_order_relaxed);
+  }
+
+  static constexpr uint32_t writerBit = 1u << 31;
+  static constexpr uint32_t waitingBit = 1u << 30;
+  static constexpr uint32_t readerMask = waitingBit - 1;
+  static constexpr int spinCount = 64;
+
+  std::atomic<uint32_t> state { 0 };
+};
+
+/// Global table of "visible readers" used by reader_biased_rw_mutex (BRAVO, Dice and Kogan 2019).
+/// A biased reader publishes the lock address in one of the lock's readersPerLock slots, each on its own cache line,
+/// so readers of one lock do not share a reader count and a writer checks those few slots rather than the table.
+class VisibleReaders
+{
+public:
+  VisibleReaders () = delete;
+
+  /// Publishes a fast-path read of the lock. Returns false if the slot is already taken.
+  static bool publish (const void *lockAddress);
+
+  /// Withdraws the calling thread's fast-path read of the lock. Returns false if it holds none.
+  static bool retract (const void *lockAddress);
+
+  static bool hasReaders (const void *lockAddress);
+
+  static void waitForReaders (const void *lockAddress);
+
+private:
+  static constexpr std::size_t slotCount = 4096;
+  static constexpr std::size_t slotsPerLine = 64 / sizeof (std::atomic<const void *>);
+  static constexpr std::size_t lineCount = slotCount / slotsPerLine;
+  static constexpr std::size_t readersPerLock = 16;
+  static constexpr std::size_t maxHeldPerThread = 16;
+
+  struct HeldSlots
+  {
+    const void *lockAddresses[maxHeldPerThread];
+    std::size_t slotIndexes[maxHeldPerThread];
+    std::size_t count;
+  };
+
+  // The slot of the lock's readerIndex-th reader; a thread starts at its own reader index.
+  static std::size_t getSlotIndex (const void *lockAddress, std::size_t readerIndex);
+  static std::size_t getThreadReaderIndex ();
+
+  alignas (64) static std::atomic<const void *> slots[slotCount];
+  static thread_local HeldSlots heldSlots;
+};
+
+/// Reader-biased wrapper around a reader-writer lock. While the bias is on, readers only touch their visible-readers
+/// slot; a writer turns the bias off and waits for those readers to drain. The bias comes back after an inhibit window
+/// of inhibitMultiplier times what that revocation took, and at least minimumInhibit, so a lock that is written often
+/// stays a plain reader-writer lock instead of being revoked by every write.
+template <class MutexT> class reader_biased_rw_mutex
+{
+public:
+  reader_biased_rw_mutex () = default;
+  reader_biased_rw_mutex (const reader_biased_rw_mutex &) = delete;
+  reader_biased_rw_mutex &operator= (const reader_biased_rw_mutex &) = delete;
+
+  bool
+  try_lock ()
+  {
+    if (!underlyingMutex.try_lock ())
+      {
+	return false;
+      }
+
+    if (readerBias.load ())
+      {
+	readerBias.store (false);
+	if (VisibleReaders::hasReaders (this))
+	  {
+	    // The readers are still inside: a later lock () must find the bias on, or it would not wait for them.
+	    readerBias.store (true);
+	    underlyingMutex.unlock ();
+	    return false;
+	  }
+      }
+    return true;
+  }
+
+  void
+  lock ()
+  {
+    underlyingMutex.lock ();
+    if (readerBias.load ())
+      {
+	revokeBias ();
+      }
+  }
+
+  void
+  unlock ()
+  {
+    underlyingMutex.unlock ();
+  }
+
+  bool
+  try_lock_shared ()
+  {
+    if (tryFastRead ())
+      {
+	return true;
+      }
+
+    if (!underlyingMutex.try_lock_shared ())
+      {
+	return false;
+      }
+    restoreBias ();
+    return true;
+  }
+
+  void
+  lock_shared ()
+  {
+    if (tryFastRead ())
+      {
+	return;
+      }
+
+    underlyingMutex.lock_shared ();
+    restoreBias ();
+  }
+
+  void
+  unlock_shared ()
+  {
+    if (!VisibleReaders::retract (this))
+      {
+	underlyingMutex.unlock_shared ();
+      }
+  }
+
+private:
+  bool
+  tryFastRead ()
+  {
+    if (!readerBias.load ())
+      {
+	return false;
+      }
+
+    if (!VisibleReaders::publish (this))
+      {
+	return false;
+      }
+
+    // A writer clears the bias before looking for readers, so if the bias is still on it will see our slot.
+    if (readerBias.load ())
+      {
+	return true;
+      }
+    VisibleReaders::retract (this);
+    return false;
+  }
+
+  void
+  revokeBias ()
+  {
+    readerBias.store (false);
+    auto startTime = std::chrono::steady_clock::now ();
+    VisibleReaders::waitForReaders (this);
+    auto endTime = std::chrono::steady_clock::now ();
+    auto inhibit = std::max<std::chrono::steady_clock::duration> ((endTime - startTime) * inhibitMultiplier,
+								   minimumInhibit);
+    inhibitUntil.store ((endTime + inhibit).time_since_epoch ().count (), std::memory_order_relaxed);
+  }
+
+  void
+  restoreBias ()
+  {
+    if (!readerBias.load (std::memory_order_relaxed)
+	&& std::chrono::steady_clock::now ().time_since_epoch ().count ()
+	     >= inhibitUntil.load (std::memory_order_relaxed))
+      {
+	readerBias.store (true);
+      }
+  }
+
+  static constexpr int inhibitMultiplier = 9;
+  static constexpr std::chrono::microseconds minimumInhibit { 100 };
+
+  MutexT underlyingMutex;
+  std::atomic<bool> readerBias { false };
+  std::atomic<int64_t> inhibitUntil { 0 };
+};
+
+/// Lock policies select the mutex type used for buckets and values of concurrent_unordered_map.
+struct shared_mutex_policy
+{
+  using mutex_type = std::shared_mutex;
+};
+
+struct spin_futex_policy
+{
+  using mutex_type = spin_rw_mutex;
+};
+
+struct reader_biased_policy
+{
+  using mutex_type = reader_biased_rw_mutex<spin_rw_mutex>;
+};
+
+#endif
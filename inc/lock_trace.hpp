@@ -0,0 +1,42 @@
+#ifndef _LOCK_TRACE_HPP_
+#define _LOCK_TRACE_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "unordered_map_utils.hpp"
+
+/// Timeline of lock requests, acquisitions and releases and of bucket compactions, for builds with ADD_LOCK_TRACING.
+/// Every thread records into its own fixed-size ring buffer without locking; once a ring is full the oldest events
+/// are overwritten. toChromeJson () turns the buffered events into Chrome trace-event JSON (also opened by Perfetto):
+/// one wait slice per contended request, one hold span per acquisition and one slice per compaction, so a latency
+/// spike can be traced to the thread that held the lock.
+class LockTrace
+{
+public:
+  enum class EventType : uint8_t
+  {
+    REQUEST,
+    ACQUIRE,
+    RELEASE,
+    COMPACTION_BEGIN,
+    COMPACTION_END
+  };
+
+  static constexpr std::size_t unknownBucket = SIZE_MAX;
+  static constexpr std::size_t ringCapacity = std::size_t (1) << 16; // events per thread
+
+  LockTrace () = delete;
+
+  static void record (EventType anEventType, const void *mutexAddress, std::size_t bucketIndex, LockType lockType);
+
+  /// Drops the events recorded so far.
+  static void clear ();
+
+  static std::string toChromeJson ();
+  static bool writeChromeJson (const std::string &filePath);
+};
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef _LOCKED_ENTRIES_HPP_
+#define _LOCKED_ENTRIES_HPP_
+
+#include <algorithm>
+#include <deque>
+#include <initializer_list>
+#include <stdexcept>
+#include <vector>
+
+#include "bucket.hpp"
+#include "bucket_table.hpp"
+
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT> class concurrent_unordered_map;
+
+/// The keys of a concurrent_unordered_map::atomically call, with their buckets write-locked. The buckets are locked in
+/// ascending index order, each once however many of the keys it holds, so two calls never wait on each other in a
+/// cycle. Only the listed keys may be accessed; the locks are released when the call returns.
+template <class KeyT, class ValueT, class HashFuncT, class LockPolicyT> class locked_entries
+{
+  using Map = concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>;
+  using Bucket = bucket<KeyT, ValueT, HashFuncT, LockPolicyT>;
+  using BucketLock = typename Bucket::template ScopedBucketLock<LockType::WRITE>;
+
+public:
+  locked_entries (const locked_entries &) = delete;
+  locked_entries &operator= (const locked_entries &) = delete;
+
+  /// <summary>Finds the value of a key.</summary>
+  /// <param name="aKey">One of the locked keys</param>
+  /// <returns>The value, valid until the next insert or erase on these entries; nullptr if the key is not in the
+  /// map.</returns>
+  ValueT *
+  find (const KeyT &aKey)
+  {
+    auto lockedKey = findLockedKey (aKey);
+    return lockedKey->bucket->findLocked (aKey, lockedKey->keyHash);
+  }
+
+  /// <summary>Checks whether the map holds the key.</summary>
+  /// <param name="aKey">One of the locked keys</param>
+  /// <returns></returns>
+  bool
+  contains (const KeyT &aKey)
+  {
+    return find (aKey) != nullptr;
+  }
+
+  /// <summary>Inserts a key and a value, unless the key is already in the map.</summary>
+  /// <param name="aKey">One of the locked keys</param>
+  /// <param name="aValue">The value</param>
+  /// <returns>True if the pair was inserted.</returns>
+  bool
+  insert (const KeyT &aKey, const ValueT &aValue)
+  {
+    auto lockedKey = findLockedKey (aKey);
+    if (lockedKey->bucket->findLocked (aKey, lockedKey->keyHash))
+      {
+	return false;
+      }
+
+    lockedKey->bucket->insertLocked (aKey, lockedKey->keyHash, aValue);
+    ++map.valueCount;
+    return true;
+  }
+
+  /// <summary>Erases the key. The bucket is compacted, if needed, once the locks are released.</summary>
+  /// <param name="aKey">One of the locked keys</param>
+  /// <returns>True if the key was in the map.</returns>
+  bool
+  erase (const KeyT &aKey)
+  {
+    bool needsCompaction = false;
+    auto lockedKey = findLockedKey (aKey);
+    if (!lockedKey->bucket->eraseLocked (aKey, lockedKey->keyHash, map.erase_threshold, map.compactionMode,
+					 needsCompaction))
+      {
+	return false;
+      }
+
+    ++map.erasedCount;
+    if (needsCompaction
+	&& std::find (bucketsToCompact.begin (), bucketsToCompact.end (), lockedKey->bucketIndex)
+	     == bucketsToCompact.end ())
+      {
+	bucketsToCompact.push_back (lockedKey->bucketIndex);
+      }
+    return true;
+  }
+
+  ~locked_entries ()
+  {
+    bucketLocks.clear ();
+    for (auto bucketIndex : bucketsToCompact)
+      {
+	map.scheduleCompaction (bucketIndex);
+      }
+    if (!bucketsToCompact.empty () && double (map.size ()) < double (table.size ()) * map.shrinkWatermark)
+      {
+	map.shrinkRequested = true;
+      }
+  }
+
+private:
+  struct LockedKey
+  {
+    KeyT key;
+    std::size_t keyHash;
+    int bucketIndex;
+    Bucket *bucket;
+  };
+
+  // The caller holds the map's writers gate shared, so the table is not replaced while the entries exist.
+  locked_entries (Map &aMap, typename Map::BucketTable &aTable, std::initializer_list<KeyT> keys)
+    : map (aMap), table (aTable)
+  {
+    for (const auto &aKey : keys)
+      {
+	auto keyHash = map.hashFunc (aKey);
+	auto bucketIndex = int (map.getBucketIndexForHash (keyHash, table));
+	lockedKeys.push_back (LockedKey { aKey, keyHash, bucketIndex, &table[bucketIndex] });
+      }
+
+    std::vector<int> bucketIndexes;
+    for (const auto &lockedKey : lockedKeys)
+      {
+	bucketIndexes.push_back (lockedKey.bucketIndex);
+      }
+    std::sort (bucketIndexes.begin (), bucketIndexes.end ());
+    bucketIndexes.erase (std::unique (bucketIndexes.begin (), bucketIndexes.end ()), bucketIndexes.end ());
+
+    bool throughLockMaps = !Map::getBucketLockMap ().empty () || !Map::getValueLockMap ().empty ();
+    for (auto bucketIndex : bucketIndexes)
+      {
+	bucketLocks.emplace_back (table[bucketIndex], throughLockMaps);
+      }
+  }
+
+  const LockedKey *
+  findLockedKey (const KeyT &aKey) const
+  {
+    auto lockedKey = std::find_if (lockedKeys.begin (), lockedKeys.end (),
+				   [&aKey] (const LockedKey &candidate) { return candidate.key == aKey; });
+    if (lockedKey == lockedKeys.end ())
+      {
+	throw std::out_of_range ("locked_entries: the key was not passed to atomically");
+      }
+    return &*lockedKey;
+  }
+
+  Map &map;
+  typename Map::BucketTable &table;
+  std::vector<LockedKey> lockedKeys;
+  std::deque<BucketLock> bucketLocks; // not movable, so not in a vector
+  std::vector<int> bucketsToCompact;
+
+  friend Map;
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef _LOOKUP_FILTER_HPP_
+#define _LOOKUP_FILTER_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/// One block of a blocked Bloom filter over the map's keys: every bucket holds the block of its own keys, so the
+/// bucket index picks the block and the key sets bitsPerKey bits of it. A lookup whose bits are not all set skips the
+/// bucket without locking it. Bits are only set while the bucket is write-locked and are cleared by a compaction of
+/// the bucket, which rebuilds the block from its live keys; erased keys keep their bits until then.
+class LookupFilter
+{
+public:
+  static constexpr int bitsPerKey = 3;
+
+  /// The bits of a key. The hash is mixed first: std::hash of an integer is the key itself, which also chose the
+  /// bucket.
+  static uint64_t
+  maskFor (std::size_t keyHash)
+  {
+    auto mixed = uint64_t (keyHash) * 0x9e3779b97f4a7c15ull;
+    return (uint64_t (1) << (mixed >> 58)) | (uint64_t (1) << ((mixed >> 52) & 63))
+	   | (uint64_t (1) << ((mixed >> 46) & 63));
+  }
+
+  /// False if no key with this hash was added since the last rebuild. Takes no lock.
+  bool
+  mayContain (std::size_t keyHash) const
+  {
+    auto mask = maskFor (keyHash);
+    return (bits.load (std::memory_order_relaxed) & mask) == mask;
+  }
+
+  /// The caller holds the bucket write lock, so no other thread changes the bits meanwhile.
+  void
+  add (std::size_t keyHash)
+  {
+    bits.store (bits.load (std::memory_order_relaxed) | maskFor (keyHash), std::memory_order_relaxed);
+  }
+
+  /// Replaces the bits with the masks of the live keys (compaction); same locking as add.
+  void
+  rebuild (uint64_t keyMasks)
+  {
+    bits.store (keyMasks, std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<uint64_t> bits { 0 };
+};
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef _MAP_STATISTICS_HPP_
+#define _MAP_STATISTICS_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Lock wait counters of one bucket. Only waits on a lock that was already taken are recorded, so the
+/// uncontended path costs nothing.
+struct BucketContention
+{
+  std::atomic<uint64_t> waitCount { 0 };
+  std::atomic<uint64_t> waitNanoseconds { 0 };
+#ifdef ADD_LOCK_TRACING
+  std::size_t bucketIndex = SIZE_MAX; // set by bucket_table, reported in lock traces
+#endif
+
+  /// Blocks on a lock whose try_lock just failed and records how long it took.
+  template <class LockT>
+  void
+  lockContended (LockT &aLock)
+  {
+    auto startTime = std::chrono::steady_clock::now ();
+    aLock.lock ();
+    auto waited = std::chrono::duration_cast<std::chrono::nanoseconds> (std::chrono::steady_clock::now () - startTime);
+    waitCount.fetch_add (1, std::memory_order_relaxed);
+    waitNanoseconds.fetch_add (uint64_t (waited.count ()), std::memory_order_relaxed);
+  }
+};
+
+/// Probe counts (elements compared per lookup), recorded for one lookup in sampleInterval per thread.
+class ProbeSampler
+{
+public:
+  static constexpr uint32_t sampleInterval = 64;
+
+  static bool shouldSample ();
+
+  void record (std::size_t probeCount);
+
+  uint64_t
+  getSampleCount () const
+  {
+    return sampleCount.load (std::memory_order_relaxed);
+  }
+
+  uint64_t
+  getProbeCount () const
+  {
+    return probeCount.load (std::memory_order_relaxed);
+  }
+
+  uint64_t
+  getMaxProbes () const
+  {
+    return maxProbes.load (std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<uint64_t> sampleCount { 0 };
+  std::atomic<uint64_t> probeCount { 0 };
+  std::atomic<uint64_t> maxProbes { 0 };
+};
+
+struct ContendedBucket
+{
+  std::size_t bucketIndex;
+  uint64_t waitCount;
+  uint64_t waitMicroseconds;
+};
+
+/// Snapshot returned by concurrent_unordered_map::get_statistics. Buckets are read one at a time, so the numbers are
+/// not an atomic view of a map that is being modified.
+struct MapStatistics
+{
+  static constexpr std::size_t chainLengthBins = 16;
+
+  std::size_t size;
+  std::size_t bucketCount;
+  std::size_t allocatedBucketCount; // buckets whose chunk has been allocated
+  double loadFactor;
+
+  uint64_t storedValues; // live values and tombstones
+  uint64_t tombstones;
+  double tombstoneRatio;
+
+  /// chainLengthHistogram[n] counts buckets holding n values (live or erased); the last bin also counts longer chains.
+  std::vector<uint64_t> chainLengthHistogram;
+  std::size_t maxChainLength;
+
+  uint64_t sampledLookups;
+  double averageProbes;
+  uint64_t maxProbes;
+
+  /// Buckets with the longest total lock wait, longest first.
+  std::vector<ContendedBucket> mostContendedBuckets;
+
+  std::string toText () const;
+  std::string toJson () const;
+};
+
+#endif
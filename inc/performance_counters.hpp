@@ -9,8 +9,6 @@
 
 #include "unordered_map_utils.hpp"
 
-using ChronoTimePoint = std::chrono::time_point<std::chrono::steady_clock>;
-
 struct MutexAquireCounters
 {
   ChronoTimePoint startTimeAquire;
@@ -19,6 +17,14 @@ struct MutexAquireCounters
   std::thread::id threadID;
 };
 
+struct CompactionCounters
+{
+  uint64_t bucketsCompacted;
+  uint64_t tombstonesRemoved;
+  uint64_t totalMicroseconds;
+  uint64_t maxMicroseconds;
+};
+
 struct Averages
 {
   uint64_t readOperationCount;
@@ -45,11 +51,15 @@ public:
     return threadAverages;
   }
 
+  static void addBucketCompaction (uint64_t tombstonesRemoved, ChronoTimePoint startTime, ChronoTimePoint endTime);
+  static CompactionCounters getCompactionCounters ();
+
 private:
   static std::atomic<uint64_t> mutexLockCount;
   static std::mutex dataMutex;
 
   static std::unordered_map<std::thread::id, Averages> threadAverages;
+  static CompactionCounters compactionCounters;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,81 @@
+#ifndef _READ_EPOCH_HPP_
+#define _READ_EPOCH_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+/// Lets readers use a published object without taking a shared lock while a writer replaces it.
+/// Readers announce themselves on a per-thread stripe of counters (no shared cache line); synchronize () waits until
+/// every reader that started before the call has left, after which the replaced object can be freed.
+class ReadEpoch
+{
+public:
+  class Guard
+  {
+  public:
+    explicit Guard (ReadEpoch &anEpoch) : epoch (&anEpoch), token (anEpoch.enter ())
+    {
+    }
+
+    Guard (Guard &&other) noexcept : epoch (other.epoch), token (other.token)
+    {
+      other.epoch = nullptr;
+    }
+
+    Guard (const Guard &) = delete;
+    Guard &operator= (const Guard &) = delete;
+    Guard &operator= (Guard &&) = delete;
+
+    ~Guard ()
+    {
+      if (epoch)
+	{
+	  epoch->exit (token);
+	}
+    }
+
+  private:
+    ReadEpoch *epoch;
+    std::size_t token;
+  };
+
+  ReadEpoch () = default;
+  ReadEpoch (const ReadEpoch &) = delete;
+  ReadEpoch &operator= (const ReadEpoch &) = delete;
+
+  std::size_t enter ();
+  void exit (std::size_t token);
+
+  /// Must not be called from inside a read section of the same epoch.
+  void synchronize ();
+
+  /// Non-blocking step of synchronize, for objects retired one at a time: advances the epoch if no reader that
+  /// entered under the previous one is left. An object unlinked before getEpoch () returned e can be freed once
+  /// getEpoch () returns e + 3 or more (the first advance may have checked its readers before the unlink). May be
+  /// called from inside a read section, where it stops advancing until the section is left.
+  bool tryAdvance ();
+
+  uint64_t
+  getEpoch () const
+  {
+    return currentEpoch.load ();
+  }
+
+private:
+  static constexpr std::size_t stripeCount = 32;
+
+  struct alignas (64) Stripe
+  {
+    std::atomic<int64_t> readers[2] = { 0, 0 };
+  };
+
+  static std::size_t getThreadStripe ();
+
+  Stripe stripes[stripeCount];
+  std::atomic<uint64_t> currentEpoch { 0 };
+  std::mutex synchronizeMutex;
+};
+
+#endif
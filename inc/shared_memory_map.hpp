@@ -0,0 +1,437 @@
+#ifndef _SHARED_MEMORY_MAP_HPP_
+#define _SHARED_MEMORY_MAP_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "fast_hash.hpp"
+#include "shared_region.hpp"
+#include "unordered_map_utils.hpp"
+
+/// A hash map laid out in a SharedRegion, so that the processes of a host map one copy of the table instead of each
+/// building its own. One process creates the table with a fixed capacity; the others open it by name. Elements are
+/// chained per bucket through offsets into the region, so every process may map it at its own address.
+///
+/// There are no process-private locks: each bucket has a version word, odd while a writer changes the bucket.
+/// Writers take it with a compare-exchange; readers do not write to the region at all, they copy what they need out
+/// of the bucket and retry if its version changed meanwhile (a seqlock). Keys and values are read and written a word
+/// at a time with relaxed atomics, so a reader racing a writer gets a torn copy that the version check throws away.
+/// Keys and values must be trivially copyable (fixed-size character arrays instead of strings), and HashFuncT must
+/// hash alike in every process. A process that dies while changing a bucket leaves it locked.
+template <class KeyT, class ValueT, class HashFuncT = default_hash<KeyT>> class shared_memory_map
+{
+  static_assert (std::is_trivially_copyable_v<KeyT> && std::is_trivially_copyable_v<ValueT>,
+		 "shared_memory_map elements are copied between processes as bytes");
+  static_assert (std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+		 "atomics shared between processes must be lock free");
+
+public:
+  /// <summary>Constructor. Creates the region aName, replacing any region of that name, with an empty table of
+  /// capacity elements. The region keeps existing when the map is destroyed; SharedRegion::remove deletes it.
+  /// </summary>
+  /// <param name="aName">"/name" for POSIX shared memory, a file path for a file-backed region</param>
+  /// <param name="capacity">How many elements the table holds at most; std::length_error past the largest bucket count
+  /// of the prime table</param>
+  /// <returns></returns>
+  shared_memory_map (const std::string &aName, std::size_t capacity)
+    : region (SharedRegion::create (aName, getRegionSize (capacity, getNextPrimeNumber (capacity))))
+  {
+    // The region is zero-filled, which is an empty table: only the header needs values.
+    header = new (region.at<Header> (0)) Header ();
+    header->keySize = sizeof (KeyT);
+    header->valueSize = sizeof (ValueT);
+    header->bucketCount = getNextPrimeNumber (capacity);
+    header->capacity = capacity;
+    header->bucketsOffset = alignToCacheLine (sizeof (Header));
+    header->entriesOffset = alignToCacheLine (header->bucketsOffset + header->bucketCount * sizeof (Bucket));
+    header->magic.store (magicNumber, std::memory_order_release); // last, so openers never see half a header
+    buckets = region.at<Bucket> (header->bucketsOffset);
+  }
+
+  /// <summary>Constructor. Maps the table another process created under aName.</summary>
+  /// <param name="aName">The name the table was created with</param>
+  /// <returns></returns>
+  explicit shared_memory_map (const std::string &aName) : region (SharedRegion::open (aName))
+  {
+    header = region.at<Header> (0);
+    if (region.size () < sizeof (Header) || header->magic.load (std::memory_order_acquire) != magicNumber
+	|| header->keySize != sizeof (KeyT) || header->valueSize != sizeof (ValueT)
+	|| region.size () < getRegionSize (header->capacity, header->bucketCount))
+      {
+	throw std::runtime_error ("shared_memory_map: " + aName + " holds no table of this type");
+      }
+    buckets = region.at<Bucket> (header->bucketsOffset);
+  }
+
+  shared_memory_map (const shared_memory_map &) = delete;
+  shared_memory_map &operator= (const shared_memory_map &) = delete;
+
+  /// <summary>Gets the number of elements in the map</summary>
+  /// <param></param>
+  /// <returns></returns>
+  std::size_t
+  size () const
+  {
+    return std::size_t (header->elementCount.load (std::memory_order_relaxed));
+  }
+
+  /// <summary>Gets the number of elements the table has room for</summary>
+  /// <param></param>
+  /// <returns></returns>
+  std::size_t
+  capacity () const
+  {
+    return std::size_t (header->capacity);
+  }
+
+  /// <summary>Gets the size of the shared region, which every process maps instead of holding a copy</summary>
+  /// <param></param>
+  /// <returns></returns>
+  std::size_t
+  region_size () const
+  {
+    return region.size ();
+  }
+
+  /// <summary>Inserts a key and a value, unless the key is already in the map. Throws std::length_error if the
+  /// table is full.</summary>
+  /// <param name="aKey">The key</param>
+  /// <param name="aValue">The value</param>
+  /// <returns>True if the pair was inserted.</returns>
+  bool
+  insert (const KeyT &aKey, const ValueT &aValue)
+  {
+    auto &aBucket = getBucket (aKey);
+    BucketWriteLock lock (aBucket);
+    if (findLocked (aBucket, aKey))
+      {
+	return false;
+      }
+
+    auto anEntry = allocateEntry ();
+    anEntry->key.store (aKey);
+    anEntry->value.store (aValue);
+    anEntry->next.store (aBucket.first.load (std::memory_order_relaxed), std::memory_order_relaxed);
+    aBucket.first.store (region.offsetOf (anEntry), std::memory_order_relaxed);
+    header->elementCount.fetch_add (1, std::memory_order_relaxed);
+    return true;
+  }
+
+  /// <summary>Replaces the value of an element in place.</summary>
+  /// <param name="aKey">The key</param>
+  /// <param name="aValue">The new value</param>
+  /// <returns>True if the key was present in the map.</returns>
+  bool
+  update (const KeyT &aKey, const ValueT &aValue)
+  {
+    auto &aBucket = getBucket (aKey);
+    BucketWriteLock lock (aBucket);
+    auto anEntry = findLocked (aBucket, aKey);
+    if (!anEntry)
+      {
+	return false;
+      }
+    anEntry->value.store (aValue);
+    return true;
+  }
+
+  /// <summary>Erases an element; its entry is reused by a later insert.</summary>
+  /// <param name="aKey">The key</param>
+  /// <returns>True if the key was present in the map.</returns>
+  bool
+  erase (const KeyT &aKey)
+  {
+    auto &aBucket = getBucket (aKey);
+    BucketWriteLock lock (aBucket);
+    for (auto link = &aBucket.first; auto offset = link->load (std::memory_order_relaxed);)
+      {
+	auto anEntry = region.at<Entry> (offset);
+	if (anEntry->key.load () == aKey)
+	  {
+	    link->store (anEntry->next.load (std::memory_order_relaxed), std::memory_order_relaxed);
+	    freeEntry (anEntry);
+	    header->elementCount.fetch_sub (1, std::memory_order_relaxed);
+	    return true;
+	  }
+	link = &anEntry->next;
+      }
+    return false;
+  }
+
+  /// <summary>Copies the value of an element. Does not write to the region.</summary>
+  /// <param name="aKey">The key</param>
+  /// <returns>The value, or std::nullopt if the key is not found.</returns>
+  std::optional<ValueT>
+  get (const KeyT &aKey) const
+  {
+    std::optional<ValueT> result;
+    cvisit (aKey, [&result] (const ValueT &aValue) { result = aValue; });
+    return result;
+  }
+
+  /// <summary>Checks whether the map holds an element with the key. Does not write to the region.</summary>
+  /// <param name="aKey">The key</param>
+  /// <returns></returns>
+  bool
+  contains (const KeyT &aKey) const
+  {
+    return cvisit (aKey, [] (const ValueT &) {});
+  }
+
+  /// <summary>Runs a callback on a copy of the value of an element. The copy is taken without a lock and repeated
+  /// until no writer changed the bucket meanwhile, so the visitor is called once, with a consistent value.</summary>
+  /// <param name="aKey">The key</param>
+  /// <param name="visitor">Called as visitor (const ValueT &amp;)</param>
+  /// <returns>True if the key was found.</returns>
+  template <class VisitorT>
+  bool
+  cvisit (const KeyT &aKey, VisitorT &&visitor) const
+  {
+    const auto &aBucket = getBucket (aKey);
+    for (int attempt = 0;; ++attempt)
+      {
+	auto version = aBucket.version.load (std::memory_order_acquire);
+	if (!(version & 1))
+	  {
+	    std::optional<ValueT> value;
+	    // An erased entry may be reused by another bucket while we walk, so bound the walk; the version check
+	    // below catches that case.
+	    auto offset = aBucket.first.load (std::memory_order_relaxed);
+	    for (std::size_t steps = 0; offset && steps <= header->capacity; ++steps)
+	      {
+		auto anEntry = region.at<const Entry> (offset);
+		if (anEntry->key.load () == aKey)
+		  {
+		    value = anEntry->value.load ();
+		    break;
+		  }
+		offset = anEntry->next.load (std::memory_order_relaxed);
+	      }
+
+	    std::atomic_thread_fence (std::memory_order_acquire);
+	    if (aBucket.version.load (std::memory_order_relaxed) == version)
+	      {
+		// Only now is the copy known to be consistent.
+		if (value)
+		  {
+		    visitor (std::as_const (*value));
+		  }
+		return value.has_value ();
+	      }
+	  }
+	backOff (attempt);
+      }
+  }
+
+private:
+  static constexpr uint64_t magicNumber = 0x53484d4150763031ull; // "SHMAPv01"
+  static constexpr int spinCount = 64;
+
+  struct Header
+  {
+    std::atomic<uint64_t> magic { 0 }; // magicNumber once the header is complete
+    uint64_t keySize;
+    uint64_t valueSize;
+    uint64_t bucketCount;
+    uint64_t capacity;
+    uint64_t bucketsOffset;
+    uint64_t entriesOffset;
+    std::atomic<uint64_t> elementCount { 0 };
+    std::atomic<uint64_t> usedEntries { 0 }; // entries handed out from the never-used tail of the entry array
+    std::atomic<uint32_t> freeListLock { 0 };
+    uint64_t freeList = 0; // offset of the first erased entry; guarded by freeListLock
+  };
+
+  struct Bucket
+  {
+    std::atomic<uint32_t> version; // odd while a writer changes the bucket
+    std::atomic<uint64_t> first;   // offset of the first entry, 0 for none
+  };
+
+  /// A key or a value, held as words that are loaded and stored with relaxed atomics: readers copy it while a writer
+  /// may be storing it.
+  template <class T> struct AtomicBytes
+  {
+    static constexpr std::size_t wordCount = (sizeof (T) + sizeof (uint64_t) - 1) / sizeof (uint64_t);
+
+    T
+    load () const
+    {
+      uint64_t copy[wordCount];
+      for (std::size_t i = 0; i < wordCount; ++i)
+	{
+	  copy[i] = std::atomic_ref<uint64_t> (const_cast<uint64_t &> (words[i])).load (std::memory_order_relaxed);
+	}
+      T result;
+      std::memcpy (&result, copy, sizeof (T));
+      return result;
+    }
+
+    void
+    store (const T &aValue)
+    {
+      uint64_t copy[wordCount] = {};
+      std::memcpy (copy, &aValue, sizeof (T));
+      for (std::size_t i = 0; i < wordCount; ++i)
+	{
+	  std::atomic_ref<uint64_t> (words[i]).store (copy[i], std::memory_order_relaxed);
+	}
+    }
+
+    uint64_t words[wordCount];
+  };
+
+  struct Entry
+  {
+    std::atomic<uint64_t> next; // offset of the next entry of the bucket (or of the free list), 0 for none
+    AtomicBytes<KeyT> key;
+    AtomicBytes<ValueT> value;
+  };
+
+  /// Makes the bucket's version odd for the lifetime of the object.
+  class BucketWriteLock
+  {
+  public:
+    explicit BucketWriteLock (Bucket &aBucket) : bucket (aBucket)
+    {
+      for (int attempt = 0;; ++attempt)
+	{
+	  auto current = bucket.version.load (std::memory_order_relaxed);
+	  if (!(current & 1)
+	      && bucket.version.compare_exchange_weak (current, current + 1, std::memory_order_acquire))
+	    {
+	      version = current + 1;
+	      break;
+	    }
+	  backOff (attempt);
+	}
+      std::atomic_thread_fence (std::memory_order_release); // readers see the odd version before any change
+    }
+
+    BucketWriteLock (const BucketWriteLock &) = delete;
+    BucketWriteLock &operator= (const BucketWriteLock &) = delete;
+
+    ~BucketWriteLock ()
+    {
+      bucket.version.store (version + 1, std::memory_order_release);
+    }
+
+  private:
+    Bucket &bucket;
+    uint32_t version;
+  };
+
+  static std::size_t
+  alignToCacheLine (std::size_t offset)
+  {
+    return (offset + 63) & ~std::size_t (63);
+  }
+
+  static std::size_t
+  getRegionSize (std::size_t capacity, std::size_t bucketCount)
+  {
+    auto entriesOffset = alignToCacheLine (alignToCacheLine (sizeof (Header)) + bucketCount * sizeof (Bucket));
+    return entriesOffset + capacity * sizeof (Entry);
+  }
+
+  static void
+  backOff (int attempt)
+  {
+    if (attempt < spinCount)
+      {
+	cpuRelax ();
+      }
+    else
+      {
+	std::this_thread::yield ();
+      }
+  }
+
+  Bucket &
+  getBucket (const KeyT &aKey) const
+  {
+    return buckets[hashFunc (aKey) % header->bucketCount];
+  }
+
+  Entry *
+  findLocked (Bucket &aBucket, const KeyT &aKey) const
+  {
+    for (auto offset = aBucket.first.load (std::memory_order_relaxed); offset;)
+      {
+	auto anEntry = region.at<Entry> (offset);
+	if (anEntry->key.load () == aKey)
+	  {
+	    return anEntry;
+	  }
+	offset = anEntry->next.load (std::memory_order_relaxed);
+      }
+    return nullptr;
+  }
+
+  // Never-used entries first, since taking one needs no lock; then the erased ones.
+  Entry *
+  allocateEntry ()
+  {
+    if (header->usedEntries.load (std::memory_order_relaxed) < header->capacity)
+      {
+	auto index = header->usedEntries.fetch_add (1, std::memory_order_relaxed);
+	if (index < header->capacity)
+	  {
+	    return region.at<Entry> (header->entriesOffset + index * sizeof (Entry));
+	  }
+      }
+
+    lockFreeList ();
+    auto offset = header->freeList;
+    if (offset)
+      {
+	header->freeList = region.at<Entry> (offset)->next.load (std::memory_order_relaxed);
+      }
+    unlockFreeList ();
+    if (!offset)
+      {
+	throw std::length_error ("shared_memory_map: the table is full");
+      }
+    return region.at<Entry> (offset);
+  }
+
+  void
+  freeEntry (Entry *anEntry)
+  {
+    lockFreeList ();
+    anEntry->next.store (header->freeList, std::memory_order_relaxed);
+    header->freeList = region.offsetOf (anEntry);
+    unlockFreeList ();
+  }
+
+  void
+  lockFreeList ()
+  {
+    for (int attempt = 0; header->freeListLock.exchange (1, std::memory_order_acquire); ++attempt)
+      {
+	backOff (attempt);
+      }
+  }
+
+  void
+  unlockFreeList ()
+  {
+    header->freeListLock.store (0, std::memory_order_release);
+  }
+
+  SharedRegion region;
+  Header *header;
+  Bucket *buckets;
+  HashFuncT hashFunc;
+};
+
+#endif
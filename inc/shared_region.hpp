@@ -0,0 +1,59 @@
+#ifndef _SHARED_REGION_HPP_
+#define _SHARED_REGION_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/// A memory region several processes map at once: a POSIX shared memory object for a name like "/name", with no other
+/// slash (shm_open, gone at reboot), a file mapped with mmap for any other name. Each process may map it at a different
+/// address, so data in it refers to other data by offset from the start of the region, never by pointer. Only on POSIX
+/// systems; elsewhere create and open throw std::runtime_error.
+class SharedRegion
+{
+public:
+  /// Creates a zero-filled region of aSize bytes, replacing any region of the same name.
+  static SharedRegion create (const std::string &aName, std::size_t aSize);
+
+  /// Maps an existing region, at its full size.
+  static SharedRegion open (const std::string &aName);
+
+  /// Removes the name; processes that have the region mapped keep it until they unmap it.
+  static void remove (const std::string &aName);
+
+  SharedRegion (SharedRegion &&other) noexcept;
+  SharedRegion (const SharedRegion &) = delete;
+  SharedRegion &operator= (const SharedRegion &) = delete;
+  SharedRegion &operator= (SharedRegion &&) = delete;
+
+  /// Unmaps the region.
+  ~SharedRegion ();
+
+  std::size_t
+  size () const
+  {
+    return regionSize;
+  }
+
+  /// The object at an offset from the start of the region.
+  template <class T>
+  T *
+  at (uint64_t offset) const
+  {
+    return reinterpret_cast<T *> (base + offset);
+  }
+
+  uint64_t
+  offsetOf (const void *address) const
+  {
+    return uint64_t (static_cast<const char *> (address) - base);
+  }
+
+private:
+  SharedRegion (char *aBase, std::size_t aSize);
+
+  char *base;
+  std::size_t regionSize;
+};
+
+#endif
@@ -0,0 +1,259 @@
+#ifndef _STABLE_VECTOR_HPP_
+#define _STABLE_VECTOR_HPP_
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+/// A sequence whose elements never move once added. The first firstChunkSize elements live in one allocation; the
+/// rest in a list of chunks of doubling capacity (2 * firstChunkSize, 4 * firstChunkSize, ...). A push_back that needs
+/// room adds a chunk instead of reallocating, so a pointer to an element stays valid until the element is destroyed by
+/// clear (), move assignment or the destructor. As small as a vector; indexing walks the chunks, which is short for
+/// the few elements of a bucket.
+template <class T, std::size_t firstChunkSize = 1> class stable_vector
+{
+  static_assert (firstChunkSize > 0, "chunks must hold elements");
+  static_assert (alignof (T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "chunks are allocated with operator new");
+
+  struct Chunk
+  {
+    Chunk *next;
+  };
+
+  static constexpr std::size_t elementsOffset = (sizeof (Chunk) + alignof (T) - 1) / alignof (T) * alignof (T);
+
+  // Where an element is: the elements of its chunk, the chunk after that one, and its offset in a chunk of capacity.
+  struct Position
+  {
+    T *elements;
+    Chunk *nextChunk;
+    std::size_t offset;
+    std::size_t capacity;
+
+    void
+    toNextChunk ()
+    {
+      elements = nextChunk ? elementsOf (nextChunk) : nullptr;
+      nextChunk = nextChunk ? nextChunk->next : nullptr;
+      offset = 0;
+      capacity *= 2;
+    }
+  };
+
+public:
+  template <class ElementT> class basic_iterator
+  {
+  public:
+    explicit basic_iterator (const Position &aPosition) : position (aPosition)
+    {
+    }
+
+    ElementT &
+    operator* () const
+    {
+      return position.elements[position.offset];
+    }
+
+    ElementT *
+    operator-> () const
+    {
+      return position.elements + position.offset;
+    }
+
+    basic_iterator &
+    operator++ ()
+    {
+      if (++position.offset == position.capacity)
+	{
+	  position.toNextChunk ();
+	}
+      return *this;
+    }
+
+    bool
+    operator== (const basic_iterator &other) const
+    {
+      return position.elements == other.position.elements && position.offset == other.position.offset;
+    }
+
+  private:
+    Position position;
+  };
+
+  using iterator = basic_iterator<T>;
+  using const_iterator = basic_iterator<const T>;
+
+  stable_vector () = default;
+
+  stable_vector (stable_vector &&other) noexcept
+    : head (std::exchange (other.head, nullptr)), overflow (std::exchange (other.overflow, nullptr)),
+      count (std::exchange (other.count, 0))
+  {
+  }
+
+  stable_vector &
+  operator= (stable_vector &&other) noexcept
+  {
+    if (this != &other)
+      {
+	clear ();
+	swap (other);
+      }
+    return *this;
+  }
+
+  stable_vector (const stable_vector &) = delete;
+  stable_vector &operator= (const stable_vector &) = delete;
+
+  ~stable_vector ()
+  {
+    clear ();
+  }
+
+  std::size_t
+  size () const
+  {
+    return count;
+  }
+
+  bool
+  empty () const
+  {
+    return count == 0;
+  }
+
+  T &
+  operator[] (std::size_t index)
+  {
+    auto position = locate (index);
+    return position.elements[position.offset];
+  }
+
+  const T &
+  operator[] (std::size_t index) const
+  {
+    return const_cast<stable_vector &> (*this)[index];
+  }
+
+  void
+  push_back (const T &aValue)
+  {
+    emplace_back (aValue);
+  }
+
+  void
+  push_back (T &&aValue)
+  {
+    emplace_back (std::move (aValue));
+  }
+
+  template <class... ArgsT>
+  T &
+  emplace_back (ArgsT &&...args)
+  {
+    auto position = locate (count);
+    if (!position.elements) // the last chunk is full
+      {
+	if (!head)
+	  {
+	    head = static_cast<T *> (::operator new (firstChunkSize * sizeof (T)));
+	    position.elements = head;
+	  }
+	else
+	  {
+	    auto chunk = static_cast<Chunk *> (::operator new (elementsOffset + position.capacity * sizeof (T)));
+	    chunk->next = nullptr;
+	    auto link = &overflow;
+	    while (*link)
+	      {
+		link = &(*link)->next;
+	      }
+	    *link = chunk;
+	    position.elements = elementsOf (chunk);
+	  }
+      }
+
+    auto element = new (position.elements + position.offset) T (std::forward<ArgsT> (args)...);
+    ++count;
+    return *element;
+  }
+
+  /// Destroys the elements and frees the chunks.
+  void
+  clear ()
+  {
+    for (auto &element : *this)
+      {
+	element.~T ();
+      }
+    for (auto chunk = overflow; chunk;)
+      {
+	auto next = chunk->next;
+	::operator delete (chunk);
+	chunk = next;
+      }
+    ::operator delete (head);
+    head = nullptr;
+    overflow = nullptr;
+    count = 0;
+  }
+
+  void
+  swap (stable_vector &other) noexcept
+  {
+    std::swap (head, other.head);
+    std::swap (overflow, other.overflow);
+    std::swap (count, other.count);
+  }
+
+  iterator
+  begin ()
+  {
+    return iterator (locate (0));
+  }
+
+  iterator
+  end ()
+  {
+    return iterator (locate (count));
+  }
+
+  const_iterator
+  begin () const
+  {
+    return const_iterator (locate (0));
+  }
+
+  const_iterator
+  end () const
+  {
+    return const_iterator (locate (count));
+  }
+
+private:
+  static T *
+  elementsOf (Chunk *chunk)
+  {
+    return std::launder (reinterpret_cast<T *> (reinterpret_cast<char *> (chunk) + elementsOffset));
+  }
+
+  // For index count: the next free slot, or no elements if the last chunk is full.
+  Position
+  locate (std::size_t index) const
+  {
+    Position position { head, overflow, index, firstChunkSize };
+    while (position.elements && position.offset >= position.capacity)
+      {
+	auto offset = position.offset - position.capacity;
+	position.toNextChunk ();
+	position.offset = offset;
+      }
+    return position;
+  }
+
+  T *head = nullptr;	       // the first firstChunkSize elements
+  Chunk *overflow = nullptr; // the other chunks
+  std::size_t count = 0;
+};
+
+#endif
@@ -1,30 +1,197 @@
 #ifndef _HASH_MAP_UTILS_HPP_
 #define _HASH_MAP_UTILS_HPP_
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <type_traits>
+#include <utility>
 #include <variant>
 #include <vector>
 
-using ReadLock = std::shared_lock<std::shared_mutex>;
-using SharedReadLock = std::shared_ptr<ReadLock>;
-using WriteLock = std::unique_lock<std::shared_mutex>;
-using SharedWriteLock = std::shared_ptr<WriteLock>;
-using VariantLock = std::variant<SharedReadLock, SharedWriteLock>;
-using SharedVariantLock = std::shared_ptr<VariantLock>;
-using WeakVariantLock = std::weak_ptr<VariantLock>;
-
 enum class LockType
 {
   READ = 0,
   WRITE
 };
 
-using LockMap = std::map<std::shared_mutex *, std::tuple<WeakVariantLock, LockType>>;
+/// Value type of concurrent_unordered_set elements. Elements of this type carry no value mutex.
+struct set_value_tag
+{
+};
+
+/// How a set element holds its key: named like a std::pair for the code shared with maps, but the empty value takes no
+/// room, where a pair pads it out to the alignment of the key.
+template <class KeyT> struct set_entry
+{
+  set_entry (const KeyT &aKey, set_value_tag) : first (aKey)
+  {
+  }
+
+  set_entry (const std::pair<KeyT, set_value_tag> &aKeyValuePair) : first (aKeyValuePair.first)
+  {
+  }
+
+  KeyT first;
+  [[no_unique_address]] set_value_tag second;
+};
+
+/// The type an entry holds its key and value in: a std::pair, or the key alone for set elements.
+template <class KeyT, class ValueT> struct entry_type
+{
+  using type = std::pair<KeyT, ValueT>;
+};
+
+template <class KeyT> struct entry_type<KeyT, set_value_tag>
+{
+  using type = set_entry<KeyT>;
+};
+
+template <class KeyT, class ValueT> using entry_type_t = typename entry_type<KeyT, ValueT>::type;
+
+template <class ValueT>
+constexpr bool
+isAtomicValue ()
+{
+  if constexpr (std::is_trivially_copyable_v<ValueT> && sizeof (ValueT) <= 8)
+    {
+      return std::atomic_ref<ValueT>::is_always_lock_free
+	     && alignof (ValueT) >= std::atomic_ref<ValueT>::required_alignment;
+    }
+  else
+    {
+      return false;
+    }
+}
+
+/// Entries with small trivially copyable keys and values are stored inline in their bucket: no per-entry allocation,
+/// no value mutex, and the value is read and written with lock-free atomic_ref operations.
+template <class KeyT, class ValueT>
+inline constexpr bool is_inline_storable_v
+  = std::is_trivially_copyable_v<KeyT> && sizeof (KeyT) <= 8 && isAtomicValue<ValueT> ();
+
+/// When buckets are compacted once their live/total ratio drops below the erase threshold.
+enum class CompactionMode
+{
+  INLINE = 0, // the erasing thread compacts the bucket right away
+  DEFERRED    // the bucket is queued for compact() / the maintenance thread
+};
+
+/// Lock holder types for a mutex type chosen by the map's lock policy.
+template <class MutexT> struct lock_types
+{
+  using ReadLock = std::shared_lock<MutexT>;
+  using SharedReadLock = std::shared_ptr<ReadLock>;
+  using WriteLock = std::unique_lock<MutexT>;
+  using SharedWriteLock = std::shared_ptr<WriteLock>;
+  using VariantLock = std::variant<SharedReadLock, SharedWriteLock>;
+  using SharedVariantLock = std::shared_ptr<VariantLock>;
+  using WeakVariantLock = std::weak_ptr<VariantLock>;
+  using LockMap = std::map<MutexT *, std::tuple<WeakVariantLock, LockType>>;
+};
+
+using ChronoTimePoint = std::chrono::time_point<std::chrono::steady_clock>;
+
+/// Bounds how long a try_ operation may wait for contended bucket and value locks:
+/// either until a deadline or for a number of failed lock attempts (shared by all locks of the operation).
+class LockWaitBudget
+{
+public:
+  LockWaitBudget (ChronoTimePoint aDeadline) : deadline (aDeadline), spinsLeft (UINT64_MAX)
+  {
+  }
+
+  template <class Rep, class Period>
+  LockWaitBudget (std::chrono::duration<Rep, Period> timeout)
+    : LockWaitBudget (ChronoTimePoint (std::chrono::steady_clock::now () + timeout))
+  {
+  }
+
+  static LockWaitBudget
+  spins (uint64_t spinCount)
+  {
+    LockWaitBudget budget (ChronoTimePoint::max ());
+    budget.spinsLeft = spinCount;
+    return budget;
+  }
+
+  /// Accounts for one failed lock attempt. Returns false once the budget is spent.
+  bool
+  consume ()
+  {
+    if (spinsLeft == 0)
+      {
+	return false;
+      }
+    --spinsLeft;
+    return deadline == ChronoTimePoint::max () || std::chrono::steady_clock::now () < deadline;
+  }
+
+private:
+  ChronoTimePoint deadline;
+  uint64_t spinsLeft;
+};
+
+/// Makes every lock taken by the current thread honor the budget until the scope ends.
+class WaitBudgetScope
+{
+public:
+  explicit WaitBudgetScope (LockWaitBudget &budget) : previous (current ())
+  {
+    current () = &budget;
+  }
+
+  ~WaitBudgetScope ()
+  {
+    current () = previous;
+  }
+
+  static LockWaitBudget *&
+  current ()
+  {
+    static thread_local LockWaitBudget *activeBudget = nullptr;
+    return activeBudget;
+  }
+
+private:
+  LockWaitBudget *previous;
+};
+
+/// Thrown when a lock cannot be acquired within the active LockWaitBudget; try_ operations turn it into std::nullopt.
+class LockWouldBlock : public std::exception
+{
+public:
+  explicit LockWouldBlock (const void *aMutexAddress) : mutexAddress (aMutexAddress)
+  {
+  }
+
+  const char *
+  what () const noexcept override
+  {
+    return "lock would block";
+  }
+
+  const void *mutexAddress;
+};
+
+static inline void
+cpuRelax ()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause ();
+#else
+  std::this_thread::yield ();
+#endif
+}
 
 static uint64_t
 getNextPrimeNumber (const uint64_t &currentNumber)
@@ -33,16 +200,13 @@ getNextPrimeNumber (const uint64_t &currentNumber)
 					      5471,	10949,	   21911,     43853,	 87719,	    175447,   350899,
 					      701819,	1403641,   2807303,   5614657,	 11229331,  22458671, 44917381,
 					      89834777, 179669557, 359339171, 718678369, 1437356741 };
-  auto findResult = std::lower_bound (primeNumbers.begin (), primeNumbers.end (), currentNumber);
-
-  if (*findResult == currentNumber)
+  // The first prime above currentNumber; there is none in the table past its last entry.
+  auto findResult = std::upper_bound (primeNumbers.begin (), primeNumbers.end (), currentNumber);
+  if (findResult == primeNumbers.end ())
     {
-      ++findResult;
+      throw std::length_error ("no bucket count above " + std::to_string (currentNumber));
     }
-
   return *findResult;
-
-  return 1437356741;
 }
 
 #endif
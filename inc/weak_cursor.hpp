@@ -0,0 +1,80 @@
+#ifndef _WEAK_CURSOR_HPP_
+#define _WEAK_CURSOR_HPP_
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "concurrent_unordered_map.hpp"
+#include "read_epoch.hpp"
+
+/// Walks a concurrent_unordered_map without holding any lock between two calls to next (), like the weakly
+/// consistent iterators of Java's ConcurrentHashMap. Each bucket's live entries are copied out under a short bucket
+/// read lock; the bucket table is pinned by a read epoch instead of a lock, so a rehash / shrink running meanwhile
+/// leaves the cursor on the table it started with. Every key present for the whole walk is returned exactly once; a
+/// key inserted or erased meanwhile may or may not be, and a value may be older than the map's current one.
+/// Not thread safe; rehash () and shrink_to_fit () must not be called by the thread owning a cursor.
+template <class KeyT, class ValueT, class HashFuncT = default_hash<KeyT>, class LockPolicyT = shared_mutex_policy>
+class weak_cursor
+{
+  using Map = concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>;
+  using BucketTable = typename Map::BucketTable;
+
+public:
+  /// <summary>Constructor. Pins the map's current bucket table.</summary>
+  /// <param name="aMap">The map walked; must outlive the cursor</param>
+  /// <returns></returns>
+  explicit weak_cursor (const Map &aMap)
+    : epochGuard (aMap.readEpoch), table (aMap.table.load ()), nextBucketIndex (0), entryIndex (0)
+  {
+  }
+
+  weak_cursor (weak_cursor &&) = default;
+  weak_cursor (const weak_cursor &) = delete;
+  weak_cursor &operator= (const weak_cursor &) = delete;
+
+  /// <summary>Moves to the next element.</summary>
+  /// <param></param>
+  /// <returns>A copy of the element, valid until the next call; nullptr once every bucket was walked.</returns>
+  const std::pair<KeyT, ValueT> *
+  next ()
+  {
+    while (entryIndex == entries.size ())
+      {
+	if (nextBucketIndex == table->size ())
+	  {
+	    return nullptr;
+	  }
+	copyBucket (nextBucketIndex++);
+      }
+    return &entries[entryIndex++];
+  }
+
+private:
+  void
+  copyBucket (std::size_t bucketIndex)
+  {
+    entries.clear ();
+    entryIndex = 0;
+
+    auto aBucket = table->find (bucketIndex);
+    if (!aBucket)
+      {
+	return;
+      }
+
+    // The caller may hold iterators between two calls, so the locks go through the lock maps if it does.
+    bool throughLockMaps = !Map::getBucketLockMap ().empty () || !Map::getValueLockMap ().empty ();
+    auto copyEntry = [this] (const KeyT &aKey, const ValueT &aValue) { entries.emplace_back (aKey, aValue); };
+    aBucket->cvisitEntries (copyEntry, throughLockMaps);
+  }
+
+  ReadEpoch::Guard epochGuard; // keeps a replaced table alive until the cursor is gone
+  const BucketTable *table;
+  std::size_t nextBucketIndex;
+
+  std::vector<std::pair<KeyT, ValueT>> entries; // the current bucket's copy
+  std::size_t entryIndex;
+};
+
+#endif
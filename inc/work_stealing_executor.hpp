@@ -0,0 +1,84 @@
+#ifndef _WORK_STEALING_EXECUTOR_HPP_
+#define _WORK_STEALING_EXECUTOR_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// A fixed pool of threads for map-wide operations (erase_if, for_each, ...). A call splits an index range into
+/// tasks: every participant works from its own deque and steals the largest pending range of another participant when
+/// it runs dry. Ranges are split lazily, only while the participant's deque is empty, so the task size adapts to how
+/// many threads actually help.
+class WorkStealingExecutor
+{
+public:
+  /// Starts workerCount threads; the thread calling parallelFor always participates as well.
+  explicit WorkStealingExecutor (unsigned workerCount = std::max (1u, std::thread::hardware_concurrency ()) - 1);
+  ~WorkStealingExecutor ();
+
+  WorkStealingExecutor (const WorkStealingExecutor &) = delete;
+  WorkStealingExecutor &operator= (const WorkStealingExecutor &) = delete;
+
+  /// Calls rangeFn (begin, end) on disjoint subranges covering [first, last), at most grain indexes per call, and
+  /// returns once all of them are done. At most maxConcurrency threads work on it, the calling one included (0: no
+  /// limit besides the pool size). The first exception thrown by rangeFn is rethrown here.
+  void parallelFor (std::size_t first, std::size_t last, unsigned maxConcurrency, std::size_t grain,
+		    const std::function<void (std::size_t, std::size_t)> &rangeFn);
+
+  unsigned
+  getWorkerCount () const
+  {
+    return unsigned (workers.size ());
+  }
+
+  /// The executor maps use when none is given; started on first use.
+  static WorkStealingExecutor &getDefault ();
+
+private:
+  struct Range
+  {
+    std::size_t begin;
+    std::size_t end;
+  };
+
+  struct Participant
+  {
+    std::mutex dequeMutex;
+    std::deque<Range> ranges; // the owner pushes and pops at the back, thieves steal from the front
+  };
+
+  struct Job
+  {
+    const std::function<void (std::size_t, std::size_t)> *rangeFn;
+    std::size_t grain;
+    std::vector<std::unique_ptr<Participant>> participants;
+    std::atomic<unsigned> nextParticipant { 1 }; // 0 is the calling thread
+    std::atomic<std::size_t> remaining;		 // indexes not processed yet
+    std::atomic<unsigned> activeWorkers { 0 };
+
+    std::atomic<bool> hasFailed { false }; // the remaining ranges are skipped
+    std::mutex exceptionMutex;
+    std::exception_ptr exception;
+  };
+
+  void workerLoop ();
+  void participate (Job &job, unsigned participantIndex);
+  bool takeRange (Job &job, unsigned participantIndex, Range &range);
+  void runRange (Job &job, Participant &self, Range range);
+
+  std::vector<std::thread> workers;
+  std::mutex jobsMutex;
+  std::condition_variable jobsCondition;
+  std::vector<Job *> jobs;
+  bool isStopping = false;
+};
+
+#endif
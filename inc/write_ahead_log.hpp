@@ -0,0 +1,160 @@
+#ifndef _WRITE_AHEAD_LOG_HPP_
+#define _WRITE_AHEAD_LOG_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+/// When a logged change reaches the disk.
+enum class Durability
+{
+  NONE = 0,	 // written by the commit thread but never fsynced: survives a crash of the process, not of the machine
+  PER_BATCH,	 // fsynced by the commit thread every commit interval: a crash loses at most the last interval
+  PER_OPERATION // the change returns once an fsync covered it; changes waiting meanwhile share the next fsync
+};
+
+/// Append-only log of the changes of a durable_map. A record is appended to the calling thread's stripe of buffers
+/// (memory only, so it can be done under a bucket lock); one commit thread writes all stripes to the file and fsyncs
+/// them in groups, so the writers never do I/O themselves. Records carry a global sequence number taken when they
+/// are appended and are replayed in sequence order, whatever order the stripes reached the file in.
+///
+/// Records are compact: varint payload length, payload (varint sequence, type byte, varint key length, key bytes,
+/// value bytes), 32-bit checksum of the payload. Replay stops at the first torn or corrupt record and cuts the file
+/// there.
+class WriteAheadLog
+{
+public:
+  enum class RecordType : uint8_t
+  {
+    PUT = 1,   // the key holds the value from now on (insert and update)
+    ERASE,     // the key is no longer in the map
+    CHECKPOINT // first record of a snapshot: its sequence
+  };
+
+  /// Called by replay with the records to apply, in sequence order; the value is empty for ERASE.
+  using ApplyFn = std::function<void (RecordType, std::string_view key, std::string_view value)>;
+
+  /// Writes a snapshot to a temporary file, renamed over the previous snapshot only once it is complete and on disk.
+  class SnapshotWriter
+  {
+  public:
+    /// Every change logged with a sequence of at least sequence is replayed on top of the snapshot.
+    SnapshotWriter (const std::string &aPath, uint64_t aSequence);
+    ~SnapshotWriter ();
+
+    SnapshotWriter (const SnapshotWriter &) = delete;
+    SnapshotWriter &operator= (const SnapshotWriter &) = delete;
+
+    void add (std::string_view key, std::string_view value);
+
+    /// Replaces the previous snapshot; without a call, the destructor discards the temporary file.
+    void commit ();
+
+  private:
+    std::string path;
+    uint64_t sequence;
+    std::FILE *file;
+    std::string buffer;
+  };
+
+  /// Opens the log at aPath for appending; the first record appended gets sequence firstSequence.
+  WriteAheadLog (const std::string &aPath, Durability aDurability, uint64_t firstSequence = 0,
+		 std::chrono::milliseconds aCommitInterval = std::chrono::milliseconds (5));
+
+  /// Writes and fsyncs every record left.
+  ~WriteAheadLog ();
+
+  WriteAheadLog (const WriteAheadLog &) = delete;
+  WriteAheadLog &operator= (const WriteAheadLog &) = delete;
+
+  /// Buffers a record; no I/O. Changes of the same key must be appended in the order they are applied (under the
+  /// bucket lock), since that is the order the sequence numbers are taken in.
+  void append (RecordType type, std::string_view key, std::string_view value = {});
+
+  /// With Durability::PER_OPERATION, waits until the records the calling thread appended are fsynced; returns at once
+  /// otherwise. Must not be called under a bucket lock. Throws std::runtime_error if the log could not be written.
+  void waitForCommit ();
+
+  /// Writes and fsyncs every record appended before the call, whatever the durability. Same errors as waitForCommit.
+  void commit ();
+
+  /// Commits, then moves the log file to aPath.old (replacing the previous one) and starts a new one. Called once a
+  /// snapshot made everything before the previous rotation obsolete.
+  void rotate ();
+
+  uint64_t
+  getNextSequence () const
+  {
+    return nextSequence.load ();
+  }
+
+  Durability
+  getDurability () const
+  {
+    return durability;
+  }
+
+  /// Applies the snapshot at aPath, if there is one, and returns its sequence (0 without a snapshot).
+  static uint64_t readSnapshot (const std::string &aPath, const ApplyFn &apply);
+
+  /// Applies the records of aPath.old and aPath with a sequence of at least fromSequence, in sequence order, and cuts
+  /// a torn tail off the files. Returns the sequence the next record should get.
+  static uint64_t replay (const std::string &aPath, uint64_t fromSequence, const ApplyFn &apply);
+
+  /// Flushes the file and fsyncs it; false on failure.
+  static bool syncFile (std::FILE *file);
+
+private:
+  static constexpr std::size_t stripeCount = 32;
+  static constexpr std::size_t flushThreshold = std::size_t (1) << 20; // bytes in a stripe that wake the commit thread
+
+  struct alignas (64) Stripe
+  {
+    std::mutex mutex;
+    std::string records;
+  };
+
+  static std::size_t getThreadStripe ();
+  static void encodeRecord (std::string &out, uint64_t sequence, RecordType type, std::string_view key,
+			    std::string_view value);
+
+  void commitLoop ();
+  void waitForRound (bool sync);
+  void writeStripes (bool sync);
+
+  std::string path;
+  const Durability durability;
+  const std::chrono::milliseconds commitInterval;
+
+  Stripe stripes[stripeCount];
+  std::atomic<uint64_t> nextSequence;
+
+  std::mutex fileMutex; // file, writeBuffer and hasUnsyncedWrites
+  std::FILE *file;
+  std::string writeBuffer; // swapped with a stripe's records, so both keep their capacity
+  bool hasUnsyncedWrites = false;
+  std::atomic<bool> hasFailed { false };
+
+  // A round collects the stripes, writes them and fsyncs them (unless Durability::NONE). A record appended before
+  // round r starts is on disk once round r completes.
+  std::mutex commitMutex;
+  std::condition_variable commitCondition;    // wakes the commit thread
+  std::condition_variable committedCondition; // wakes the threads waiting for a round
+  uint64_t startedRounds = 0;
+  uint64_t completedRounds = 0;
+  bool isCommitRequested = false;
+  bool isSyncRequested = false;
+  bool isStopping = false;
+  std::atomic<bool> isFlushRequested { false }; // a stripe is over flushThreshold; set without commitMutex
+  std::thread commitThread;
+};
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef _WRITE_COMBINING_BUFFER_HPP_
+#define _WRITE_COMBINING_BUFFER_HPP_
+
+#include <chrono>
+#include <optional>
+#include <vector>
+
+#include "buffered_write.hpp"
+#include "concurrent_unordered_map.hpp"
+
+/// Buffers one thread's inserts, updates and erases of a concurrent_unordered_map and applies them in batches: sorted
+/// by bucket, one bucket lock per bucket, flat-combined with the batches of other threads waiting on the same bucket.
+/// Not thread safe: every writing thread owns its buffer. Other threads see buffered writes only after a flush.
+template <class KeyT, class ValueT, class HashFuncT = default_hash<KeyT>, class LockPolicyT = shared_mutex_policy>
+class write_combining_buffer
+{
+  using Map = concurrent_unordered_map<KeyT, ValueT, HashFuncT, LockPolicyT>;
+  using Write = buffered_write<KeyT, ValueT>;
+
+public:
+  /// <summary>Constructor.</summary>
+  /// <param name="aMap">The map written to; must outlive the buffer</param>
+  /// <param name="maxOperations">Flush once this many writes are buffered</param>
+  /// <param name="maxDelay">Flush on the next write once the oldest buffered write is this old (there is no timer
+  /// thread: a buffer that is not written to keeps its writes until flush ())</param>
+  /// <returns></returns>
+  explicit write_combining_buffer (Map &aMap, std::size_t maxOperations = 256,
+				   std::chrono::microseconds maxDelay = std::chrono::microseconds (1000))
+    : map (aMap), maxOperations (maxOperations), maxDelay (maxDelay)
+  {
+    writes.reserve (maxOperations);
+  }
+
+  write_combining_buffer (const write_combining_buffer &) = delete;
+  write_combining_buffer &operator= (const write_combining_buffer &) = delete;
+
+  /// <summary>Destructor. Flushes the buffered writes.</summary>
+  ~write_combining_buffer ()
+  {
+    flush ();
+  }
+
+  /// <summary>Buffers an insert; when flushed it behaves like concurrent_unordered_map::insert (a present key keeps
+  /// its value).</summary>
+  /// <param name="aKey">The key</param>
+  /// <param name="aValue">The value</param>
+  /// <returns></returns>
+  void
+  insert (const KeyT &aKey, const ValueT &aValue)
+  {
+    add (BufferedWriteType::INSERT, aKey, aValue);
+  }
+
+  /// <summary>Buffers an update; when flushed it behaves like concurrent_unordered_map::update (only a present key
+  /// is changed).</summary>
+  /// <param name="aKey">The key</param>
+  /// <param name="aValue">The new value</param>
+  /// <returns></returns>
+  void
+  update (const KeyT &aKey, const ValueT &aValue)
+  {
+    add (BufferedWriteType::UPDATE, aKey, aValue);
+  }
+
+  /// <summary>Buffers an erase of the key.</summary>
+  /// <param name="aKey">The key</param>
+  /// <returns></returns>
+  void
+  erase (const KeyT &aKey)
+  {
+    add (BufferedWriteType::ERASE, aKey, ValueT ());
+  }
+
+  /// <summary>Copies the value of the key as this thread will see it after a flush: the map's value with the
+  /// buffered writes of the key applied on top.</summary>
+  /// <param name="aKey">The key</param>
+  /// <returns>The value, or std::nullopt if the key is not (or will no longer be) in the map.</returns>
+  std::optional<ValueT>
+  get (const KeyT &aKey) const
+  {
+    auto result = map.get (aKey);
+    for (const auto &write : writes)
+      {
+	if (!(write.key == aKey))
+	  {
+	    continue;
+	  }
+
+	switch (write.type)
+	  {
+	  case BufferedWriteType::INSERT:
+	    if (!result)
+	      {
+		result = write.value;
+	      }
+	    break;
+	  case BufferedWriteType::UPDATE:
+	    if (result)
+	      {
+		result = write.value;
+	      }
+	    break;
+	  case BufferedWriteType::ERASE:
+	    result.reset ();
+	    break;
+	  }
+      }
+    return result;
+  }
+
+  /// <summary>Checks whether the key is in the map as seen by this thread (see get).</summary>
+  /// <param name="aKey">The key</param>
+  /// <returns></returns>
+  bool
+  contains (const KeyT &aKey) const
+  {
+    return get (aKey).has_value ();
+  }
+
+  /// <summary>Applies the buffered writes to the map. On return they are visible to every thread.</summary>
+  /// <param></param>
+  /// <returns>The number of writes flushed.</returns>
+  std::size_t
+  flush ()
+  {
+    auto flushedCount = writes.size ();
+    if (flushedCount > 0)
+      {
+	map.applyWrites (writes);
+	writes.clear ();
+      }
+    return flushedCount;
+  }
+
+  /// <summary>Gets the number of buffered writes</summary>
+  std::size_t
+  pending () const
+  {
+    return writes.size ();
+  }
+
+private:
+  void
+  add (BufferedWriteType type, const KeyT &aKey, const ValueT &aValue)
+  {
+    auto now = std::chrono::steady_clock::now ();
+    if (writes.empty ())
+      {
+	oldestWriteTime = now;
+      }
+    writes.push_back (Write { type, aKey, aValue, -1, 0 });
+
+    if (writes.size () >= maxOperations || now - oldestWriteTime >= maxDelay)
+      {
+	flush ();
+      }
+  }
+
+  Map &map;
+  std::size_t maxOperations;
+  std::chrono::microseconds maxDelay;
+  std::vector<Write> writes;
+  std::chrono::steady_clock::time_point oldestWriteTime;
+};
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef _WRITERS_GATE_HPP_
+#define _WRITERS_GATE_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+/// Keeps the writers of a map out while a migration moves its elements to a new table. Writers pass it shared
+/// (lock_shared, or std::shared_lock) on a per-thread stripe of counters, so passing costs no shared cache line while
+/// the gate is open; a migration closes it (lock, or std::unique_lock) and waits until every stripe is empty.
+///
+/// A thread that already holds a pass gets another even while the gate is closed: a migration waits for the writers
+/// inside the gate, so making one of them wait for the migration would deadlock. A pass must be released by the
+/// thread that took it, and the thread that closes the gate must not hold one.
+class WritersGate
+{
+public:
+  WritersGate () = default;
+  WritersGate (const WritersGate &) = delete;
+  WritersGate &operator= (const WritersGate &) = delete;
+
+  /// Takes a pass; waits while the gate is closed, unless the calling thread already holds one.
+  void lock_shared ();
+  bool try_lock_shared ();
+  void unlock_shared ();
+
+  /// Closes the gate and waits until the passes taken before are released.
+  void lock ();
+  bool try_lock ();
+  void unlock ();
+
+private:
+  static constexpr std::size_t stripeCount = 32;
+
+  struct alignas (64) Stripe
+  {
+    std::atomic<int64_t> writers { 0 };
+  };
+
+  static std::size_t getThreadStripe ();
+
+  // Announces a writer on the calling thread's stripe; false, with nothing announced, if the gate is closed to it.
+  bool tryEnter ();
+  bool isHeldByThisThread () const;
+
+  Stripe stripes[stripeCount];
+  std::atomic<bool> isClosed { false };
+  std::mutex closeMutex; // held from lock () to unlock (), so migrations close the gate one at a time
+  std::mutex openMutex;
+  std::condition_variable openCondition;
+};
+
+#endif
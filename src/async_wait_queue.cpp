@@ -0,0 +1,139 @@
+#include "async_wait_queue.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <thread>
+
+namespace
+{
+/// One thread resuming the handles scheduled on it, in order.
+class ResumerThread : public AsyncScheduler
+{
+public:
+  ResumerThread () : thread ([this] () { resumeLoop (); })
+  {
+  }
+
+  ~ResumerThread () override
+  {
+    {
+      std::unique_lock<std::mutex> lock (queueMutex);
+      isStopping = true;
+    }
+    queueCondition.notify_one ();
+    thread.join ();
+  }
+
+  void
+  schedule (std::coroutine_handle<> handle) override
+  {
+    {
+      std::unique_lock<std::mutex> lock (queueMutex);
+      readyQueue.push_back (handle);
+    }
+    queueCondition.notify_one ();
+  }
+
+private:
+  void
+  resumeLoop ()
+  {
+    std::unique_lock<std::mutex> lock (queueMutex);
+    while (true)
+      {
+	queueCondition.wait (lock, [this] () { return !readyQueue.empty () || isStopping; });
+	if (readyQueue.empty ())
+	  {
+	    return;
+	  }
+	auto handle = readyQueue.front ();
+	readyQueue.pop_front ();
+
+	lock.unlock ();
+	handle.resume ();
+	lock.lock ();
+      }
+  }
+
+  std::mutex queueMutex;
+  std::condition_variable queueCondition;
+  std::deque<std::coroutine_handle<>> readyQueue;
+  bool isStopping = false;
+  std::thread thread;
+};
+} // namespace
+
+std::atomic<uint64_t> AsyncWaitQueue::waiterCount = 0;
+AsyncWaitQueue::Shard AsyncWaitQueue::shards[AsyncWaitQueue::shardCount];
+
+AsyncWaitQueue::Shard &
+AsyncWaitQueue::getShard (const void *mutexAddress)
+{
+  return shards[std::hash<const void *> () (mutexAddress) % shardCount];
+}
+
+void
+AsyncWaitQueue::enqueue (const void *mutexAddress, std::coroutine_handle<> handle, AsyncScheduler *scheduler)
+{
+  auto &shard = getShard (mutexAddress);
+  std::unique_lock<std::mutex> lock (shard.shardMutex);
+  shard.waiters.push_back (Waiter { mutexAddress, handle, scheduler });
+  ++waiterCount;
+}
+
+bool
+AsyncWaitQueue::cancel (const void *mutexAddress, std::coroutine_handle<> handle)
+{
+  auto &shard = getShard (mutexAddress);
+  std::unique_lock<std::mutex> lock (shard.shardMutex);
+  auto it = std::find_if (shard.waiters.begin (), shard.waiters.end (), [&] (const Waiter &waiter) {
+    return waiter.mutexAddress == mutexAddress && waiter.handle == handle;
+  });
+
+  if (it == shard.waiters.end ())
+    {
+      return false;
+    }
+
+  shard.waiters.erase (it);
+  --waiterCount;
+  return true;
+}
+
+void
+AsyncWaitQueue::notify (const void *mutexAddress)
+{
+  // Pairs with the fence a waiter issues between enqueue() and its retry of the lock:
+  // either the waiter sees the mutex released or we see the waiter.
+  std::atomic_thread_fence (std::memory_order_seq_cst);
+  if (waiterCount == 0)
+    {
+      return;
+    }
+
+  std::vector<Waiter> ready;
+  {
+    auto &shard = getShard (mutexAddress);
+    std::unique_lock<std::mutex> lock (shard.shardMutex);
+    auto it = std::stable_partition (shard.waiters.begin (), shard.waiters.end (),
+				     [mutexAddress] (const Waiter &waiter) { return waiter.mutexAddress != mutexAddress; });
+    ready.assign (it, shard.waiters.end ());
+    shard.waiters.erase (it, shard.waiters.end ());
+    waiterCount -= ready.size ();
+  }
+
+  for (auto &waiter : ready)
+    {
+      auto scheduler = waiter.scheduler ? waiter.scheduler : &getDefaultScheduler ();
+      scheduler->schedule (waiter.handle);
+    }
+}
+
+AsyncScheduler &
+AsyncWaitQueue::getDefaultScheduler ()
+{
+  static ResumerThread resumer;
+  return resumer;
+}
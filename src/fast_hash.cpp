@@ -0,0 +1,142 @@
+#include "fast_hash.hpp"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define FAST_HASH_HAS_AVX2
+#include <immintrin.h>
+#endif
+
+namespace
+{
+constexpr std::size_t laneCount = 4;
+constexpr std::size_t stripeLength = laneCount * sizeof (uint64_t);
+constexpr std::size_t stripesPerScramble = 8;
+constexpr uint64_t scramblePrime = 0x9e3779b1u;
+
+uint64_t
+read64 (const unsigned char *bytes)
+{
+  uint64_t value;
+  std::memcpy (&value, bytes, sizeof (value));
+  return value;
+}
+
+// Each lane adds the product of the low and high halves of its (data ^ secret) word, plus the neighbouring lane's
+// data word, so that a zero product does not drop the input.
+void
+accumulateScalar (uint64_t *acc, const unsigned char *stripe)
+{
+  uint64_t data[laneCount];
+  for (std::size_t i = 0; i < laneCount; ++i)
+    {
+      data[i] = read64 (stripe + i * sizeof (uint64_t));
+    }
+  for (std::size_t i = 0; i < laneCount; ++i)
+    {
+      auto keyed = data[i] ^ ByteHash::secret[i];
+      acc[i] += (keyed & 0xffffffffu) * (keyed >> 32) + data[i ^ 1];
+    }
+}
+
+void
+scrambleScalar (uint64_t *acc)
+{
+  for (std::size_t i = 0; i < laneCount; ++i)
+    {
+      acc[i] = (acc[i] ^ (acc[i] >> 47) ^ ByteHash::secret[laneCount + i]) * scramblePrime;
+    }
+}
+
+void
+accumulateStripesScalar (uint64_t *acc, const unsigned char *bytes, std::size_t stripeCount)
+{
+  for (std::size_t stripe = 0; stripe < stripeCount; ++stripe)
+    {
+      accumulateScalar (acc, bytes + stripe * stripeLength);
+      if ((stripe + 1) % stripesPerScramble == 0)
+	{
+	  scrambleScalar (acc);
+	}
+    }
+}
+
+#ifdef FAST_HASH_HAS_AVX2
+// Same computation as accumulateStripesScalar, one stripe per instruction sequence.
+__attribute__ ((target ("avx2"))) void
+accumulateStripesAvx2 (uint64_t *acc, const unsigned char *bytes, std::size_t stripeCount)
+{
+  auto accumulator = _mm256_loadu_si256 (reinterpret_cast<const __m256i *> (acc));
+  const auto keys = _mm256_loadu_si256 (reinterpret_cast<const __m256i *> (ByteHash::secret));
+  const auto scrambleKeys = _mm256_loadu_si256 (reinterpret_cast<const __m256i *> (ByteHash::secret + laneCount));
+  const auto prime = _mm256_set1_epi64x (int64_t (scramblePrime));
+
+  for (std::size_t stripe = 0; stripe < stripeCount; ++stripe)
+    {
+      auto data = _mm256_loadu_si256 (reinterpret_cast<const __m256i *> (bytes + stripe * stripeLength));
+      auto keyed = _mm256_xor_si256 (data, keys);
+      auto product = _mm256_mul_epu32 (keyed, _mm256_srli_epi64 (keyed, 32));
+      auto swapped = _mm256_shuffle_epi32 (data, _MM_SHUFFLE (1, 0, 3, 2)); // lane i gets lane i ^ 1
+      accumulator = _mm256_add_epi64 (accumulator, _mm256_add_epi64 (product, swapped));
+
+      if ((stripe + 1) % stripesPerScramble == 0)
+	{
+	  auto mixed = _mm256_xor_si256 (accumulator, _mm256_srli_epi64 (accumulator, 47));
+	  mixed = _mm256_xor_si256 (mixed, scrambleKeys);
+	  // 64 x 32 bit multiply from two 32 x 32 -> 64 bit ones.
+	  auto low = _mm256_mul_epu32 (mixed, prime);
+	  auto high = _mm256_mul_epu32 (_mm256_srli_epi64 (mixed, 32), prime);
+	  accumulator = _mm256_add_epi64 (low, _mm256_slli_epi64 (high, 32));
+	}
+    }
+  _mm256_storeu_si256 (reinterpret_cast<__m256i *> (acc), accumulator);
+}
+#endif
+
+using AccumulateStripesFn = void (*) (uint64_t *, const unsigned char *, std::size_t);
+
+AccumulateStripesFn
+selectAccumulateStripes ()
+{
+#ifdef FAST_HASH_HAS_AVX2
+  __builtin_cpu_init (); // may run before the constructors that initialize the CPU model
+  if (__builtin_cpu_supports ("avx2"))
+    {
+      return accumulateStripesAvx2;
+    }
+#endif
+  return accumulateStripesScalar;
+}
+
+// A function-local static, so that hashing from another translation unit's static initialization works too.
+AccumulateStripesFn
+getAccumulateStripes ()
+{
+  static const auto accumulateStripes = selectAccumulateStripes ();
+  return accumulateStripes;
+}
+} // namespace
+
+bool
+ByteHash::usesAvx2 ()
+{
+#ifdef FAST_HASH_HAS_AVX2
+  return getAccumulateStripes () == accumulateStripesAvx2;
+#else
+  return false;
+#endif
+}
+
+uint64_t
+ByteHash::hashLong (const unsigned char *bytes, std::size_t length, uint64_t state)
+{
+  uint64_t acc[laneCount] = { state ^ secret[2], state ^ secret[3], state ^ secret[4], state ^ secret[5] };
+
+  // Every full stripe but the last one; the last stripe-length bytes are accumulated separately, overlapping.
+  auto stripeCount = (length - 1) / stripeLength;
+  getAccumulateStripes () (acc, bytes, stripeCount);
+  accumulateScalar (acc, bytes + length - stripeLength);
+
+  auto result = length * secret[6];
+  result += multiplyFold (acc[0] ^ secret[1], acc[1] ^ secret[6]);
+  result += multiplyFold (acc[2] ^ secret[7], acc[3] ^ secret[0]);
+  return result ^ (result >> 29);
+}
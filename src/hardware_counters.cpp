@@ -0,0 +1,261 @@
+#include "hardware_counters.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+const char *const eventNames[hardwareEventCount]
+    = { "cycles", "instructions", "L1D misses", "LLC misses", "dTLB misses", "branch misses" };
+
+std::mutex reasonMutex;
+std::string unavailableReason;
+
+void
+recordUnavailable (const std::string &aReason)
+{
+  std::unique_lock<std::mutex> lock (reasonMutex);
+  if (unavailableReason.empty ())
+    {
+      unavailableReason = aReason;
+    }
+}
+
+#ifdef __linux__
+uint64_t
+getCacheConfig (uint64_t aCache)
+{
+  return aCache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+void
+setEventConfig (perf_event_attr &attributes, HardwareEvent anEvent)
+{
+  switch (anEvent)
+    {
+    case HardwareEvent::CYCLES:
+      attributes.type = PERF_TYPE_HARDWARE;
+      attributes.config = PERF_COUNT_HW_CPU_CYCLES;
+      break;
+    case HardwareEvent::INSTRUCTIONS:
+      attributes.type = PERF_TYPE_HARDWARE;
+      attributes.config = PERF_COUNT_HW_INSTRUCTIONS;
+      break;
+    case HardwareEvent::L1D_MISSES:
+      attributes.type = PERF_TYPE_HW_CACHE;
+      attributes.config = getCacheConfig (PERF_COUNT_HW_CACHE_L1D);
+      break;
+    case HardwareEvent::LLC_MISSES:
+      attributes.type = PERF_TYPE_HARDWARE;
+      attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+      break;
+    case HardwareEvent::DTLB_MISSES:
+      attributes.type = PERF_TYPE_HW_CACHE;
+      attributes.config = getCacheConfig (PERF_COUNT_HW_CACHE_DTLB);
+      break;
+    case HardwareEvent::BRANCH_MISSES:
+      attributes.type = PERF_TYPE_HARDWARE;
+      attributes.config = PERF_COUNT_HW_BRANCH_MISSES;
+      break;
+    }
+}
+#endif
+} // namespace
+
+bool
+HardwareCounterValues::isAvailable () const
+{
+  return std::find (available.begin (), available.end (), true) != available.end ();
+}
+
+HardwareCounterValues &
+HardwareCounterValues::operator+= (const HardwareCounterValues &other)
+{
+  for (std::size_t i = 0; i < hardwareEventCount; ++i)
+    {
+      counts[i] += other.counts[i];
+      available[i] = available[i] || other.available[i];
+    }
+  return *this;
+}
+
+std::string
+HardwareCounterValues::toText (uint64_t operationCount) const
+{
+  std::ostringstream out;
+  for (std::size_t i = 0; i < hardwareEventCount; ++i)
+    {
+      out << (i > 0 ? ", " : "") << eventNames[i] << " ";
+      if (!available[i])
+	{
+	  out << "n/a";
+	  continue;
+	}
+
+      out << counts[i];
+      if (operationCount > 0)
+	{
+	  out << " (" << double (counts[i]) / double (operationCount) << "/op)";
+	}
+    }
+
+  auto cycles = get (HardwareEvent::CYCLES);
+  if (available[std::size_t (HardwareEvent::INSTRUCTIONS)] && available[std::size_t (HardwareEvent::CYCLES)]
+      && cycles > 0)
+    {
+      out << ", IPC " << double (get (HardwareEvent::INSTRUCTIONS)) / double (cycles);
+    }
+  return out.str ();
+}
+
+HardwareCounterGroup::HardwareCounterGroup ()
+{
+  eventFds.fill (-1);
+
+#ifdef __linux__
+  for (std::size_t i = 0; i < hardwareEventCount; ++i)
+    {
+      perf_event_attr attributes;
+      std::memset (&attributes, 0, sizeof (attributes));
+      attributes.size = sizeof (attributes);
+      setEventConfig (attributes, HardwareEvent (i));
+      attributes.disabled = leaderFd == -1 ? 1 : 0; // members follow the leader
+      attributes.exclude_kernel = 1;
+      attributes.exclude_hv = 1;
+      attributes.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+      int fd = int (syscall (SYS_perf_event_open, &attributes, 0, -1, leaderFd, 0));
+      if (fd == -1)
+	{
+	  recordUnavailable (std::string (eventNames[i]) + ": " + std::strerror (errno));
+	  continue;
+	}
+
+      eventFds[i] = fd;
+      if (leaderFd == -1)
+	{
+	  leaderFd = fd;
+	}
+    }
+#else
+  recordUnavailable ("perf_event_open is only available on Linux");
+#endif
+}
+
+HardwareCounterGroup::~HardwareCounterGroup ()
+{
+#ifdef __linux__
+  for (auto fd : eventFds)
+    {
+      if (fd != -1)
+	{
+	  close (fd);
+	}
+    }
+#endif
+}
+
+void
+HardwareCounterGroup::start ()
+{
+#ifdef __linux__
+  if (isAvailable ())
+    {
+      ioctl (leaderFd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl (leaderFd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+}
+
+HardwareCounterValues
+HardwareCounterGroup::stop ()
+{
+  HardwareCounterValues result;
+
+#ifdef __linux__
+  if (!isAvailable ())
+    {
+      return result;
+    }
+
+  ioctl (leaderFd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+  // Layout of a PERF_FORMAT_GROUP read: nr, time_enabled, time_running, then one value per member in opening order.
+  uint64_t buffer[3 + hardwareEventCount] = {};
+  if (read (leaderFd, buffer, sizeof (buffer)) < ssize_t (3 * sizeof (uint64_t)))
+    {
+      recordUnavailable (std::string ("read: ") + std::strerror (errno));
+      return result;
+    }
+
+  auto timeEnabled = buffer[1];
+  auto timeRunning = buffer[2];
+  double scale = timeRunning > 0 && timeRunning < timeEnabled ? double (timeEnabled) / double (timeRunning) : 1.0;
+
+  std::size_t member = 0;
+  for (std::size_t i = 0; i < hardwareEventCount && member < buffer[0]; ++i)
+    {
+      if (eventFds[i] != -1)
+	{
+	  result.counts[i] = uint64_t (double (buffer[3 + member++]) * scale);
+	  result.available[i] = timeRunning > 0;
+	}
+    }
+#endif
+
+  return result;
+}
+
+std::string
+HardwareCounterGroup::getUnavailableReason ()
+{
+  std::unique_lock<std::mutex> lock (reasonMutex);
+  return unavailableReason;
+}
+
+void
+PhaseCounters::add (int threadIndex, const HardwareCounterValues &someValues)
+{
+  std::unique_lock<std::mutex> lock (valuesMutex);
+  threadValues.emplace_back (threadIndex, someValues);
+}
+
+std::string
+PhaseCounters::toText (const std::string &title, uint64_t operationCount) const
+{
+  std::unique_lock<std::mutex> lock (valuesMutex);
+  std::ostringstream out;
+
+  HardwareCounterValues total;
+  for (auto &threadValue : threadValues)
+    {
+      total += threadValue.second;
+    }
+
+  if (!total.isAvailable ())
+    {
+      out << title << " Counters: unavailable (" << HardwareCounterGroup::getUnavailableReason () << ")\n";
+      return out.str ();
+    }
+
+  auto sortedValues = threadValues;
+  std::sort (sortedValues.begin (), sortedValues.end (),
+	     [] (const auto &left, const auto &right) { return left.first < right.first; });
+
+  out << title << " Counters:\n";
+  for (auto &threadValue : sortedValues)
+    {
+      out << "-- Thread " << threadValue.first << ": " << threadValue.second.toText () << "\n";
+    }
+  out << "-- Total: " << total.toText (operationCount) << "\n";
+  return out.str ();
+}
@@ -0,0 +1,97 @@
+#include "latency_histogram.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <iomanip>
+#include <sstream>
+
+LatencyHistogram::LatencyHistogram () : counts (getIndex (UINT64_MAX) + 1)
+{
+}
+
+std::size_t
+LatencyHistogram::getIndex (uint64_t value)
+{
+  // Values below 64 have their own bucket; above, the bucket group is the number of low bits that are dropped.
+  unsigned mostSignificantBit = value > 0 ? unsigned (std::bit_width (value)) - 1 : 0;
+  if (mostSignificantBit <= subBucketBits)
+    {
+      return std::size_t (value);
+    }
+
+  unsigned group = mostSignificantBit - subBucketBits;
+  return std::size_t (group) * (1u << subBucketBits) + std::size_t (value >> group);
+}
+
+uint64_t
+LatencyHistogram::getHighestEquivalentValue (std::size_t index)
+{
+  const std::size_t halfCount = 1u << subBucketBits;
+  if (index < 2 * halfCount)
+    {
+      return uint64_t (index);
+    }
+
+  auto group = unsigned (index / halfCount - 1);
+  auto subBucket = uint64_t (index - std::size_t (group) * halfCount);
+  return ((subBucket + 1) << group) - 1;
+}
+
+void
+LatencyHistogram::record (uint64_t nanoseconds)
+{
+  ++counts[getIndex (nanoseconds)];
+  ++count;
+  maxValue = std::max (maxValue, nanoseconds);
+}
+
+LatencyHistogram &
+LatencyHistogram::operator+= (const LatencyHistogram &other)
+{
+  for (std::size_t i = 0; i < counts.size (); ++i)
+    {
+      counts[i] += other.counts[i];
+    }
+  count += other.count;
+  maxValue = std::max (maxValue, other.maxValue);
+  return *this;
+}
+
+uint64_t
+LatencyHistogram::getPercentile (double percentile) const
+{
+  if (count == 0)
+    {
+      return 0;
+    }
+
+  auto rank = std::max (uint64_t (1), uint64_t (double (count) * std::clamp (percentile, 0.0, 100.0) / 100.0 + 0.5));
+  uint64_t seen = 0;
+  for (std::size_t i = 0; i < counts.size (); ++i)
+    {
+      seen += counts[i];
+      if (seen >= rank)
+	{
+	  return std::min (getHighestEquivalentValue (i), maxValue);
+	}
+    }
+  return maxValue;
+}
+
+std::string
+LatencyHistogram::toText () const
+{
+  std::ostringstream out;
+  out << std::fixed << std::setprecision (1);
+  auto writeValue = [&out] (const char *name, uint64_t nanoseconds) {
+    out << name << " " << double (nanoseconds) / 1000.0 << " us";
+  };
+
+  writeValue ("p50", getPercentile (50.0));
+  writeValue (", p90", getPercentile (90.0));
+  writeValue (", p99", getPercentile (99.0));
+  writeValue (", p999", getPercentile (99.9));
+  writeValue (", max", maxValue);
+  out << " (" << count << " operations)";
+  return out.str ();
+}
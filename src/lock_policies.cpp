@@ -0,0 +1,92 @@
+#include "lock_policies.hpp"
+
+#include <cstdint>
+
+alignas (64) std::atomic<const void *> VisibleReaders::slots[VisibleReaders::slotCount];
+thread_local VisibleReaders::HeldSlots VisibleReaders::heldSlots = {};
+
+std::size_t
+VisibleReaders::getSlotIndex (const void *lockAddress, std::size_t readerIndex)
+{
+  uint64_t mixed = uint64_t (reinterpret_cast<uintptr_t> (lockAddress)) * 0x9E3779B97F4A7C15ull;
+  auto firstLine = std::size_t (mixed >> 40) % lineCount;
+  auto slotInLine = std::size_t (mixed >> 58) % slotsPerLine;
+  return (firstLine + readerIndex % readersPerLock) % lineCount * slotsPerLine + slotInLine;
+}
+
+std::size_t
+VisibleReaders::getThreadReaderIndex ()
+{
+  static std::atomic<std::size_t> nextReaderIndex = 0;
+  static thread_local std::size_t threadReaderIndex = nextReaderIndex++ % readersPerLock;
+  return threadReaderIndex;
+}
+
+bool
+VisibleReaders::publish (const void *lockAddress)
+{
+  if (heldSlots.count == maxHeldPerThread)
+    {
+      return false;
+    }
+
+  // Threads beyond readersPerLock share reader indexes, so a taken slot moves the reader on to the next one.
+  auto threadReaderIndex = getThreadReaderIndex ();
+  for (std::size_t i = 0; i < readersPerLock; ++i)
+    {
+      auto slotIndex = getSlotIndex (lockAddress, threadReaderIndex + i);
+      const void *expected = nullptr;
+      if (slots[slotIndex].load (std::memory_order_relaxed) == nullptr
+	  && slots[slotIndex].compare_exchange_strong (expected, lockAddress))
+	{
+	  heldSlots.lockAddresses[heldSlots.count] = lockAddress;
+	  heldSlots.slotIndexes[heldSlots.count] = slotIndex;
+	  ++heldSlots.count;
+	  return true;
+	}
+    }
+  return false;
+}
+
+bool
+VisibleReaders::retract (const void *lockAddress)
+{
+  for (std::size_t i = heldSlots.count; i > 0; --i)
+    {
+      if (heldSlots.lockAddresses[i - 1] == lockAddress)
+	{
+	  slots[heldSlots.slotIndexes[i - 1]].store (nullptr, std::memory_order_release);
+	  --heldSlots.count;
+	  heldSlots.lockAddresses[i - 1] = heldSlots.lockAddresses[heldSlots.count];
+	  heldSlots.slotIndexes[i - 1] = heldSlots.slotIndexes[heldSlots.count];
+	  return true;
+	}
+    }
+  return false;
+}
+
+bool
+VisibleReaders::hasReaders (const void *lockAddress)
+{
+  for (std::size_t readerIndex = 0; readerIndex < readersPerLock; ++readerIndex)
+    {
+      if (slots[getSlotIndex (lockAddress, readerIndex)].load () == lockAddress)
+	{
+	  return true;
+	}
+    }
+  return false;
+}
+
+void
+VisibleReaders::waitForReaders (const void *lockAddress)
+{
+  for (std::size_t readerIndex = 0; readerIndex < readersPerLock; ++readerIndex)
+    {
+      auto &slot = slots[getSlotIndex (lockAddress, readerIndex)];
+      while (slot.load () == lockAddress)
+	{
+	  cpuRelax ();
+	}
+    }
+}
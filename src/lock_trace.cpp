@@ -0,0 +1,233 @@
+#include "lock_trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+struct TraceSlot
+{
+  std::atomic<uint64_t> timestamp { 0 };
+  std::atomic<uint64_t> mutexAddress { 0 };
+  std::atomic<uint64_t> bucketIndex { 0 };
+  std::atomic<uint32_t> kind { 0 }; // event type in the low byte, lock type in the next
+};
+
+struct TraceEvent
+{
+  uint64_t timestamp;
+  uint64_t mutexAddress;
+  uint64_t bucketIndex;
+  LockTrace::EventType type;
+  LockType lockType;
+};
+
+/// Written only by its thread. Readers copy the slots below head and then drop the ones the writer may have started
+/// overwriting meanwhile (those below writing - ringCapacity).
+struct ThreadRing
+{
+  explicit ThreadRing (int aThreadId) : threadId (aThreadId), slots (new TraceSlot[LockTrace::ringCapacity])
+  {
+  }
+
+  int threadId;
+  std::unique_ptr<TraceSlot[]> slots;
+  std::atomic<uint64_t> writing { 0 };
+  std::atomic<uint64_t> head { 0 };
+  std::atomic<uint64_t> firstKept { 0 };
+};
+
+std::mutex ringsMutex;
+std::vector<std::shared_ptr<ThreadRing>> rings; // kept after their thread exits so its events can still be written
+const ChronoTimePoint traceStart = std::chrono::steady_clock::now ();
+
+ThreadRing &
+getThreadRing ()
+{
+  static thread_local std::shared_ptr<ThreadRing> ring = [] () {
+    std::unique_lock<std::mutex> lock (ringsMutex);
+    rings.push_back (std::make_shared<ThreadRing> (int (rings.size ()) + 1));
+    return rings.back ();
+  }();
+  return *ring;
+}
+
+std::vector<std::shared_ptr<ThreadRing>>
+getRings ()
+{
+  std::unique_lock<std::mutex> lock (ringsMutex);
+  return rings;
+}
+
+std::vector<TraceEvent>
+readRing (const ThreadRing &ring)
+{
+  auto head = ring.head.load (std::memory_order_acquire);
+  auto first = std::max (ring.firstKept.load (), head > LockTrace::ringCapacity ? head - LockTrace::ringCapacity : 0);
+
+  std::vector<TraceEvent> events;
+  events.reserve (head - first);
+  for (auto i = first; i < head; ++i)
+    {
+      auto &slot = ring.slots[i % LockTrace::ringCapacity];
+      auto kind = slot.kind.load (std::memory_order_relaxed);
+      events.push_back ({ slot.timestamp.load (std::memory_order_relaxed),
+			  slot.mutexAddress.load (std::memory_order_relaxed),
+			  slot.bucketIndex.load (std::memory_order_relaxed), LockTrace::EventType (kind & 0xff),
+			  LockType (kind >> 8) });
+    }
+
+  std::atomic_thread_fence (std::memory_order_acquire);
+  auto writing = ring.writing.load (std::memory_order_relaxed);
+  if (writing > LockTrace::ringCapacity && writing - LockTrace::ringCapacity > first)
+    {
+      auto tornCount = std::min (std::size_t (writing - LockTrace::ringCapacity - first), events.size ());
+      events.erase (events.begin (), events.begin () + tornCount);
+    }
+  return events;
+}
+
+std::string
+getLockName (const TraceEvent &anEvent)
+{
+  std::ostringstream name;
+  name << (anEvent.lockType == LockType::READ ? "read " : "write ");
+  if (anEvent.bucketIndex != LockTrace::unknownBucket)
+    {
+      name << "bucket " << anEvent.bucketIndex;
+    }
+  else
+    {
+      name << "value 0x" << std::hex << anEvent.mutexAddress;
+    }
+  return name.str ();
+}
+
+void
+writeTimestamp (std::ostream &out, uint64_t nanoseconds)
+{
+  out << nanoseconds / 1000 << "." << std::setw (3) << std::setfill ('0') << nanoseconds % 1000;
+}
+} // namespace
+
+void
+LockTrace::record (EventType anEventType, const void *mutexAddress, std::size_t bucketIndex, LockType lockType)
+{
+  auto timestamp =
+    std::chrono::duration_cast<std::chrono::nanoseconds> (std::chrono::steady_clock::now () - traceStart);
+
+  auto &ring = getThreadRing ();
+  auto index = ring.head.load (std::memory_order_relaxed);
+  ring.writing.store (index + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence (std::memory_order_release);
+
+  auto &slot = ring.slots[index % ringCapacity];
+  slot.timestamp.store (uint64_t (timestamp.count ()), std::memory_order_relaxed);
+  slot.mutexAddress.store (uint64_t (reinterpret_cast<uintptr_t> (mutexAddress)), std::memory_order_relaxed);
+  slot.bucketIndex.store (uint64_t (bucketIndex), std::memory_order_relaxed);
+  slot.kind.store (uint32_t (anEventType) | uint32_t (lockType) << 8, std::memory_order_relaxed);
+  ring.head.store (index + 1, std::memory_order_release);
+}
+
+void
+LockTrace::clear ()
+{
+  for (auto &ring : getRings ())
+    {
+      ring->firstKept = ring->head.load ();
+    }
+}
+
+std::string
+LockTrace::toChromeJson ()
+{
+  std::ostringstream out;
+  out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+  bool isFirst = true;
+  auto beginEvent = [&out, &isFirst] (const char *phase, int threadId, uint64_t timestamp) -> std::ostream & {
+    out << (isFirst ? "\n" : ",\n") << "{\"ph\":\"" << phase << "\",\"pid\":1,\"tid\":" << threadId << ",\"ts\":";
+    writeTimestamp (out, timestamp);
+    isFirst = false;
+    return out;
+  };
+
+  uint64_t nextHoldId = 1;
+  for (auto &ring : getRings ())
+    {
+      beginEvent ("M", ring->threadId, 0)
+	<< ",\"name\":\"thread_name\",\"args\":{\"name\":\"thread " << ring->threadId << "\"}}";
+
+      // Requests, holds and compactions still open when the events were read are left out.
+      std::unordered_map<uint64_t, uint64_t> requestTimes;
+      std::unordered_map<uint64_t, TraceEvent> holds;
+      std::unordered_map<uint64_t, uint64_t> compactionTimes;
+
+      for (auto &event : readRing (*ring))
+	{
+	  switch (event.type)
+	    {
+	    case EventType::REQUEST:
+	      requestTimes[event.mutexAddress] = event.timestamp;
+	      break;
+
+	    case EventType::ACQUIRE:
+	      if (auto it = requestTimes.find (event.mutexAddress); it != requestTimes.end ())
+		{
+		  beginEvent ("X", ring->threadId, it->second) << ",\"dur\":";
+		  writeTimestamp (out, event.timestamp - it->second);
+		  out << ",\"cat\":\"lock\",\"name\":\"wait " << getLockName (event) << "\"}";
+		  requestTimes.erase (it);
+		}
+	      holds[event.mutexAddress] = event;
+	      break;
+
+	    case EventType::RELEASE:
+	      if (auto it = holds.find (event.mutexAddress); it != holds.end ())
+		{
+		  // Holds of one thread need not nest (iterators), so they are async spans rather than slices.
+		  auto name = getLockName (it->second);
+		  auto holdId = nextHoldId++;
+		  beginEvent ("b", ring->threadId, it->second.timestamp)
+		    << ",\"cat\":\"lock\",\"id\":" << holdId << ",\"name\":\"" << name << "\"}";
+		  beginEvent ("e", ring->threadId, event.timestamp)
+		    << ",\"cat\":\"lock\",\"id\":" << holdId << ",\"name\":\"" << name << "\"}";
+		  holds.erase (it);
+		}
+	      break;
+
+	    case EventType::COMPACTION_BEGIN:
+	      compactionTimes[event.bucketIndex] = event.timestamp;
+	      break;
+
+	    case EventType::COMPACTION_END:
+	      if (auto it = compactionTimes.find (event.bucketIndex); it != compactionTimes.end ())
+		{
+		  beginEvent ("X", ring->threadId, it->second) << ",\"dur\":";
+		  writeTimestamp (out, event.timestamp - it->second);
+		  out << ",\"cat\":\"compaction\",\"name\":\"compaction bucket " << event.bucketIndex << "\"}";
+		  compactionTimes.erase (it);
+		}
+	      break;
+	    }
+	}
+    }
+
+  out << "\n]}\n";
+  return out.str ();
+}
+
+bool
+LockTrace::writeChromeJson (const std::string &filePath)
+{
+  std::ofstream file (filePath);
+  file << toChromeJson ();
+  return bool (file);
+}
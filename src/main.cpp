@@ -1,16 +1,45 @@
-﻿#include <assert.h>
+﻿#include <algorithm>
+#include <assert.h>
+#include <atomic>
 #include <chrono>
+#include <cstring>
+#include <deque>
+#include <filesystem>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <string>
 #include <thread>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "concurrent_ordered_map.hpp"
 #include "concurrent_unordered_map.hpp"
+#include "concurrent_unordered_multimap.hpp"
+#include "concurrent_unordered_set.hpp"
+#include "durable_map.hpp"
+#include "fast_hash.hpp"
+#include "hardware_counters.hpp"
 #include "iterator.hpp"
 #include "large_object.hpp"
+#include "latency_histogram.hpp"
+#include "shared_memory_map.hpp"
+#include "weak_cursor.hpp"
+#include "write_ahead_log.hpp"
+#include "write_combining_buffer.hpp"
 
 const int oneMill = 100000;
+const double openLoopOperationsPerSecond = 100000.0; // target rate of all threads together
+const std::chrono::milliseconds openLoopPhaseDuration (1000);
 std::mutex stdMapMutex;
 
 template <typename MapT>
@@ -44,8 +73,9 @@ findInto (MapT &map, int left, int right, bool lock)
     }
 }
 
+template <typename MapT>
 void
-findIntoLock (concurrent_unordered_map<int, std::shared_ptr<int>> &map, int left, int right)
+findIntoLock (MapT &map, int left, int right)
 {
   for (auto i = left; i < right; ++i)
     {
@@ -54,16 +84,41 @@ findIntoLock (concurrent_unordered_map<int, std::shared_ptr<int>> &map, int left
     }
 }
 
+template <typename MapT>
+void
+getInto (MapT &map, int left, int right)
+{
+  for (auto i = left; i < right; ++i)
+    {
+      auto value = map.get (i);
+      assert (value.has_value ());
+    }
+}
+
+template <typename WorkT>
+std::thread
+startCountedWorker (PhaseCounters &counters, int threadIndex, WorkT work)
+{
+  return std::thread ([&counters, threadIndex, work] () {
+    HardwareCounterGroup group;
+    group.start ();
+    work ();
+    counters.add (threadIndex, group.stop ());
+  });
+}
+
 template <typename MapT>
 void
 timeInsertOperation (MapT &map, const std::string &mapType, bool lock)
 {
   std::vector<std::thread> workers;
+  PhaseCounters counters;
   auto startTimePopulate = std::chrono::steady_clock::now ();
 
   for (auto i = 0; i < int (std::thread::hardware_concurrency ()); ++i)
     {
-      workers.push_back (std::thread ([&map, i, lock] () { insertInto (map, i * oneMill, (i + 1) * oneMill, lock); }));
+      workers.push_back (
+	startCountedWorker (counters, i, [&map, i, lock] () { insertInto (map, i * oneMill, (i + 1) * oneMill, lock); }));
     }
 
   for (auto &worker : workers)
@@ -75,6 +130,7 @@ timeInsertOperation (MapT &map, const std::string &mapType, bool lock)
   std::cout << mapType << " - Insert Duration: "
 	    << std::chrono::duration_cast<std::chrono::milliseconds> (endTimePopulate - startTimePopulate).count ()
 	    << " milliseconds\n";
+  std::cout << counters.toText (mapType + " - Insert", uint64_t (workers.size ()) * oneMill);
   workers.clear ();
 }
 
@@ -83,11 +139,13 @@ void
 timeFindOperation (MapT &map, const std::string &mapType, bool lock)
 {
   std::vector<std::thread> workers;
+  PhaseCounters counters;
   auto startTime = std::chrono::steady_clock::now ();
 
   for (auto i = 0; i < int (std::thread::hardware_concurrency ()); ++i)
     {
-      workers.push_back (std::thread ([&map, i, lock] () { findInto (map, i * oneMill, (i + 1) * oneMill, lock); }));
+      workers.push_back (
+	startCountedWorker (counters, i, [&map, i, lock] () { findInto (map, i * oneMill, (i + 1) * oneMill, lock); }));
     }
 
   for (auto &worker : workers)
@@ -99,11 +157,37 @@ timeFindOperation (MapT &map, const std::string &mapType, bool lock)
   std::cout << mapType << " - Find Duration: "
 	    << std::chrono::duration_cast<std::chrono::milliseconds> (endTime - startTime).count ()
 	    << " milliseconds\n";
+  std::cout << counters.toText (mapType + " - Find", uint64_t (workers.size ()) * oneMill);
+  workers.clear ();
+}
+
+template <typename MapT>
+void
+timeGetOperation (MapT &map, const std::string &mapType)
+{
+  std::vector<std::thread> workers;
+  auto startTime = std::chrono::steady_clock::now ();
+
+  for (auto i = 0; i < int (std::thread::hardware_concurrency ()); ++i)
+    {
+      workers.push_back (std::thread ([&map, i] () { getInto (map, i * oneMill, (i + 1) * oneMill); }));
+    }
+
+  for (auto &worker : workers)
+    {
+      worker.join ();
+    }
+
+  auto endTime = std::chrono::steady_clock::now ();
+  std::cout << mapType << " - Get Duration: "
+	    << std::chrono::duration_cast<std::chrono::milliseconds> (endTime - startTime).count ()
+	    << " milliseconds\n";
   workers.clear ();
 }
 
+template <typename MapT>
 void
-timeFindLockOperation (concurrent_unordered_map<int, std::shared_ptr<int>> &map)
+timeFindLockOperation (MapT &map, const std::string &mapType)
 {
   std::vector<std::thread> workers;
   auto startTime = std::chrono::steady_clock::now ();
@@ -119,8 +203,94 @@ timeFindLockOperation (concurrent_unordered_map<int, std::shared_ptr<int>> &map)
     }
 
   auto endTime = std::chrono::steady_clock::now ();
-  std::cout << "Concurrent Map"
-	    << " - Find Lock Duration: "
+  std::cout << mapType << " - Find Lock Duration: "
+	    << std::chrono::duration_cast<std::chrono::milliseconds> (endTime - startTime).count ()
+	    << " milliseconds\n";
+  workers.clear ();
+}
+
+class LoopScheduler : public AsyncScheduler
+{
+public:
+  void
+  schedule (std::coroutine_handle<> handle) override
+  {
+    std::unique_lock<std::mutex> lock (queueMutex);
+    readyQueue.push_back (handle);
+  }
+
+  bool
+  runOne ()
+  {
+    std::coroutine_handle<> handle;
+    {
+      std::unique_lock<std::mutex> lock (queueMutex);
+      if (readyQueue.empty ())
+	{
+	  return false;
+	}
+      handle = readyQueue.front ();
+      readyQueue.pop_front ();
+    }
+    handle.resume ();
+    return true;
+  }
+
+private:
+  std::mutex queueMutex;
+  std::deque<std::coroutine_handle<>> readyQueue;
+};
+
+template <typename MapT>
+void
+asyncFindInto (MapT &map, int left, int right)
+{
+  const int batchSize = 64;
+  LoopScheduler loop;
+
+  for (auto i = left; i < right; i += batchSize)
+    {
+      std::vector<AsyncTask<std::optional<std::shared_ptr<int>>>> tasks;
+      for (auto j = i; j < std::min (i + batchSize, right); ++j)
+	{
+	  tasks.push_back (map.async_find (j, &loop));
+	  tasks.back ().start ();
+	}
+
+      for (auto &task : tasks)
+	{
+	  while (!task.isReady ())
+	    {
+	      if (!loop.runOne ())
+		{
+		  std::this_thread::yield ();
+		}
+	    }
+	  auto result = task.getResult ();
+	  assert (result.has_value ());
+	}
+    }
+}
+
+template <typename MapT>
+void
+timeAsyncFindOperation (MapT &map, const std::string &mapType)
+{
+  std::vector<std::thread> workers;
+  auto startTime = std::chrono::steady_clock::now ();
+
+  for (auto i = 0; i < int (std::thread::hardware_concurrency ()); ++i)
+    {
+      workers.push_back (std::thread ([&map, i] () { asyncFindInto (map, i * oneMill, (i + 1) * oneMill); }));
+    }
+
+  for (auto &worker : workers)
+    {
+      worker.join ();
+    }
+
+  auto endTime = std::chrono::steady_clock::now ();
+  std::cout << mapType << " - Async Find Duration: "
 	    << std::chrono::duration_cast<std::chrono::milliseconds> (endTime - startTime).count ()
 	    << " milliseconds\n";
   workers.clear ();
@@ -138,16 +308,22 @@ timeTraverseOperation (MapT &map, const std::string &mapType, bool lock)
       sharedLock = std::make_shared<std::unique_lock<std::mutex>> (stdMapMutex);
     }
 
+  PhaseCounters counters;
+  HardwareCounterGroup group;
+  group.start ();
+
   std::size_t valueCount = 0;
   for (auto it = map.begin (); it != map.end (); ++it)
     {
       ++valueCount;
     }
 
+  counters.add (0, group.stop ());
   auto endTime = std::chrono::steady_clock::now ();
   std::cout << mapType << " - Traverse Duration: "
 	    << std::chrono::duration_cast<std::chrono::milliseconds> (endTime - startTime).count ()
 	    << " milliseconds. Value count: " << valueCount << "\n";
+  std::cout << counters.toText (mapType + " - Traverse", valueCount);
 }
 
 template <typename MapT>
@@ -171,11 +347,13 @@ void
 timeEraseOperation (MapT &map, const std::string &mapType, bool lock)
 {
   std::vector<std::thread> workers;
+  PhaseCounters counters;
   auto startTime = std::chrono::steady_clock::now ();
 
   for (auto i = 0; i < int (std::thread::hardware_concurrency ()); ++i)
     {
-      workers.push_back (std::thread ([&map, i, lock] () { eraseInto (map, i * oneMill, (i + 1) * oneMill, lock); }));
+      workers.push_back (
+	startCountedWorker (counters, i, [&map, i, lock] () { eraseInto (map, i * oneMill, (i + 1) * oneMill, lock); }));
     }
 
   for (auto &worker : workers)
@@ -187,29 +365,998 @@ timeEraseOperation (MapT &map, const std::string &mapType, bool lock)
   std::cout << mapType << " - Erase Duration: "
 	    << std::chrono::duration_cast<std::chrono::milliseconds> (endTime - startTime).count ()
 	    << " milliseconds\n";
+  std::cout << counters.toText (mapType + " - Erase", uint64_t (workers.size ()) * oneMill);
   workers.clear ();
   assert (map.size () == 0);
 }
+
+template <typename MapT>
+void
+timeConstructOperation (const std::string &mapType)
+{
+  const int mapCount = 1000;
+  std::vector<std::unique_ptr<MapT>> maps;
+  auto startTime = std::chrono::steady_clock::now ();
+
+  for (auto i = 0; i < mapCount; ++i)
+    {
+      maps.push_back (std::make_unique<MapT> ());
+      maps.back ()->insert (i, std::make_shared<int> (i));
+    }
+
+  auto endTime = std::chrono::steady_clock::now ();
+  std::cout << mapType << " - Construct Duration: "
+	    << std::chrono::duration_cast<std::chrono::milliseconds> (endTime - startTime).count () << " milliseconds ("
+	    << mapCount << " maps)\n";
+}
+
+template <typename MapT>
+void
+timeShrinkOperation (MapT &map, const std::string &mapType)
+{
+  auto bucketCount = map.bucket_count ();
+  auto startTime = std::chrono::steady_clock::now ();
+  map.shrink_to_fit ();
+  auto endTime = std::chrono::steady_clock::now ();
+
+  std::cout << mapType << " - Shrink Duration: "
+	    << std::chrono::duration_cast<std::chrono::milliseconds> (endTime - startTime).count () << " milliseconds ("
+	    << bucketCount << " -> " << map.bucket_count () << " buckets)\n";
+}
+
+template <typename LockPolicyT>
+void
+timeSetOperation (const std::string &mapType)
+{
+  concurrent_unordered_set<int, std::hash<int>, LockPolicyT> set;
+  auto startTime = std::chrono::steady_clock::now ();
+
+  for (auto i = 0; i < oneMill; ++i)
+    {
+      set.insert (i);
+    }
+  for (auto i = 0; i < oneMill; ++i)
+    {
+      auto result = set.contains (i);
+      assert (result);
+    }
+
+  auto endTime = std::chrono::steady_clock::now ();
+  std::cout << mapType << " - Set Insert + Contains Duration: "
+	    << std::chrono::duration_cast<std::chrono::milliseconds> (endTime - startTime).count ()
+	    << " milliseconds\n";
+}
+
+template <typename LockPolicyT>
+void
+timeMultimapAppendOperation (const std::string &mapType)
+{
+  const int keyCount = 1000;
+  const int valuesPerKey = 100;
+
+  concurrent_unordered_multimap<int, int, std::hash<int>, LockPolicyT> multimap;
+  auto startTime = std::chrono::steady_clock::now ();
+  for (auto i = 0; i < keyCount * valuesPerKey; ++i)
+    {
+      multimap.append (i % keyCount, i);
+    }
+  auto endTime = std::chrono::steady_clock::now ();
+  assert (multimap.count (0) == valuesPerKey);
+  int expectedValue = 0;
+  for (const auto &keyValue : multimap.equal_range (0))
+    {
+      assert (keyValue.second == expectedValue); // in append order
+      expectedValue += keyCount;
+    }
+
+  // The emulation the multimap replaces: every append copies the key's vector and writes it back.
+  concurrent_unordered_map<int, std::vector<int>, std::hash<int>, LockPolicyT> vectorMap;
+  auto startTimeVector = std::chrono::steady_clock::now ();
+  for (auto i = 0; i < keyCount * valuesPerKey; ++i)
+    {
+      auto values = vectorMap.get (i % keyCount).value_or (std::vector<int> ());
+      values.push_back (i);
+      if (!vectorMap.update (i % keyCount, values))
+	{
+	  vectorMap.insert (i % keyCount, values);
+	}
+    }
+  auto endTimeVector = std::chrono::steady_clock::now ();
+
+  std::cout << mapType << " - Multimap Append Duration: "
+	    << std::chrono::duration_cast<std::chrono::milliseconds> (endTime - startTime).count ()
+	    << " milliseconds (map of vectors: "
+	    << std::chrono::duration_cast<std::chrono::milliseconds> (endTimeVector - startTimeVector).count ()
+	    << " milliseconds)\n";
+}
+
+// A string key the map does not recognize as one: compared directly, without key tags.
+struct UntaggedString
+{
+  std::string text;
+
+  bool
+  operator== (const UntaggedString &other) const
+  {
+    return text == other.text;
+  }
+};
+
+struct UntaggedStringHash
+{
+  std::size_t
+  operator() (const UntaggedString &aKey) const
+  {
+    return std::hash<std::string> () (aKey.text);
+  }
+};
+
+static std::size_t
+getHeapBytesInUse ()
+{
+#ifdef __GLIBC__
+  return mallinfo2 ().uordblks;
+#else
+  return 0;
+#endif
+}
+
+template <typename MapT, typename MakeValueT>
+std::string
+fillAndMeasure (MapT &map, MakeValueT makeValue)
+{
+  auto heapBefore = getHeapBytesInUse ();
+  auto startTime = std::chrono::steady_clock::now ();
+  for (uint64_t i = 0; i < oneMill; ++i)
+    {
+      map.insert (i, makeValue (i));
+    }
+  auto endTime = std::chrono::steady_clock::now ();
+  auto heapBytes = getHeapBytesInUse () - heapBefore;
+
+  return std::to_string (std::chrono::duration_cast<std::chrono::milliseconds> (endTime - startTime).count ())
+	 + " milliseconds, " + (heapBytes ? std::to_string (heapBytes / oneMill) : std::string ("?"))
+	 + " heap bytes per entry";
+}
+
+template <typename LockPolicyT>
+void
+timeInlineStorageOperation (const std::string &mapType)
+{
+  concurrent_unordered_map<uint64_t, uint64_t, std::hash<uint64_t>, LockPolicyT> inlineMap (oneMill);
+  concurrent_unordered_map<uint64_t, std::shared_ptr<uint64_t>, std::hash<uint64_t>, LockPolicyT> sharedMap (oneMill);
+
+  // Buckets and their vectors are counted too, so the difference is what the per-entry allocations cost.
+  auto inlineText = fillAndMeasure (inlineMap, [] (uint64_t i) { return i; });
+  auto sharedText = fillAndMeasure (sharedMap, [] (uint64_t i) { return std::make_shared<uint64_t> (i); });
+  std::cout << mapType << " - Inline <uint64_t, uint64_t> Insert: " << inlineText << " (shared_ptr values: "
+	    << sharedText << ")\n";
+}
+
+template <typename LockPolicyT>
+void
+timeCountingOperation (const std::string &mapType)
+{
+  const uint64_t seriesCount = 1000;
+  using CounterMap = concurrent_unordered_map<uint64_t, uint64_t, std::hash<uint64_t>, LockPolicyT>;
+
+  auto countWith = [] (CounterMap &counters, auto increment) {
+    std::vector<std::thread> workers;
+    auto startTime = std::chrono::steady_clock::now ();
+    for (unsigned i = 0; i < std::thread::hardware_concurrency (); ++i)
+      {
+	workers.push_back (std::thread ([&counters, increment, i] () {
+	  for (uint64_t j = 0; j < oneMill; ++j)
+	    {
+	      increment (counters, (j + i) % seriesCount);
+	    }
+	}));
+      }
+    for (auto &worker : workers)
+      {
+	worker.join ();
+      }
+    return std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::steady_clock::now () - startTime);
+  };
+
+  CounterMap atomicCounters (seriesCount);
+  auto atomicDuration =
+    countWith (atomicCounters, [] (CounterMap &counters, uint64_t key) { counters.fetch_add (key, 1); });
+
+  // What counting took before fetch_add: a write-locked iterator per increment.
+  CounterMap lockedCounters (seriesCount);
+  auto lockedDuration = countWith (lockedCounters, [] (CounterMap &counters, uint64_t key) {
+    auto it = counters.find (key);
+    if (it == counters.end ())
+      {
+	it = counters.insert (key, 0).first;
+      }
+    ++it->second;
+  });
+  assert (atomicCounters.get (0) == lockedCounters.get (0));
+
+  std::cout << mapType << " - Counting fetch_add Duration: " << atomicDuration.count ()
+	    << " milliseconds (find + write-locked iterator: " << lockedDuration.count () << " milliseconds)\n";
+}
+
+template <typename LockPolicyT>
+void
+timeWriteCombiningOperation (const std::string &mapType)
+{
+  const uint64_t hotKeyCount = 64;
+  using IngestMap = concurrent_unordered_map<uint64_t, uint64_t, std::hash<uint64_t>, LockPolicyT>;
+
+  auto ingestWith = [hotKeyCount] (IngestMap &map, auto ingest) {
+    for (uint64_t key = 0; key < hotKeyCount; ++key)
+      {
+	map.insert (key, 0);
+      }
+
+    std::vector<std::thread> workers;
+    auto startTime = std::chrono::steady_clock::now ();
+    for (unsigned i = 0; i < std::thread::hardware_concurrency (); ++i)
+      {
+	workers.push_back (std::thread ([&map, ingest, i] () { ingest (map, i); }));
+      }
+    for (auto &worker : workers)
+      {
+	worker.join ();
+      }
+    return std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::steady_clock::now () - startTime);
+  };
+
+  // Skewed ingest: every update lands on one of a few hot keys.
+  IngestMap directMap (hotKeyCount);
+  auto directDuration = ingestWith (directMap, [hotKeyCount] (IngestMap &map, unsigned threadIndex) {
+    for (uint64_t j = 0; j < oneMill; ++j)
+      {
+	map.update ((j * 7 + threadIndex) % hotKeyCount, j);
+      }
+  });
+
+  IngestMap combinedMap (hotKeyCount);
+  auto combinedDuration = ingestWith (combinedMap, [hotKeyCount] (IngestMap &map, unsigned threadIndex) {
+    write_combining_buffer<uint64_t, uint64_t, std::hash<uint64_t>, LockPolicyT> buffer (map);
+    for (uint64_t j = 0; j < oneMill; ++j)
+      {
+	buffer.update ((j * 7 + threadIndex) % hotKeyCount, j);
+      }
+  });
+
+  std::cout << mapType << " - Write-Combined Update Duration: " << combinedDuration.count ()
+	    << " milliseconds (direct update: " << directDuration.count () << " milliseconds)\n";
+}
+
+template <typename LockPolicyT>
+void
+timeEraseIfOperation (const std::string &mapType)
+{
+  using ExpiryMap = concurrent_unordered_map<uint64_t, uint64_t, std::hash<uint64_t>, LockPolicyT>;
+  const uint64_t entryCount = 10 * oneMill;
+  const uint64_t expiryTime = entryCount / 2;
+  auto fill = [entryCount] (ExpiryMap &map) {
+    for (uint64_t i = 0; i < entryCount; ++i)
+      {
+	map.insert (i, i); // the value is the entry's timestamp
+      }
+  };
+
+  ExpiryMap sweptMap (entryCount);
+  fill (sweptMap);
+  auto startTime = std::chrono::steady_clock::now ();
+  auto erased = sweptMap.erase_if ([expiryTime] (const uint64_t &, const uint64_t &time) { return time < expiryTime; });
+  auto endTime = std::chrono::steady_clock::now ();
+  assert (erased == expiryTime);
+
+  // The sweep erase_if replaces: walk an iterator and erase every expired key by itself.
+  ExpiryMap walkedMap (entryCount);
+  fill (walkedMap);
+  auto startTimeWalk = std::chrono::steady_clock::now ();
+  for (auto it = walkedMap.begin (); it != walkedMap.end (); ++it)
+    {
+      if (it->second < expiryTime)
+	{
+	  walkedMap.erase (it->first);
+	}
+    }
+  auto endTimeWalk = std::chrono::steady_clock::now ();
+
+  std::cout << mapType << " - erase_if Duration: "
+	    << std::chrono::duration_cast<std::chrono::milliseconds> (endTime - startTime).count ()
+	    << " milliseconds (iterator + erase: "
+	    << std::chrono::duration_cast<std::chrono::milliseconds> (endTimeWalk - startTimeWalk).count ()
+	    << " milliseconds)\n";
+}
+
+template <typename LockPolicyT>
+void
+timeTransferOperation (const std::string &mapType)
+{
+  using AccountMap = concurrent_unordered_map<uint64_t, int64_t, std::hash<uint64_t>, LockPolicyT>;
+  const uint64_t accountCount = 10000;
+  const int64_t initialBalance = 1000;
+
+  // Every thread moves one unit between pseudo-random pairs of accounts; the total balance must not change.
+  auto transferWith = [accountCount, initialBalance] (auto transfer) {
+    AccountMap map (accountCount);
+    for (uint64_t account = 0; account < accountCount; ++account)
+      {
+	map.insert (account, initialBalance);
+      }
+
+    std::vector<std::thread> workers;
+    auto startTime = std::chrono::steady_clock::now ();
+    for (unsigned i = 0; i < std::thread::hardware_concurrency (); ++i)
+      {
+	workers.push_back (std::thread ([&map, transfer, i, accountCount] () {
+	  for (uint64_t j = 0; j < oneMill; ++j)
+	    {
+	      auto from = (j * 7919 + i) % accountCount;
+	      auto to = (j * 104729 + i * 31) % accountCount;
+	      if (from != to)
+		{
+		  transfer (map, from, to);
+		}
+	    }
+	}));
+      }
+    for (auto &worker : workers)
+      {
+	worker.join ();
+      }
+    auto duration =
+      std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::steady_clock::now () - startTime);
+
+    int64_t totalBalance = 0;
+    map.cvisit_all ([&totalBalance] (const uint64_t &, const int64_t &balance) { totalBalance += balance; }, 1);
+    assert (totalBalance == int64_t (accountCount) * initialBalance);
+    return duration;
+  };
+
+  auto atomicallyDuration = transferWith ([] (AccountMap &map, uint64_t from, uint64_t to) {
+    map.atomically ({ from, to }, [from, to] (auto &entries) {
+      auto fromBalance = entries.find (from);
+      auto toBalance = entries.find (to);
+      if (*fromBalance > 0)
+	{
+	  --*fromBalance;
+	  ++*toBalance;
+	}
+    });
+  });
+
+  // The alternative without atomically: one mutex around every multi-key update.
+  auto mutexDuration = transferWith ([] (AccountMap &map, uint64_t from, uint64_t to) {
+    std::unique_lock<std::mutex> lock (stdMapMutex);
+    auto fromBalance = *map.get (from);
+    if (fromBalance > 0)
+      {
+	map.update (from, fromBalance - 1);
+	map.update (to, *map.get (to) + 1);
+      }
+  });
+
+  std::cout << mapType << " - atomically Transfer Duration: " << atomicallyDuration.count ()
+	    << " milliseconds (global mutex: " << mutexDuration.count () << " milliseconds)\n";
+}
+
+template <typename LockPolicyT>
+void
+timeWeakCursorOperation (const std::string &mapType)
+{
+  using ExportMap = concurrent_unordered_map<int, int, std::hash<int>, LockPolicyT>;
+  const int entryCount = oneMill / 10;
+  const int entriesPerPause = 1000;
+  ExportMap map (entryCount);
+  for (int i = 0; i < entryCount; ++i)
+    {
+      map.insert (i, i);
+    }
+
+  // A slow export (it pauses every entriesPerPause entries) while a writer keeps updating the entry the export is on.
+  // Returns the longest update.
+  auto measureLongestUpdate = [&map] (auto walk) {
+    std::atomic<int> currentKey (0);
+    std::atomic<bool> isWalking (true);
+    std::chrono::nanoseconds longestUpdate (0);
+    std::thread writer ([&] () {
+      while (isWalking)
+	{
+	  auto startTime = std::chrono::steady_clock::now ();
+	  map.update (currentKey.load (), 0);
+	  longestUpdate = std::max (longestUpdate, std::chrono::steady_clock::now () - startTime);
+	}
+    });
+
+    walk ([&currentKey] (int aKey, int exportedCount) {
+      currentKey = aKey;
+      if (exportedCount % entriesPerPause == 0)
+	{
+	  std::this_thread::sleep_for (std::chrono::milliseconds (1));
+	}
+    });
+    isWalking = false;
+    writer.join ();
+    return std::chrono::duration_cast<std::chrono::microseconds> (longestUpdate).count ();
+  };
+
+  auto cursorUpdate = measureLongestUpdate ([&map] (auto exportEntry) {
+    weak_cursor<int, int, std::hash<int>, LockPolicyT> cursor (map);
+    int exportedCount = 0;
+    for (auto entry = cursor.next (); entry; entry = cursor.next ())
+      {
+	exportEntry (entry->first, ++exportedCount);
+      }
+    assert (exportedCount == entryCount);
+  });
+  auto iteratorUpdate = measureLongestUpdate ([&map] (auto exportEntry) {
+    const ExportMap &constMap = map;
+    int exportedCount = 0;
+    for (auto it = constMap.begin (); it != constMap.end (); ++it)
+      {
+	exportEntry (it->first, ++exportedCount);
+      }
+  });
+
+  std::cout << mapType << " - Longest update during a slow export: " << cursorUpdate
+	    << " microseconds with weak_cursor (iterator: " << iteratorUpdate << " microseconds)\n";
+}
+
+template <typename LockPolicyT>
+void
+timeKeyTagOperation (const std::string &mapType)
+{
+  // Long URL keys sharing their first bytes, four per bucket: a lookup compares several keys besides its own.
+  const int urlCount = 2 * oneMill;
+  auto makeUrl = [] (int i) { return "https://www.example.com/catalog/item?id=" + std::to_string (i * 7919); };
+
+  auto lookupWith = [urlCount, &makeUrl] (auto &map, auto makeKey) {
+    std::vector<decltype (makeKey (0))> keys;
+    for (int i = 0; i < urlCount; ++i)
+      {
+	keys.push_back (makeKey (makeUrl (i)));
+	map.insert (keys.back (), i);
+      }
+
+    std::size_t foundCount = 0;
+    auto startTime = std::chrono::steady_clock::now ();
+    for (int round = 0; round < 3; ++round)
+      {
+	for (const auto &aKey : keys)
+	  {
+	    foundCount += map.contains (aKey);
+	  }
+      }
+    auto endTime = std::chrono::steady_clock::now ();
+    assert (foundCount == 3 * keys.size ());
+    return std::chrono::duration_cast<std::chrono::milliseconds> (endTime - startTime);
+  };
+
+  concurrent_unordered_map<std::string, int, std::hash<std::string>, LockPolicyT> taggedMap (urlCount / 4);
+  concurrent_unordered_map<UntaggedString, int, UntaggedStringHash, LockPolicyT> untaggedMap (urlCount / 4);
+  auto taggedDuration = lookupWith (taggedMap, [] (std::string url) { return url; });
+  auto untaggedDuration = lookupWith (untaggedMap, [] (std::string url) { return UntaggedString { url }; });
+
+  std::cout << mapType << " - Key Tag Lookup Duration: " << taggedDuration.count ()
+	    << " milliseconds (without key tags: " << untaggedDuration.count () << " milliseconds)\n";
+}
+
+template <typename LockPolicyT>
+void
+timeNegativeLookupOperation (const std::string &mapType)
+{
+  // Seven lookups in ten miss, in buckets of four keys: without the filter a miss locks the bucket and compares every
+  // key of its chain.
+  using LookupMap = concurrent_unordered_map<int, std::shared_ptr<int>, std::hash<int>, LockPolicyT>;
+  const int keyCount = oneMill;
+  LookupMap map (keyCount / 4);
+  for (int i = 0; i < keyCount; ++i)
+    {
+      map.insert (i, std::make_shared<int> (i));
+    }
+
+  auto lookUp = [&map, keyCount] (auto lookupFunc) {
+    std::vector<std::thread> workers;
+    std::atomic<int> foundCount (0);
+    auto startTime = std::chrono::steady_clock::now ();
+    for (auto t = 0; t < int (std::thread::hardware_concurrency ()); ++t)
+      {
+	workers.push_back (std::thread ([&map, &foundCount, &lookupFunc, keyCount, t] () {
+	  int threadFoundCount = 0;
+	  for (int i = 0; i < keyCount; ++i)
+	    {
+	      threadFoundCount += lookupFunc (map, i % 10 < 3 ? i : keyCount * (t + 1) + i);
+	    }
+	  foundCount += threadFoundCount;
+	}));
+      }
+    for (auto &worker : workers)
+      {
+	worker.join ();
+      }
+    auto endTime = std::chrono::steady_clock::now ();
+    assert (foundCount == int (workers.size ()) * (keyCount / 10 * 3));
+    return std::chrono::duration_cast<std::chrono::milliseconds> (endTime - startTime);
+  };
+  auto findKey = [] (const LookupMap &aMap, int aKey) { return aMap.find (aKey) != aMap.end (); };
+  auto containsKey = [] (const LookupMap &aMap, int aKey) { return aMap.contains (aKey); };
+
+  auto unfilteredFindDuration = lookUp (findKey);
+  auto unfilteredContainsDuration = lookUp (containsKey);
+  map.set_lookup_filter (true);
+  auto findDuration = lookUp (findKey);
+  auto containsDuration = lookUp (containsKey);
+
+  std::cout << mapType << " - Negative Lookup Duration (70% misses): " << findDuration.count ()
+	    << " milliseconds find, " << containsDuration.count () << " milliseconds contains (without lookup filter: "
+	    << unfilteredFindDuration.count () << " / " << unfilteredContainsDuration.count () << " milliseconds)\n";
+}
+
+struct OpenLoopLatencies
+{
+  LatencyHistogram responseTime; // from when the operation was due
+  LatencyHistogram serviceTime;  // from when it actually started
+};
+
+template <typename OperationT>
+void
+runOpenLoop (int operationCount, std::chrono::nanoseconds interval, OpenLoopLatencies &latencies, OperationT operation)
+{
+  auto startTime = std::chrono::steady_clock::now ();
+  for (auto i = 0; i < operationCount; ++i)
+    {
+      // Operations are issued on a fixed schedule, whether or not the previous one finished in time. Measuring from
+      // the scheduled start charges a stall to every operation queued behind it (coordinated-omission correction).
+      auto intendedStart = startTime + interval * i;
+      while (std::chrono::steady_clock::now () < intendedStart)
+	{
+	  std::this_thread::yield ();
+	}
+
+      auto actualStart = std::chrono::steady_clock::now ();
+      operation (i);
+      auto endTime = std::chrono::steady_clock::now ();
+
+      latencies.responseTime.record (
+	uint64_t (std::chrono::duration_cast<std::chrono::nanoseconds> (endTime - intendedStart).count ()));
+      latencies.serviceTime.record (
+	uint64_t (std::chrono::duration_cast<std::chrono::nanoseconds> (endTime - actualStart).count ()));
+    }
+}
+
+template <typename MapT, typename OperationT>
+void
+timeOpenLoopOperation (MapT &map, const std::string &mapType, const std::string &operationName, OperationT operation)
+{
+  auto threadCount = int (std::thread::hardware_concurrency ());
+  auto operationsPerThread = int (openLoopOperationsPerSecond * openLoopPhaseDuration.count () / 1000.0 / threadCount);
+  auto interval = std::chrono::nanoseconds (int64_t (1e9 * threadCount / openLoopOperationsPerSecond));
+
+  std::vector<OpenLoopLatencies> threadLatencies (threadCount);
+  std::vector<std::thread> workers;
+  for (auto i = 0; i < threadCount; ++i)
+    {
+      workers.push_back (std::thread ([&map, &operation, &threadLatencies, i, operationsPerThread, interval] () {
+	runOpenLoop (operationsPerThread, interval, threadLatencies[i],
+		     [&map, &operation, left = i * operationsPerThread] (int offset) { operation (map, left + offset); });
+      }));
+    }
+
+  for (auto &worker : workers)
+    {
+      worker.join ();
+    }
+
+  OpenLoopLatencies latencies;
+  for (auto &threadLatency : threadLatencies)
+    {
+      latencies.responseTime += threadLatency.responseTime;
+      latencies.serviceTime += threadLatency.serviceTime;
+    }
+
+  std::cout << mapType << " - Open Loop " << operationName << " Latency (" << openLoopOperationsPerSecond
+	    << " ops/s): " << latencies.responseTime.toText () << "\n";
+  std::cout << "-- Uncorrected service time: " << latencies.serviceTime.toText () << "\n";
+}
+
+template <typename MapT>
+void
+timeOpenLoopOperations (MapT &map, const std::string &mapType, bool lock)
+{
+  auto locked = [lock] (auto operation) {
+    return [lock, operation] (MapT &aMap, int key) {
+      std::unique_lock<std::mutex> mapLock (stdMapMutex, std::defer_lock);
+      if (lock)
+	{
+	  mapLock.lock ();
+	}
+      operation (aMap, key);
+    };
+  };
+
+  map.reserve (std::size_t (openLoopOperationsPerSecond * openLoopPhaseDuration.count () / 1000.0));
+  timeOpenLoopOperation (map, mapType, "Insert", locked ([] (MapT &aMap, int key) {
+			   aMap.insert (std::make_pair (key, std::make_shared<int> (key)));
+			 }));
+  timeOpenLoopOperation (map, mapType, "Find", locked ([] (MapT &aMap, int key) {
+			   auto it = std::as_const (aMap).find (key);
+			   assert (it != aMap.end ());
+			 }));
+  timeOpenLoopOperation (map, mapType, "Erase", locked ([] (MapT &aMap, int key) {
+			   auto result = aMap.erase (key);
+			   assert (result);
+			 }));
+}
+
+template <typename LockPolicyT>
+void
+timeOrderedMapOperation (const std::string &mapType)
+{
+  // Time-ordered keys from several producers, then range scans of the latest keys while producers keep appending.
+  using OrderedMap = concurrent_ordered_map<uint64_t, uint64_t, std::less<uint64_t>, LockPolicyT>;
+  const auto threadCount = uint64_t (std::thread::hardware_concurrency ());
+  const uint64_t keyCount = oneMill;
+  const int scanCount = 20000;
+  const int scanLength = 100;
+
+  OrderedMap orderedMap;
+  std::map<uint64_t, uint64_t> lockedMap;
+  std::mutex lockedMapMutex;
+  auto insertOrdered = [&orderedMap] (uint64_t aKey) { orderedMap.insert (aKey, aKey); };
+  auto insertLocked = [&lockedMap, &lockedMapMutex] (uint64_t aKey) {
+    std::unique_lock<std::mutex> lock (lockedMapMutex);
+    lockedMap.emplace (aKey, aKey);
+  };
+  auto scanOrdered = [&orderedMap, scanLength] (uint64_t first) {
+    auto cursor = orderedMap.lower_bound (first);
+    uint64_t sum = 0;
+    for (auto element = cursor.next (); element && int (element->first - first) < scanLength; element = cursor.next ())
+      {
+	sum += element->second;
+      }
+    return sum;
+  };
+  auto scanLocked = [&lockedMap, &lockedMapMutex, scanLength] (uint64_t first) {
+    std::unique_lock<std::mutex> lock (lockedMapMutex);
+    uint64_t sum = 0;
+    for (auto it = lockedMap.lower_bound (first); it != lockedMap.end () && int (it->first - first) < scanLength; ++it)
+      {
+	sum += it->second;
+      }
+    return sum;
+  };
+
+  auto timeInserts = [threadCount, keyCount] (auto insertKey) {
+    std::vector<std::thread> workers;
+    auto startTime = std::chrono::steady_clock::now ();
+    for (uint64_t t = 0; t < threadCount; ++t)
+      {
+	workers.push_back (std::thread ([&insertKey, threadCount, keyCount, t] () {
+	  for (uint64_t i = 0; i < keyCount; ++i)
+	    {
+	      insertKey (i * threadCount + t);
+	    }
+	}));
+      }
+    for (auto &worker : workers)
+      {
+	worker.join ();
+      }
+    return std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::steady_clock::now () - startTime);
+  };
+
+  auto timeScans = [threadCount, keyCount, scanCount, scanLength] (auto insertKey, auto scanFrom) {
+    std::atomic<bool> isScanning (true);
+    std::thread producer ([&insertKey, &isScanning, threadCount, keyCount] () {
+      for (auto aKey = keyCount * threadCount; isScanning; ++aKey)
+	{
+	  insertKey (aKey);
+	}
+    });
+
+    std::vector<std::thread> workers;
+    auto startTime = std::chrono::steady_clock::now ();
+    for (uint64_t t = 0; t < threadCount; ++t)
+      {
+	workers.push_back (std::thread ([&scanFrom, threadCount, keyCount, scanCount, scanLength, t] () {
+	  uint64_t sum = 0;
+	  for (int i = 0; i < scanCount; ++i)
+	    {
+	      sum += scanFrom ((uint64_t (i) * 7919 + t) % (keyCount * threadCount - scanLength));
+	    }
+	  assert (sum > 0);
+	}));
+      }
+    for (auto &worker : workers)
+      {
+	worker.join ();
+      }
+    auto duration =
+      std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::steady_clock::now () - startTime);
+    isScanning = false;
+    producer.join ();
+    return duration;
+  };
+
+  auto orderedInsertDuration = timeInserts (insertOrdered);
+  auto lockedInsertDuration = timeInserts (insertLocked);
+  auto orderedScanDuration = timeScans (insertOrdered, scanOrdered);
+  auto lockedScanDuration = timeScans (insertLocked, scanLocked);
+
+  std::cout << mapType << " - Ordered Map Insert Duration: " << orderedInsertDuration.count ()
+	    << " milliseconds (std::map with a mutex: " << lockedInsertDuration.count () << " milliseconds)\n";
+  std::cout << mapType << " - Ordered Map Range Scan Duration: " << orderedScanDuration.count ()
+	    << " milliseconds (std::map with a mutex: " << lockedScanDuration.count () << " milliseconds)\n";
+}
+
+template <typename LockPolicyT>
+void
+timeConcurrentMapOperations (const std::string &mapType)
+{
+  using MapT = concurrent_unordered_map<int, std::shared_ptr<int>, std::hash<int>, LockPolicyT>;
+  timeConstructOperation<MapT> (mapType);
+
+  MapT myMap;
+  myMap.reserve (std::thread::hardware_concurrency () * oneMill);
+  myMap.start_maintenance ();
+
+  timeInsertOperation (myMap, mapType, false);
+  timeFindOperation (myMap, mapType, false);
+  timeGetOperation (myMap, mapType);
+  timeFindLockOperation (myMap, mapType);
+  timeAsyncFindOperation (myMap, mapType);
+  timeTraverseOperation (myMap, mapType, false);
+  std::cout << mapType << " - Statistics:\n" << myMap.get_statistics (5).toText ();
+  timeEraseOperation (myMap, mapType, false);
+  timeShrinkOperation (myMap, mapType);
+  timeOpenLoopOperations (myMap, mapType, false);
+  timeSetOperation<LockPolicyT> (mapType);
+  timeMultimapAppendOperation<LockPolicyT> (mapType);
+  timeInlineStorageOperation<LockPolicyT> (mapType);
+  timeKeyTagOperation<LockPolicyT> (mapType);
+  timeNegativeLookupOperation<LockPolicyT> (mapType);
+  timeCountingOperation<LockPolicyT> (mapType);
+  timeWriteCombiningOperation<LockPolicyT> (mapType);
+  timeEraseIfOperation<LockPolicyT> (mapType);
+  timeWeakCursorOperation<LockPolicyT> (mapType);
+  timeTransferOperation<LockPolicyT> (mapType);
+  timeOrderedMapOperation<LockPolicyT> (mapType);
+}
+
+template <typename HashT>
+double
+timeStringHashing (const std::vector<std::string> &keys, int rounds)
+{
+  HashT hashFunc;
+  std::size_t combined = 0;
+  auto startTime = std::chrono::steady_clock::now ();
+  for (int round = 0; round < rounds; ++round)
+    {
+      for (const auto &aKey : keys)
+	{
+	  combined ^= hashFunc (aKey);
+	}
+    }
+  auto endTime = std::chrono::steady_clock::now ();
+  assert (combined != 1); // keeps the loop
+  return double (std::chrono::duration_cast<std::chrono::nanoseconds> (endTime - startTime).count ())
+	 / (double (keys.size ()) * rounds);
+}
+
+template <typename HashT>
+std::pair<std::size_t, std::size_t>
+getStridedChainLengths (std::size_t bucketCount, std::size_t stride)
+{
+  HashT hashFunc;
+  std::vector<std::size_t> chainLengths (bucketCount);
+  for (std::size_t i = 0; i < bucketCount; ++i)
+    {
+      ++chainLengths[hashFunc (uint64_t (i * stride)) % bucketCount];
+    }
+  auto longestChain = *std::max_element (chainLengths.begin (), chainLengths.end ());
+  auto emptyBuckets = std::size_t (std::count (chainLengths.begin (), chainLengths.end (), 0));
+  return { longestChain, emptyBuckets };
+}
+
+void
+timeHashFunctions ()
+{
+  std::cout << "Hash functions (fast_hash long inputs on " << (ByteHash::usesAvx2 () ? "AVX2" : "scalar code")
+	    << "):\n";
+  for (std::size_t length : { 8, 32, 128, 1024 })
+    {
+      // Enough keys to leave the L1 cache, each hashed the same number of bytes per round.
+      std::vector<std::string> keys;
+      for (std::size_t i = 0; i < (1u << 20) / length; ++i)
+	{
+	  keys.push_back (std::string (length, 'a' + char (i % 26)));
+	  std::memcpy (keys.back ().data (), &i, std::min (length, sizeof (i)));
+	}
+      auto rounds = int (std::max<std::size_t> (length, 16));
+      auto standardTime = timeStringHashing<std::hash<std::string>> (keys, rounds);
+      auto fastTime = timeStringHashing<fast_hash<std::string>> (keys, rounds);
+      std::cout << "-- " << length << " byte strings: " << fastTime << " ns per hash, " << double (length) / fastTime
+		<< " GB/s (std::hash: " << standardTime << " ns, " << double (length) / standardTime << " GB/s)\n";
+    }
+
+  // Keys that are multiples of 1024 in a power-of-two table: the identity std::hash of libstdc++ uses one bucket in
+  // 1024. The map's own tables have a prime size, which spreads these keys either way.
+  const std::size_t bucketCount = 1 << 16;
+  auto [standardLongest, standardEmpty] = getStridedChainLengths<std::hash<uint64_t>> (bucketCount, 1024);
+  auto [fastLongest, fastEmpty] = getStridedChainLengths<fast_hash<uint64_t>> (bucketCount, 1024);
+  std::cout << "-- Strided integer keys in " << bucketCount << " buckets: longest chain " << fastLongest << ", "
+	    << fastEmpty << " empty buckets (std::hash: longest chain " << standardLongest << ", " << standardEmpty
+	    << " empty buckets)\n";
+}
+
+template <typename WriteT>
+std::chrono::milliseconds
+timeDurableWriters (unsigned writerCount, int writesPerWriter, WriteT write)
+{
+  std::vector<std::thread> writers;
+  auto startTime = std::chrono::steady_clock::now ();
+  for (unsigned i = 0; i < writerCount; ++i)
+    {
+      writers.push_back (std::thread ([write, i, writesPerWriter] () {
+	for (int j = 0; j < writesPerWriter; ++j)
+	  {
+	    write (uint64_t (i) * writesPerWriter + j);
+	  }
+      }));
+    }
+  for (auto &writer : writers)
+    {
+      writer.join ();
+    }
+  return std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::steady_clock::now () - startTime);
+}
+
+void
+timeDurableWrites ()
+{
+  using DurableMap = durable_map<uint64_t, uint64_t>;
+  // Writers mostly wait for the disk, so there are more of them than cores: that is what group commit batches.
+  const unsigned writerCount = 8;
+  const int writesPerWriter = 2000;
+  auto directory = std::filesystem::temp_directory_path () / "concurrent_hash_map_wal";
+  std::filesystem::remove_all (directory);
+  std::filesystem::create_directories (directory);
+
+  std::cout << "Durable map (" << writerCount << " writers, " << writerCount * writesPerWriter << " inserts):\n";
+  const std::pair<Durability, const char *> durabilities[]
+    = { { Durability::NONE, "no fsync" },
+	{ Durability::PER_BATCH, "fsync per batch" },
+	{ Durability::PER_OPERATION, "fsync per operation" } };
+  for (auto [durability, name] : durabilities)
+    {
+      auto basePath = (directory / name).string ();
+      std::chrono::milliseconds duration;
+      {
+	DurableMap map (basePath, durability, 100003);
+	duration = timeDurableWriters (writerCount, writesPerWriter,
+				       [&map] (uint64_t aKey) { map.insert (aKey, aKey * 2); });
+      }
+      auto startTime = std::chrono::steady_clock::now ();
+      DurableMap recovered (basePath, durability, 100003);
+      auto recoveryDuration
+	= std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::steady_clock::now () - startTime);
+      assert (recovered.size () == writerCount * writesPerWriter);
+      std::cout << "-- " << name << ": " << duration.count () << " milliseconds, recovery "
+		<< recoveryDuration.count () << " milliseconds\n";
+    }
+
+  // The alternative without the log: every insert also written and fsynced to a file, one at a time.
+  {
+    concurrent_unordered_map<uint64_t, uint64_t> map (100003);
+    std::mutex mirrorMutex;
+    auto mirror = std::fopen ((directory / "mirror").string ().c_str (), "ab");
+    auto duration = timeDurableWriters (writerCount, writesPerWriter, [&map, &mirrorMutex, mirror] (uint64_t aKey) {
+      map.insert (aKey, aKey * 2);
+      std::unique_lock<std::mutex> lock (mirrorMutex);
+      uint64_t record[2] = { aKey, aKey * 2 };
+      std::fwrite (record, sizeof (record), 1, mirror);
+      WriteAheadLog::syncFile (mirror);
+    });
+    std::fclose (mirror);
+    std::cout << "-- synchronous mirror, one fsync per insert: " << duration.count () << " milliseconds\n";
+  }
+  std::filesystem::remove_all (directory);
+}
+
+#ifndef _WIN32
+void
+timeSharedMemoryMap ()
+{
+  using SharedMap = shared_memory_map<uint64_t, uint64_t>;
+  const std::string regionName = "/concurrent_hash_map_benchmark";
+  const uint64_t elementCount = 1000000;
+  const int readerCount = 4;
+
+  std::cout << "Shared-memory map (" << elementCount << " elements, " << readerCount << " reader processes):\n";
+  try
+    {
+      auto startTime = std::chrono::steady_clock::now ();
+      SharedMap map (regionName, elementCount);
+      for (uint64_t i = 0; i < elementCount; ++i)
+	{
+	  map.insert (i, i * 2);
+	}
+      auto buildDuration
+	= std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::steady_clock::now () - startTime);
+
+      // Every reader maps the table and looks up each key; nothing is copied into the reader.
+      startTime = std::chrono::steady_clock::now ();
+      std::vector<pid_t> readers;
+      for (int i = 0; i < readerCount; ++i)
+	{
+	  auto pid = fork ();
+	  if (pid == 0)
+	    {
+	      bool isConsistent = false;
+	      try
+		{
+		  SharedMap readerMap (regionName);
+		  isConsistent = readerMap.size () == elementCount;
+		  for (uint64_t key = 0; key < elementCount && isConsistent; ++key)
+		    {
+		      isConsistent = readerMap.get (key) == key * 2;
+		    }
+		}
+	      catch (const std::exception &)
+		{
+		}
+	      _exit (isConsistent ? 0 : 1);
+	    }
+	  readers.push_back (pid);
+	}
+      bool areReadersConsistent = true;
+      for (auto pid : readers)
+	{
+	  int status = 0;
+	  waitpid (pid, &status, 0);
+	  areReadersConsistent = areReadersConsistent && WIFEXITED (status) && WEXITSTATUS (status) == 0;
+	}
+      auto readDuration
+	= std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::steady_clock::now () - startTime);
+      SharedRegion::remove (regionName);
+      assert (areReadersConsistent);
+
+      auto regionMegabytes = map.region_size () >> 20;
+      std::cout << "-- Build: " << buildDuration.count () << " milliseconds, one " << regionMegabytes
+		<< " MB region for all processes (a copy per process: " << (readerCount + 1) * regionMegabytes
+		<< " MB)\n";
+      std::cout << "-- Readers mapping it and finding every key: " << readDuration.count () << " milliseconds\n";
+    }
+  catch (const std::exception &e)
+    {
+      SharedRegion::remove (regionName);
+      std::cout << "-- Skipped: " << e.what () << "\n";
+    }
+}
+#endif
+
 int
 main ()
 {
   using namespace std::chrono_literals;
   std::cout << "Using " << std::thread::hardware_concurrency () << " threads...\n";
-  concurrent_unordered_map<int, std::shared_ptr<int>> myMap;
   std::unordered_map<int, std::shared_ptr<int>> standardMap;
 
-  timeInsertOperation (myMap, "Concurrent Map", false);
-  timeInsertOperation (standardMap, "Standard Map", true);
+  timeConcurrentMapOperations<shared_mutex_policy> ("Concurrent Map (shared_mutex)");
+  timeConcurrentMapOperations<spin_futex_policy> ("Concurrent Map (spin/futex)");
+  timeConcurrentMapOperations<reader_biased_policy> ("Concurrent Map (reader-biased)");
 
-  timeFindOperation (myMap, "Concurrent Map", false);
+  timeInsertOperation (standardMap, "Standard Map", true);
   timeFindOperation (standardMap, "Standard Map", true);
-  timeFindLockOperation (myMap);
-
-  timeTraverseOperation (myMap, "Concurrent Map", false);
   timeTraverseOperation (standardMap, "Standard Map", true);
-
-  timeEraseOperation (myMap, "Concurrent Map", false);
   timeEraseOperation (standardMap, "Standard Map", true);
+  timeOpenLoopOperations (standardMap, "Standard Map", true);
+
+  timeHashFunctions ();
+  timeDurableWrites ();
+#ifndef _WIN32
+  timeSharedMemoryMap ();
+#endif
 
   auto &averages = GlobalCounter::getAverages ();
 
@@ -222,5 +1369,18 @@ main ()
       std::cout << "-- Average write lock time: " << it->second.averageMicrosecondsWrite << " microseconds.\n";
     }
 
+  auto compactionCounters = GlobalCounter::getCompactionCounters ();
+  std::cout << "Bucket compactions: " << compactionCounters.bucketsCompacted << "\n";
+  std::cout << "-- Tombstones removed: " << compactionCounters.tombstonesRemoved << "\n";
+  std::cout << "-- Total compaction time: " << compactionCounters.totalMicroseconds << " microseconds.\n";
+  std::cout << "-- Longest compaction: " << compactionCounters.maxMicroseconds << " microseconds.\n";
+
+#ifdef ADD_LOCK_TRACING
+  if (LockTrace::writeChromeJson ("lock_trace.json"))
+    {
+      std::cout << "Lock trace written to lock_trace.json\n";
+    }
+#endif
+
   return 0;
 }
@@ -0,0 +1,75 @@
+#include "map_statistics.hpp"
+
+#include <sstream>
+
+bool
+ProbeSampler::shouldSample ()
+{
+  static thread_local uint32_t lookupCount = 0;
+  return ++lookupCount % sampleInterval == 0;
+}
+
+void
+ProbeSampler::record (std::size_t aProbeCount)
+{
+  sampleCount.fetch_add (1, std::memory_order_relaxed);
+  probeCount.fetch_add (aProbeCount, std::memory_order_relaxed);
+
+  auto currentMax = maxProbes.load (std::memory_order_relaxed);
+  while (aProbeCount > currentMax && !maxProbes.compare_exchange_weak (currentMax, aProbeCount))
+    {
+    }
+}
+
+std::string
+MapStatistics::toText () const
+{
+  std::ostringstream out;
+  out << "Size: " << size << "\n";
+  out << "Buckets: " << bucketCount << " (" << allocatedBucketCount << " allocated)\n";
+  out << "Load factor: " << loadFactor << "\n";
+  out << "Stored values: " << storedValues << " (" << tombstones << " tombstones, ratio " << tombstoneRatio << ")\n";
+  out << "Chain length histogram (max " << maxChainLength << "):\n";
+  for (std::size_t i = 0; i < chainLengthHistogram.size (); ++i)
+    {
+      if (chainLengthHistogram[i] > 0)
+	{
+	  out << "-- " << i << (i + 1 == chainLengthHistogram.size () ? "+" : "") << ": " << chainLengthHistogram[i]
+	      << "\n";
+	}
+    }
+  out << "Probes per lookup: " << averageProbes << " average, " << maxProbes << " max (" << sampledLookups
+      << " sampled lookups)\n";
+  out << "Most contended buckets:\n";
+  for (auto &contendedBucket : mostContendedBuckets)
+    {
+      out << "-- Bucket " << contendedBucket.bucketIndex << ": " << contendedBucket.waitCount << " waits, "
+	  << contendedBucket.waitMicroseconds << " microseconds\n";
+    }
+  return out.str ();
+}
+
+std::string
+MapStatistics::toJson () const
+{
+  std::ostringstream out;
+  out << "{\"size\":" << size << ",\"bucketCount\":" << bucketCount
+      << ",\"allocatedBucketCount\":" << allocatedBucketCount << ",\"loadFactor\":" << loadFactor
+      << ",\"storedValues\":" << storedValues << ",\"tombstones\":" << tombstones
+      << ",\"tombstoneRatio\":" << tombstoneRatio << ",\"chainLengthHistogram\":[";
+  for (std::size_t i = 0; i < chainLengthHistogram.size (); ++i)
+    {
+      out << (i > 0 ? "," : "") << chainLengthHistogram[i];
+    }
+  out << "],\"maxChainLength\":" << maxChainLength << ",\"sampledLookups\":" << sampledLookups
+      << ",\"averageProbes\":" << averageProbes << ",\"maxProbes\":" << maxProbes << ",\"mostContendedBuckets\":[";
+  for (std::size_t i = 0; i < mostContendedBuckets.size (); ++i)
+    {
+      auto &contendedBucket = mostContendedBuckets[i];
+      out << (i > 0 ? "," : "") << "{\"bucketIndex\":" << contendedBucket.bucketIndex
+	  << ",\"waitCount\":" << contendedBucket.waitCount
+	  << ",\"waitMicroseconds\":" << contendedBucket.waitMicroseconds << "}";
+    }
+  out << "]}";
+  return out.str ();
+}
@@ -1,11 +1,13 @@
 #include "performance_counters.hpp"
 
+#include <algorithm>
 #include <atomic>
 #include <mutex>
 
 std::atomic<uint64_t> GlobalCounter::mutexLockCount = 0;
 std::mutex GlobalCounter::dataMutex;
 std::unordered_map<std::thread::id, Averages> GlobalCounter::threadAverages;
+CompactionCounters GlobalCounter::compactionCounters = {};
 
 void
 GlobalCounter::addMutexAquireCounters (const MutexAquireCounters &counters)
@@ -33,4 +35,23 @@ GlobalCounter::addMutexAquireCounters (const MutexAquireCounters &counters)
 	(currentAverage * currentCounter + durationMicro.count ()) / (currentCounter + 1);
       threadAverages[counters.threadID].writeOperationCount++;
     }
-}
\ No newline at end of file
+}
+
+void
+GlobalCounter::addBucketCompaction (uint64_t tombstonesRemoved, ChronoTimePoint startTime, ChronoTimePoint endTime)
+{
+  uint64_t durationMicro = std::chrono::duration_cast<std::chrono::microseconds> (endTime - startTime).count ();
+
+  std::unique_lock<std::mutex> lock (dataMutex);
+  compactionCounters.bucketsCompacted++;
+  compactionCounters.tombstonesRemoved += tombstonesRemoved;
+  compactionCounters.totalMicroseconds += durationMicro;
+  compactionCounters.maxMicroseconds = std::max (compactionCounters.maxMicroseconds, durationMicro);
+}
+
+CompactionCounters
+GlobalCounter::getCompactionCounters ()
+{
+  std::unique_lock<std::mutex> lock (dataMutex);
+  return compactionCounters;
+}
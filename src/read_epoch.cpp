@@ -0,0 +1,60 @@
+#include "read_epoch.hpp"
+
+#include <thread>
+
+std::size_t
+ReadEpoch::getThreadStripe ()
+{
+  static std::atomic<std::size_t> nextStripe = 0;
+  static thread_local std::size_t threadStripe = nextStripe++ % stripeCount;
+  return threadStripe;
+}
+
+std::size_t
+ReadEpoch::enter ()
+{
+  auto stripe = getThreadStripe ();
+  auto parity = std::size_t (currentEpoch.load () & 1);
+  stripes[stripe].readers[parity].fetch_add (1);
+  return stripe * 2 + parity;
+}
+
+void
+ReadEpoch::exit (std::size_t token)
+{
+  stripes[token / 2].readers[token % 2].fetch_sub (1, std::memory_order_release);
+}
+
+void
+ReadEpoch::synchronize ()
+{
+  std::unique_lock<std::mutex> lock (synchronizeMutex);
+
+  // Flipping twice also covers readers that read the old parity just before a flip.
+  for (int flip = 0; flip < 2; ++flip)
+    {
+      auto previousParity = std::size_t (currentEpoch.fetch_add (1) & 1);
+      for (auto &stripe : stripes)
+	{
+	  while (stripe.readers[previousParity].load () != 0)
+	    {
+	      std::this_thread::yield ();
+	    }
+	}
+    }
+}
+
+bool
+ReadEpoch::tryAdvance ()
+{
+  auto epoch = currentEpoch.load ();
+  auto previousParity = std::size_t ((epoch + 1) & 1);
+  for (auto &stripe : stripes)
+    {
+      if (stripe.readers[previousParity].load () != 0)
+	{
+	  return false;
+	}
+    }
+  return currentEpoch.compare_exchange_strong (epoch, epoch + 1);
+}
@@ -0,0 +1,126 @@
+#include "shared_region.hpp"
+
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+#ifndef _WIN32
+bool
+isSharedMemoryName (const std::string &aName)
+{
+  return !aName.empty () && aName[0] == '/' && aName.find ('/', 1) == std::string::npos;
+}
+
+int
+openDescriptor (const std::string &aName, int flags)
+{
+  auto descriptor = isSharedMemoryName (aName) ? shm_open (aName.c_str (), flags, 0600)
+					       : ::open (aName.c_str (), flags, 0600);
+  if (descriptor < 0)
+    {
+      throw std::system_error (errno, std::generic_category (), "cannot open the shared region " + aName);
+    }
+  return descriptor;
+}
+
+char *
+mapDescriptor (int descriptor, std::size_t aSize, const std::string &aName)
+{
+  auto address = mmap (nullptr, aSize, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+  auto error = errno;
+  close (descriptor); // the mapping keeps the region
+  if (address == MAP_FAILED)
+    {
+      throw std::system_error (error, std::generic_category (), "cannot map the shared region " + aName);
+    }
+  return static_cast<char *> (address);
+}
+#else
+[[noreturn]] void
+throwUnsupported ()
+{
+  throw std::runtime_error ("shared regions need a POSIX system");
+}
+#endif
+} // namespace
+
+SharedRegion::SharedRegion (char *aBase, std::size_t aSize) : base (aBase), regionSize (aSize)
+{
+}
+
+SharedRegion::SharedRegion (SharedRegion &&other) noexcept : base (other.base), regionSize (other.regionSize)
+{
+  other.base = nullptr;
+  other.regionSize = 0;
+}
+
+SharedRegion::~SharedRegion ()
+{
+#ifndef _WIN32
+  if (base)
+    {
+      munmap (base, regionSize);
+    }
+#endif
+}
+
+SharedRegion
+SharedRegion::create (const std::string &aName, std::size_t aSize)
+{
+#ifndef _WIN32
+  remove (aName);
+  auto descriptor = openDescriptor (aName, O_RDWR | O_CREAT | O_EXCL);
+  if (ftruncate (descriptor, off_t (aSize)) != 0)
+    {
+      auto error = errno;
+      close (descriptor);
+      throw std::system_error (error, std::generic_category (), "cannot size the shared region " + aName);
+    }
+  return SharedRegion (mapDescriptor (descriptor, aSize, aName), aSize);
+#else
+  throwUnsupported ();
+#endif
+}
+
+SharedRegion
+SharedRegion::open (const std::string &aName)
+{
+#ifndef _WIN32
+  auto descriptor = openDescriptor (aName, O_RDWR);
+  struct stat status;
+  if (fstat (descriptor, &status) != 0)
+    {
+      auto error = errno;
+      close (descriptor);
+      throw std::system_error (error, std::generic_category (), "cannot size the shared region " + aName);
+    }
+  auto aSize = std::size_t (status.st_size);
+  return SharedRegion (mapDescriptor (descriptor, aSize, aName), aSize);
+#else
+  throwUnsupported ();
+#endif
+}
+
+void
+SharedRegion::remove (const std::string &aName)
+{
+#ifndef _WIN32
+  if (isSharedMemoryName (aName))
+    {
+      shm_unlink (aName.c_str ());
+    }
+  else
+    {
+      unlink (aName.c_str ());
+    }
+#endif
+}
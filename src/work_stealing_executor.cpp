@@ -0,0 +1,224 @@
+#include "work_stealing_executor.hpp"
+
+#include <algorithm>
+
+WorkStealingExecutor::WorkStealingExecutor (unsigned workerCount)
+{
+  for (unsigned i = 0; i < workerCount; ++i)
+    {
+      workers.push_back (std::thread ([this] () { workerLoop (); }));
+    }
+}
+
+WorkStealingExecutor::~WorkStealingExecutor ()
+{
+  {
+    std::unique_lock<std::mutex> lock (jobsMutex);
+    isStopping = true;
+  }
+  jobsCondition.notify_all ();
+
+  for (auto &worker : workers)
+    {
+      worker.join ();
+    }
+}
+
+WorkStealingExecutor &
+WorkStealingExecutor::getDefault ()
+{
+  static WorkStealingExecutor defaultExecutor;
+  return defaultExecutor;
+}
+
+void
+WorkStealingExecutor::parallelFor (std::size_t first, std::size_t last, unsigned maxConcurrency, std::size_t grain,
+				   const std::function<void (std::size_t, std::size_t)> &rangeFn)
+{
+  if (first >= last)
+    {
+      return;
+    }
+
+  auto participantCount = getWorkerCount () + 1;
+  if (maxConcurrency != 0)
+    {
+      participantCount = std::min (participantCount, maxConcurrency);
+    }
+  grain = std::max<std::size_t> (grain, 1);
+
+  // Nothing to share: skip the job bookkeeping.
+  if (participantCount == 1 || last - first <= grain)
+    {
+      for (auto begin = first; begin < last; begin += std::min (grain, last - begin))
+	{
+	  rangeFn (begin, begin + std::min (grain, last - begin));
+	}
+      return;
+    }
+
+  Job job;
+  job.rangeFn = &rangeFn;
+  job.grain = grain;
+  job.remaining = last - first;
+  for (unsigned i = 0; i < participantCount; ++i)
+    {
+      job.participants.push_back (std::make_unique<Participant> ());
+    }
+  job.participants[0]->ranges.push_back (Range { first, last });
+
+  {
+    std::unique_lock<std::mutex> lock (jobsMutex);
+    jobs.push_back (&job);
+  }
+  jobsCondition.notify_all ();
+
+  participate (job, 0);
+
+  // Wait for the ranges stolen by the workers, then for the workers to let go of the job.
+  for (auto remaining = job.remaining.load (); remaining != 0; remaining = job.remaining.load ())
+    {
+      job.remaining.wait (remaining);
+    }
+  {
+    std::unique_lock<std::mutex> lock (jobsMutex);
+    jobs.erase (std::find (jobs.begin (), jobs.end (), &job));
+  }
+  for (auto active = job.activeWorkers.load (); active != 0; active = job.activeWorkers.load ())
+    {
+      job.activeWorkers.wait (active);
+    }
+  {
+    std::unique_lock<std::mutex> lock (jobsMutex); // the last worker notifies while holding it
+  }
+
+  if (job.exception)
+    {
+      std::rethrow_exception (job.exception);
+    }
+}
+
+void
+WorkStealingExecutor::workerLoop ()
+{
+  std::unique_lock<std::mutex> lock (jobsMutex);
+  while (true)
+    {
+      Job *job = nullptr;
+      unsigned participantIndex = 0;
+      jobsCondition.wait (lock, [this, &job, &participantIndex] () {
+	for (auto candidate : jobs)
+	  {
+	    auto index = candidate->nextParticipant.load ();
+	    if (index < candidate->participants.size () && candidate->remaining != 0)
+	      {
+		candidate->nextParticipant = index + 1; // slots are only taken under jobsMutex
+		participantIndex = index;
+		job = candidate;
+		return true;
+	      }
+	  }
+	return isStopping;
+      });
+      if (!job)
+	{
+	  return;
+	}
+
+      ++job->activeWorkers;
+      lock.unlock ();
+      participate (*job, participantIndex);
+      lock.lock ();
+
+      // The job may be freed as soon as activeWorkers drops to zero.
+      if (--job->activeWorkers == 0)
+	{
+	  job->activeWorkers.notify_all ();
+	}
+    }
+}
+
+void
+WorkStealingExecutor::participate (Job &job, unsigned participantIndex)
+{
+  auto &self = *job.participants[participantIndex];
+  Range range;
+  while (takeRange (job, participantIndex, range))
+    {
+      runRange (job, self, range);
+    }
+}
+
+bool
+WorkStealingExecutor::takeRange (Job &job, unsigned participantIndex, Range &range)
+{
+  {
+    auto &self = *job.participants[participantIndex];
+    std::unique_lock<std::mutex> lock (self.dequeMutex);
+    if (!self.ranges.empty ())
+      {
+	range = self.ranges.back ();
+	self.ranges.pop_back ();
+	return true;
+      }
+  }
+
+  // Steal the oldest (largest) range of another participant, starting after ourselves to spread the thieves.
+  auto participantCount = job.participants.size ();
+  for (std::size_t i = 1; i < participantCount; ++i)
+    {
+      auto &victim = *job.participants[(participantIndex + i) % participantCount];
+      std::unique_lock<std::mutex> lock (victim.dequeMutex);
+      if (!victim.ranges.empty ())
+	{
+	  range = victim.ranges.front ();
+	  victim.ranges.pop_front ();
+	  return true;
+	}
+    }
+  return false;
+}
+
+void
+WorkStealingExecutor::runRange (Job &job, Participant &self, Range range)
+{
+  while (range.begin < range.end)
+    {
+      // Keep one range up for grabs: split off the upper half whenever a thief has emptied our deque.
+      if (range.end - range.begin > 2 * job.grain)
+	{
+	  std::unique_lock<std::mutex> lock (self.dequeMutex);
+	  if (self.ranges.empty ())
+	    {
+	      auto middle = range.begin + (range.end - range.begin) / 2;
+	      self.ranges.push_back (Range { middle, range.end });
+	      range.end = middle;
+	      continue;
+	    }
+	}
+
+      auto chunkEnd = std::min (range.end, range.begin + job.grain);
+      try
+	{
+	  if (!job.hasFailed)
+	    {
+	      (*job.rangeFn) (range.begin, chunkEnd);
+	    }
+	}
+      catch (...)
+	{
+	  std::unique_lock<std::mutex> lock (job.exceptionMutex);
+	  if (!job.exception)
+	    {
+	      job.exception = std::current_exception ();
+	      job.hasFailed = true;
+	    }
+	}
+
+      if (job.remaining.fetch_sub (chunkEnd - range.begin) == chunkEnd - range.begin)
+	{
+	  job.remaining.notify_all ();
+	}
+      range.begin = chunkEnd;
+    }
+}
@@ -0,0 +1,451 @@
+#include "write_ahead_log.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "fast_hash.hpp"
+
+namespace
+{
+struct DecodedRecord
+{
+  uint64_t sequence;
+  WriteAheadLog::RecordType type;
+  std::string_view key;
+  std::string_view value;
+};
+
+std::size_t
+varintLength (uint64_t value)
+{
+  std::size_t length = 1;
+  for (; value >= 0x80; value >>= 7)
+    {
+      ++length;
+    }
+  return length;
+}
+
+void
+putVarint (std::string &out, uint64_t value)
+{
+  for (; value >= 0x80; value >>= 7)
+    {
+      out.push_back (char (value | 0x80));
+    }
+  out.push_back (char (value));
+}
+
+bool
+getVarint (std::string_view bytes, std::size_t &position, uint64_t &value)
+{
+  value = 0;
+  for (int shift = 0; shift < 64 && position < bytes.size (); shift += 7)
+    {
+      auto byte = uint8_t (bytes[position++]);
+      value |= uint64_t (byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+	{
+	  return true;
+	}
+    }
+  return false;
+}
+
+uint32_t
+checksum (std::string_view payload)
+{
+  return uint32_t (ByteHash::hash (payload.data (), payload.size ()));
+}
+
+/// Calls onRecord for each intact record at the start of bytes; returns the length of that intact prefix.
+template <class OnRecordT>
+std::size_t
+decodeRecords (std::string_view bytes, OnRecordT &&onRecord)
+{
+  std::size_t position = 0;
+  while (position < bytes.size ())
+    {
+      auto recordStart = position;
+      uint64_t payloadLength;
+      if (!getVarint (bytes, position, payloadLength) || payloadLength > bytes.size () - position
+	  || bytes.size () - position - payloadLength < sizeof (uint32_t))
+	{
+	  return recordStart;
+	}
+      auto payload = bytes.substr (position, payloadLength);
+      uint32_t storedChecksum;
+      std::memcpy (&storedChecksum, bytes.data () + position + payloadLength, sizeof (storedChecksum));
+      if (storedChecksum != checksum (payload))
+	{
+	  return recordStart;
+	}
+
+      std::size_t payloadPosition = 0;
+      DecodedRecord record;
+      uint64_t keyLength;
+      if (!getVarint (payload, payloadPosition, record.sequence) || payloadPosition == payload.size ())
+	{
+	  return recordStart;
+	}
+      record.type = WriteAheadLog::RecordType (payload[payloadPosition++]);
+      if (!getVarint (payload, payloadPosition, keyLength) || keyLength > payload.size () - payloadPosition)
+	{
+	  return recordStart;
+	}
+      record.key = payload.substr (payloadPosition, keyLength);
+      record.value = payload.substr (payloadPosition + keyLength);
+
+      onRecord (record);
+      position += payloadLength + sizeof (uint32_t);
+    }
+  return position;
+}
+
+bool
+readFile (const std::string &aPath, std::string &contents)
+{
+  std::ifstream input (aPath, std::ios::binary);
+  if (!input)
+    {
+      return false;
+    }
+  contents.assign (std::istreambuf_iterator<char> (input), std::istreambuf_iterator<char> ());
+  return true;
+}
+
+std::FILE *
+openForAppend (const std::string &aPath)
+{
+  auto file = std::fopen (aPath.c_str (), "ab");
+  if (!file)
+    {
+      throw std::system_error (errno, std::generic_category (), "cannot open " + aPath);
+    }
+  return file;
+}
+
+/// Makes a rename in the file's directory durable (POSIX only; a no-op elsewhere).
+void
+syncDirectoryOf (const std::string &aPath)
+{
+#ifndef _WIN32
+  auto directory = std::filesystem::path (aPath).parent_path ();
+  auto descriptor = open (directory.empty () ? "." : directory.c_str (), O_RDONLY);
+  if (descriptor >= 0)
+    {
+      fsync (descriptor);
+      close (descriptor);
+    }
+#endif
+}
+} // namespace
+
+WriteAheadLog::SnapshotWriter::SnapshotWriter (const std::string &aPath, uint64_t aSequence)
+  : path (aPath), sequence (aSequence), file (nullptr)
+{
+  file = std::fopen ((path + ".tmp").c_str (), "wb");
+  if (!file)
+    {
+      throw std::system_error (errno, std::generic_category (), "cannot create " + path + ".tmp");
+    }
+  encodeRecord (buffer, sequence, RecordType::CHECKPOINT, {}, {});
+}
+
+WriteAheadLog::SnapshotWriter::~SnapshotWriter ()
+{
+  if (file)
+    {
+      std::fclose (file);
+      std::remove ((path + ".tmp").c_str ());
+    }
+}
+
+void
+WriteAheadLog::SnapshotWriter::add (std::string_view key, std::string_view value)
+{
+  encodeRecord (buffer, sequence, RecordType::PUT, key, value);
+  if (buffer.size () >= flushThreshold)
+    {
+      if (std::fwrite (buffer.data (), 1, buffer.size (), file) != buffer.size ())
+	{
+	  throw std::runtime_error ("cannot write " + path + ".tmp");
+	}
+      buffer.clear ();
+    }
+}
+
+void
+WriteAheadLog::SnapshotWriter::commit ()
+{
+  if (std::fwrite (buffer.data (), 1, buffer.size (), file) != buffer.size () || !syncFile (file))
+    {
+      throw std::runtime_error ("cannot write " + path + ".tmp");
+    }
+  std::fclose (file);
+  file = nullptr;
+  std::filesystem::rename (path + ".tmp", path);
+  syncDirectoryOf (path);
+}
+
+WriteAheadLog::WriteAheadLog (const std::string &aPath, Durability aDurability, uint64_t firstSequence,
+			      std::chrono::milliseconds aCommitInterval)
+  : path (aPath), durability (aDurability), commitInterval (aCommitInterval), nextSequence (firstSequence),
+    file (openForAppend (aPath))
+{
+  commitThread = std::thread ([this] () { commitLoop (); });
+}
+
+WriteAheadLog::~WriteAheadLog ()
+{
+  {
+    std::unique_lock<std::mutex> lock (commitMutex);
+    isStopping = true;
+  }
+  commitCondition.notify_one ();
+  commitThread.join ();
+
+  writeStripes (true);
+  std::fclose (file);
+}
+
+bool
+WriteAheadLog::syncFile (std::FILE *file)
+{
+  if (std::fflush (file) != 0)
+    {
+      return false;
+    }
+#ifdef _WIN32
+  return _commit (_fileno (file)) == 0;
+#else
+  return fsync (fileno (file)) == 0;
+#endif
+}
+
+std::size_t
+WriteAheadLog::getThreadStripe ()
+{
+  static std::atomic<std::size_t> nextStripe = 0;
+  static thread_local std::size_t threadStripe = nextStripe++ % stripeCount;
+  return threadStripe;
+}
+
+void
+WriteAheadLog::encodeRecord (std::string &out, uint64_t sequence, RecordType type, std::string_view key,
+			     std::string_view value)
+{
+  auto payloadLength = varintLength (sequence) + 1 + varintLength (key.size ()) + key.size () + value.size ();
+  putVarint (out, payloadLength);
+  auto payloadStart = out.size ();
+  putVarint (out, sequence);
+  out.push_back (char (type));
+  putVarint (out, key.size ());
+  out.append (key);
+  out.append (value);
+
+  auto payloadChecksum = checksum (std::string_view (out).substr (payloadStart));
+  out.append (reinterpret_cast<const char *> (&payloadChecksum), sizeof (payloadChecksum));
+}
+
+void
+WriteAheadLog::append (RecordType type, std::string_view key, std::string_view value)
+{
+  auto &stripe = stripes[getThreadStripe ()];
+  bool isFull;
+  {
+    std::unique_lock<std::mutex> lock (stripe.mutex);
+    encodeRecord (stripe.records, nextSequence++, type, key, value);
+    isFull = stripe.records.size () >= flushThreshold;
+  }
+  if (isFull && !isFlushRequested.exchange (true))
+    {
+      commitCondition.notify_one ();
+    }
+}
+
+void
+WriteAheadLog::waitForCommit ()
+{
+  if (durability == Durability::PER_OPERATION)
+    {
+      waitForRound (false);
+    }
+}
+
+void
+WriteAheadLog::commit ()
+{
+  waitForRound (true);
+}
+
+void
+WriteAheadLog::waitForRound (bool sync)
+{
+  std::unique_lock<std::mutex> lock (commitMutex);
+  // The round running now may have collected our stripe before our records; the next one cannot have.
+  auto targetRound = startedRounds + 1;
+  isCommitRequested = true;
+  isSyncRequested = isSyncRequested || sync;
+  commitCondition.notify_one ();
+  committedCondition.wait (lock, [this, targetRound] () { return completedRounds >= targetRound; });
+
+  if (hasFailed)
+    {
+      throw std::runtime_error ("cannot write the log " + path);
+    }
+}
+
+void
+WriteAheadLog::rotate ()
+{
+  commit ();
+
+  std::unique_lock<std::mutex> lock (fileMutex);
+  std::fclose (file);
+  file = nullptr;
+  std::filesystem::rename (path, path + ".old");
+  file = openForAppend (path);
+  syncDirectoryOf (path);
+}
+
+void
+WriteAheadLog::commitLoop ()
+{
+  std::unique_lock<std::mutex> lock (commitMutex);
+  while (!isStopping)
+    {
+      commitCondition.wait_for (lock, commitInterval,
+				[this] () { return isCommitRequested || isFlushRequested || isStopping; });
+
+      // Everyone waiting now is served by this round: that is the group commit.
+      bool sync = isSyncRequested || durability != Durability::NONE;
+      isCommitRequested = false;
+      isSyncRequested = false;
+      isFlushRequested = false;
+      ++startedRounds;
+
+      lock.unlock ();
+      writeStripes (sync);
+      lock.lock ();
+
+      ++completedRounds;
+      committedCondition.notify_all ();
+    }
+}
+
+void
+WriteAheadLog::writeStripes (bool sync)
+{
+  std::unique_lock<std::mutex> lock (fileMutex);
+  for (auto &stripe : stripes)
+    {
+      {
+	std::unique_lock<std::mutex> stripeLock (stripe.mutex);
+	writeBuffer.swap (stripe.records);
+      }
+      if (!writeBuffer.empty ())
+	{
+	  if (std::fwrite (writeBuffer.data (), 1, writeBuffer.size (), file) != writeBuffer.size ())
+	    {
+	      hasFailed = true;
+	    }
+	  hasUnsyncedWrites = true;
+	  writeBuffer.clear ();
+	}
+    }
+
+  if (!sync)
+    {
+      std::fflush (file);
+    }
+  else if (hasUnsyncedWrites)
+    {
+      if (!syncFile (file))
+	{
+	  hasFailed = true;
+	}
+      hasUnsyncedWrites = false;
+    }
+}
+
+uint64_t
+WriteAheadLog::readSnapshot (const std::string &aPath, const ApplyFn &apply)
+{
+  std::string contents;
+  if (!readFile (aPath, contents))
+    {
+      return 0;
+    }
+
+  bool hasCheckpoint = false;
+  uint64_t sequence = 0;
+  auto intactLength = decodeRecords (contents, [&] (const DecodedRecord &record) {
+    if (!hasCheckpoint)
+      {
+	hasCheckpoint = record.type == RecordType::CHECKPOINT;
+	sequence = record.sequence;
+      }
+    else
+      {
+	apply (record.type, record.key, record.value);
+      }
+  });
+  // Snapshots are renamed into place only once complete, so damage here is not a crash artifact.
+  if (!hasCheckpoint || intactLength != contents.size ())
+    {
+      throw std::runtime_error ("corrupt snapshot " + aPath);
+    }
+  return sequence;
+}
+
+uint64_t
+WriteAheadLog::replay (const std::string &aPath, uint64_t fromSequence, const ApplyFn &apply)
+{
+  std::string contents[2];
+  std::vector<DecodedRecord> records;
+  auto nextSequence = fromSequence;
+
+  const std::string segmentPaths[2] = { aPath + ".old", aPath };
+  for (int segment = 0; segment < 2; ++segment)
+    {
+      if (!readFile (segmentPaths[segment], contents[segment]))
+	{
+	  continue;
+	}
+      auto intactLength = decodeRecords (contents[segment], [&] (const DecodedRecord &record) {
+	nextSequence = std::max (nextSequence, record.sequence + 1);
+	if (record.sequence >= fromSequence)
+	  {
+	    records.push_back (record);
+	  }
+      });
+      // A crash in the middle of a write leaves a torn record; later appends must not end up behind it.
+      if (intactLength != contents[segment].size ())
+	{
+	  std::filesystem::resize_file (segmentPaths[segment], intactLength);
+	}
+    }
+
+  std::sort (records.begin (), records.end (),
+	     [] (const DecodedRecord &a, const DecodedRecord &b) { return a.sequence < b.sequence; });
+  for (const auto &record : records)
+    {
+      apply (record.type, record.key, record.value);
+    }
+  return nextSequence;
+}
@@ -0,0 +1,141 @@
+#include "writers_gate.hpp"
+
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace
+{
+/// The passes the thread holds, per gate; a thread uses few gates at a time, so a short list is searched.
+std::vector<std::pair<const WritersGate *, std::size_t>> &
+getHeldPasses ()
+{
+  static thread_local std::vector<std::pair<const WritersGate *, std::size_t>> heldPasses;
+  return heldPasses;
+}
+} // namespace
+
+std::size_t
+WritersGate::getThreadStripe ()
+{
+  static std::atomic<std::size_t> nextStripe = 0;
+  static thread_local std::size_t threadStripe = nextStripe++ % stripeCount;
+  return threadStripe;
+}
+
+bool
+WritersGate::isHeldByThisThread () const
+{
+  for (auto &held : getHeldPasses ())
+    {
+      if (held.first == this)
+	{
+	  return true;
+	}
+    }
+  return false;
+}
+
+bool
+WritersGate::tryEnter ()
+{
+  auto &writers = stripes[getThreadStripe ()].writers;
+  // Announce first, then check: lock () sets isClosed before it reads the stripes, so one of the two sees the other.
+  writers.fetch_add (1);
+  if (isClosed.load () && !isHeldByThisThread ())
+    {
+      writers.fetch_sub (1, std::memory_order_release);
+      return false;
+    }
+
+  auto &heldPasses = getHeldPasses ();
+  for (auto &held : heldPasses)
+    {
+      if (held.first == this)
+	{
+	  ++held.second;
+	  return true;
+	}
+    }
+  heldPasses.emplace_back (this, 1);
+  return true;
+}
+
+void
+WritersGate::lock_shared ()
+{
+  while (!tryEnter ())
+    {
+      std::unique_lock<std::mutex> lock (openMutex);
+      openCondition.wait (lock, [this] () { return !isClosed.load (); });
+    }
+}
+
+bool
+WritersGate::try_lock_shared ()
+{
+  return tryEnter ();
+}
+
+void
+WritersGate::unlock_shared ()
+{
+  auto &heldPasses = getHeldPasses ();
+  for (auto held = heldPasses.begin (); held != heldPasses.end (); ++held)
+    {
+      if (held->first == this)
+	{
+	  if (--held->second == 0)
+	    {
+	      *held = heldPasses.back ();
+	      heldPasses.pop_back ();
+	    }
+	  break;
+	}
+    }
+  stripes[getThreadStripe ()].writers.fetch_sub (1, std::memory_order_release);
+}
+
+void
+WritersGate::lock ()
+{
+  closeMutex.lock ();
+  isClosed.store (true);
+  for (auto &stripe : stripes)
+    {
+      while (stripe.writers.load () != 0)
+	{
+	  std::this_thread::yield ();
+	}
+    }
+}
+
+bool
+WritersGate::try_lock ()
+{
+  if (!closeMutex.try_lock ())
+    {
+      return false;
+    }
+  isClosed.store (true);
+  for (auto &stripe : stripes)
+    {
+      if (stripe.writers.load () != 0)
+	{
+	  unlock ();
+	  return false;
+	}
+    }
+  return true;
+}
+
+void
+WritersGate::unlock ()
+{
+  {
+    std::unique_lock<std::mutex> lock (openMutex);
+    isClosed.store (false);
+  }
+  openCondition.notify_all ();
+  closeMutex.unlock ();
+}